@@ -0,0 +1,357 @@
+#include "bus.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Microbenchmarks for the interpreter hot paths. Results go to stdout as JSON
+// (one benchmark per line) so two runs can be diffed with --compare:
+//
+//   gba_bench [--filter <substring>] > before.json
+//   gba_bench --compare before.json after.json [--threshold <percent>]
+
+#define SAMPLES 9
+#define SAMPLE_NS 20000000.0 // Target length of one timed sample
+#define THRESHOLD 3.0        // Default minimum change in percent
+
+// Keeps the compiler from dropping results nobody reads
+template <typename T> static inline void keep(T const &val) {
+  asm volatile("" : : "r,m"(val) : "memory");
+}
+
+struct Result {
+  std::string name;
+  double ns_per_op; // Median over all samples
+  double mad_ns;    // Median absolute deviation, the noise estimate
+};
+
+static double median(std::vector<double> v) {
+  std::sort(v.begin(), v.end());
+  return v[v.size() / 2];
+}
+
+// Friend of CPU, Bus and PPU so it can time the private hot paths directly
+struct Bench {
+  CPU *cpu;
+  Bus *bus;
+  PPU *ppu;
+
+  const char *filter;
+  std::vector<Result> results;
+
+  Bench(const char *filter) : filter(filter) {
+    cpu = new CPU();
+    bus = new Bus(*cpu);
+    ppu = new PPU(*bus, true);
+    bus->attach_ppu(ppu);
+    cpu->set_bus(bus);
+    cpu->reset();
+    cpu->running = true;
+  }
+
+  ~Bench() { delete cpu; }
+
+  // `body` performs `ops` operations per call
+  template <typename F> void run(const std::string &name, uint32_t ops, F body) {
+    if (filter && name.find(filter) == std::string::npos) {
+      return;
+    }
+
+    // Calibrate the number of calls per sample
+    uint64_t calls = 1;
+    while (true) {
+      auto start_time = std::chrono::steady_clock::now();
+      for (uint64_t i = 0; i < calls; i++) {
+        body();
+      }
+      auto now = std::chrono::steady_clock::now();
+      double ns = std::chrono::duration<double, std::nano>(now - start_time)
+                      .count();
+      if (ns >= SAMPLE_NS / 10) {
+        calls = std::max<uint64_t>(1, calls * SAMPLE_NS / ns);
+        break;
+      }
+      calls *= 2;
+    }
+
+    std::vector<double> samples;
+    for (int s = 0; s < SAMPLES; s++) {
+      auto start_time = std::chrono::steady_clock::now();
+      for (uint64_t i = 0; i < calls; i++) {
+        body();
+      }
+      auto now = std::chrono::steady_clock::now();
+      double ns = std::chrono::duration<double, std::nano>(now - start_time)
+                      .count();
+      samples.push_back(ns / (calls * ops));
+    }
+
+    double med = median(samples);
+    std::vector<double> dev;
+    for (double x : samples) {
+      dev.push_back(std::fabs(x - med));
+    }
+    results.push_back({name, med, median(dev)});
+    fprintf(stderr, "%-32s %10.3f ns/op %14.0f ops/s\n", name.c_str(), med,
+            1e9 / med);
+  }
+
+  void barrel_shift() {
+    static const char *names[] = {"lsl", "lsr", "asr", "ror"};
+    for (int t = CPU::LSL; t <= CPU::ROR; t++) {
+      run(std::string("cpu.barrel_shift.") + names[t], 256, [&] {
+        uint32_t acc = 0;
+        for (uint32_t i = 0; i < 256; i++) {
+          uint32_t val = 0x87654321 ^ (i * 0x01010101);
+          bool carry = cpu->barrel_shift(val, static_cast<CPU::SHIFT>(t),
+                                         i & 0x1f, false);
+          acc += val + carry;
+        }
+        keep(acc);
+      });
+    }
+  }
+
+  void eval_cond() {
+    run("cpu.eval_cond", 16 * 15, [&] {
+      uint32_t acc = 0;
+      for (uint32_t flags = 0; flags < 16; flags++) {
+        cpu->set_cpsr((cpu->cpsr & 0x0fffffff) | (flags << 28));
+        for (uint32_t cond = CPU::EQ; cond <= CPU::AL; cond++) {
+          acc += cpu->eval_cond(static_cast<CPU::COND>(cond));
+        }
+      }
+      keep(acc);
+    });
+  }
+
+  void arm_dispatch() {
+    static const uint32_t dproc[] = {
+        0xE0810002, // add r0, r1, r2
+        0xE0532001, // subs r2, r3, r1
+        0xE1A03184, // mov r3, r4, lsl #3
+        0xE1540005, // cmp r4, r5
+        0x01855006, // orreq r5, r5, r6
+        0xE0065007, // and r5, r6, r7
+        0xE3A0602A, // mov r6, #42
+        0xE1E07000, // mvn r7, r0
+    };
+    static const uint32_t sdt[] = {
+        0xE5980000, // ldr r0, [r8]
+        0xE5881004, // str r1, [r8, #4]
+        0xE5D82008, // ldrb r2, [r8, #8]
+        0xE588300C, // str r3, [r8, #12]
+    };
+
+    cpu->cpsr &= ~CPU::T;
+    cpu->regs[8] = 0x03000000;
+    run("cpu.arm_dispatch.dproc", 8 * 64, [&] {
+      for (int n = 0; n < 64; n++) {
+        for (uint32_t instr : dproc) {
+          cpu->arm_execute(instr);
+        }
+      }
+    });
+    run("cpu.arm_dispatch.sdt", 4 * 64, [&] {
+      for (int n = 0; n < 64; n++) {
+        for (uint32_t instr : sdt) {
+          cpu->arm_execute(instr);
+        }
+      }
+    });
+  }
+
+  void thumb_dispatch() {
+    static const uint16_t program[] = {
+        0x0088, // lsl r0, r1, #2
+        0x191A, // add r2, r3, r4
+        0x2105, // mov r1, #5
+        0x2905, // cmp r1, #5
+        0x3201, // add r2, #1
+        0x3B01, // sub r3, #1
+        0x4288, // cmp r0, r1
+        0x0854, // lsr r4, r2, #1
+    };
+
+    cpu->cpsr |= CPU::T;
+    run("cpu.thumb_dispatch", 8 * 64, [&] {
+      for (int n = 0; n < 64; n++) {
+        for (uint16_t instr : program) {
+          cpu->thumb_execute(instr);
+        }
+      }
+    });
+    cpu->cpsr &= ~CPU::T;
+  }
+
+  void bus_access() {
+    static const struct {
+      const char *name;
+      uint32_t base;
+      bool writable;
+    } regions[] = {
+        {"ewram", 0x02000000, true},  {"iwram", 0x03000000, true},
+        {"mmio", 0x04000010, true},   {"palram", 0x05000000, true},
+        {"vram", 0x06000000, true},   {"oam", 0x07000000, true},
+        {"rom", 0x08000000, false},
+    };
+
+    for (const auto &region : regions) {
+      uint32_t base = region.base;
+      run(std::string("bus.read32.") + region.name, 256, [&] {
+        uint32_t acc = 0;
+        for (uint32_t i = 0; i < 256; i++) {
+          acc += bus->read32(base + ((i * 4) & 0x3f), CPU::SEQ);
+        }
+        keep(acc);
+      });
+      run(std::string("bus.read16.") + region.name, 256, [&] {
+        uint32_t acc = 0;
+        for (uint32_t i = 0; i < 256; i++) {
+          acc += bus->read16(base + ((i * 2) & 0x3f), CPU::SEQ);
+        }
+        keep(acc);
+      });
+      if (!region.writable) {
+        continue;
+      }
+      run(std::string("bus.write32.") + region.name, 256, [&] {
+        for (uint32_t i = 0; i < 256; i++) {
+          bus->write32(base + ((i * 4) & 0x3f), i, CPU::SEQ);
+        }
+      });
+    }
+  }
+
+  void render() {
+    for (uint32_t i = 0; i < sizeof(bus->vram); i++) {
+      bus->vram[i] = i * 7;
+    }
+    for (uint32_t i = 0; i < sizeof(bus->palram); i++) {
+      bus->palram[i] = i * 13;
+    }
+
+    // Only the bitmap modes are rendered so far
+    for (uint8_t mode : {3, 4}) {
+      run("ppu.render_scanline.mode" + std::to_string(mode), SCREEN_HEIGHT,
+          [&] {
+            ppu->lcd.dispcnt.bits.bgMode = mode;
+            for (uint32_t y = 0; y < SCREEN_HEIGHT; y++) {
+              ppu->render_scanline(y);
+            }
+            keep(ppu->frame[0]);
+          });
+    }
+    ppu->lcd.dispcnt.full = 0;
+  }
+
+  void print_json() {
+    printf("{\n  \"benchmarks\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+      const Result &r = results[i];
+      printf("    {\"name\": \"%s\", \"ns_per_op\": %.4f, \"ops_per_sec\": "
+             "%.0f, \"mad_ns\": %.4f, \"samples\": %d}%s\n",
+             r.name.c_str(), r.ns_per_op, 1e9 / r.ns_per_op, r.mad_ns,
+             SAMPLES, (i + 1 < results.size()) ? "," : "");
+    }
+    printf("  ]\n}\n");
+  }
+};
+
+static bool load_json(const char *path, std::vector<Result> &results) {
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    return false;
+  }
+
+  char line[512];
+  while (fgets(line, sizeof(line), fp)) {
+    char name[256];
+    double ns, ops, mad;
+    if (sscanf(line,
+               " {\"name\": \"%255[^\"]\", \"ns_per_op\": %lf, "
+               "\"ops_per_sec\": %lf, \"mad_ns\": %lf",
+               name, &ns, &ops, &mad) == 4) {
+      results.push_back({name, ns, mad});
+    }
+  }
+
+  fclose(fp);
+  return true;
+}
+
+// A change only counts if it's above the threshold and well outside the
+// spread both runs measured. Returns 1 if anything got slower.
+static int compare(const char *base_path, const char *new_path,
+                   double threshold) {
+  std::vector<Result> base, cand;
+  if (!load_json(base_path, base) || !load_json(new_path, cand)) {
+    fprintf(stderr, "Failed to read %s or %s\n", base_path, new_path);
+    return 2;
+  }
+
+  int regressions = 0;
+  printf("%-32s %10s %10s %8s\n", "benchmark", "base ns", "new ns", "delta");
+  for (const Result &b : base) {
+    auto it = std::find_if(cand.begin(), cand.end(),
+                           [&](const Result &c) { return c.name == b.name; });
+    if (it == cand.end()) {
+      continue;
+    }
+
+    double delta = (it->ns_per_op - b.ns_per_op) / b.ns_per_op * 100;
+    double noise = 3 * (b.mad_ns + it->mad_ns) / b.ns_per_op * 100;
+    const char *verdict = "";
+    if (std::fabs(delta) > std::max(threshold, noise)) {
+      verdict = (delta > 0) ? "slower" : "faster";
+      regressions += (delta > 0);
+    }
+    printf("%-32s %10.3f %10.3f %+7.1f%% %s\n", b.name.c_str(), b.ns_per_op,
+           it->ns_per_op, delta, verdict);
+  }
+
+  return regressions ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+  const char *filter = nullptr;
+  const char *compare_paths[2] = {nullptr, nullptr};
+  double threshold = THRESHOLD;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--filter") && i + 1 < argc) {
+      filter = argv[++i];
+    } else if (!strcmp(argv[i], "--compare") && i + 2 < argc) {
+      compare_paths[0] = argv[++i];
+      compare_paths[1] = argv[++i];
+    } else if (!strcmp(argv[i], "--threshold") && i + 1 < argc) {
+      threshold = atof(argv[++i]);
+    } else {
+      fprintf(stderr,
+              "Usage: %s [--filter <substring>]\n"
+              "       %s --compare <base.json> <new.json> "
+              "[--threshold <percent>]\n",
+              argv[0], argv[0]);
+      return 2;
+    }
+  }
+
+  if (compare_paths[0]) {
+    return compare(compare_paths[0], compare_paths[1], threshold);
+  }
+
+  Bench bench(filter);
+  bench.barrel_shift();
+  bench.eval_cond();
+  bench.arm_dispatch();
+  bench.thumb_dispatch();
+  bench.bus_access();
+  bench.render();
+  bench.print_json();
+
+  return 0;
+}
@@ -0,0 +1,53 @@
+#include "resampler.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+// Resamples a few seconds of GBA-rate stereo audio to the host rate with every
+// quality/kernel combination and reports output samples per second.
+
+#define IN_RATE 32768.0
+#define OUT_RATE 48000.0
+#define SECONDS 30
+
+int main() {
+  static const char *quality_names[] = {"low", "medium", "high"};
+  static const char *kernel_names[] = {"scalar", "sse", "avx"};
+
+  size_t in_frames = static_cast<size_t>(IN_RATE) * SECONDS;
+  std::vector<float> in(in_frames * 2);
+  for (size_t i = 0; i < in_frames; i++) {
+    in[2 * i + 0] = 0.5f * std::sin(2 * M_PI * 440.0 * i / IN_RATE);
+    in[2 * i + 1] = 0.5f * std::sin(2 * M_PI * 660.0 * i / IN_RATE);
+  }
+
+  // Push and pull in mixer-sized chunks, as the real pipeline would
+  const size_t chunk = 1024;
+  std::vector<float> out(chunk * 4);
+
+  printf("%-8s %-8s %14s\n", "quality", "kernel", "samples/s");
+  for (int q = Resampler::LOW; q <= Resampler::HIGH; q++) {
+    for (int k = Resampler::SCALAR; k <= Resampler::AVX; k++) {
+      Resampler resampler(IN_RATE, OUT_RATE,
+                          static_cast<Resampler::QUALITY>(q));
+      if (!resampler.set_kernel(static_cast<Resampler::KERNEL>(k))) {
+        continue;
+      }
+
+      size_t produced = 0;
+      auto start_time = std::chrono::steady_clock::now();
+      for (size_t i = 0; i < in_frames; i += chunk) {
+        resampler.push(in.data() + 2 * i, chunk);
+        produced += resampler.pull(out.data(), out.size() / 2);
+      }
+      auto now = std::chrono::steady_clock::now();
+      double elapsed = std::chrono::duration<double>(now - start_time).count();
+
+      printf("%-8s %-8s %14.0f\n", quality_names[q], kernel_names[k],
+             produced / elapsed);
+    }
+  }
+
+  return 0;
+}
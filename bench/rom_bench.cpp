@@ -0,0 +1,303 @@
+#include "bus.h"
+#include "rom_builder.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+// Runs synthetic ROMs through the interpreter loop and reports emulated MIPS
+// and frames per second. Every ROM loops forever, so each one runs for the
+// same number of emulated frames.
+//
+//   gba_rom_bench [frames]
+
+#define FRAMES 120
+#define CYCLES_PER_FRAME (228 * (PPU::HDRAW_CYCLES + PPU::HBLANK_CYCLES))
+
+using R = RomBuilder;
+
+// Register shifts/logic mixed with flag setting arithmetic
+static std::vector<uint8_t> arm_alu() {
+  R rom;
+  R::Label outer = rom.label(), inner = rom.label();
+  rom.mov32(1, 0x12345678);
+  rom.dp_imm(R::MOV, false, 2, 0, 3);
+  rom.bind(outer);
+  rom.mov32(0, 4096);
+  rom.bind(inner);
+  rom.dp_reg(R::ADD, false, 1, 1, 2);
+  rom.dp_reg(R::EOR, false, 3, 1, 2, R::LSL, 3);
+  rom.dp_reg(R::ORR, false, 4, 3, 1, R::LSR, 5);
+  rom.dp_reg(R::AND, false, 5, 4, 1);
+  rom.dp_reg(R::SUB, false, 2, 5, 3, R::ASR, 2);
+  rom.dp_reg(R::ADD, true, 6, 1, 4);
+  rom.dp_imm(R::SUB, true, 0, 0, 1);
+  rom.b(inner, R::NE);
+  rom.b(outer);
+  return rom.finish();
+}
+
+static std::vector<uint8_t> thumb_alu() {
+  R rom;
+  R::Label main = rom.label(), outer = rom.label(), inner = rom.label();
+  rom.b(main);
+
+  uint32_t entry = rom.here();
+  rom.t_mov(1, 0x5a);
+  rom.t_mov(2, 3);
+  rom.bind(outer);
+  rom.t_mov(0, 0xff);
+  rom.t_lsl(0, 0, 4);
+  rom.bind(inner);
+  rom.t_add_reg(1, 1, 2);
+  rom.t_mov(3, 0x3c);
+  rom.t_alu(R::T_EOR, 3, 1);
+  rom.t_alu(R::T_ORR, 3, 2);
+  rom.t_lsl(4, 1, 3);
+  rom.t_alu(R::T_AND, 4, 3);
+  rom.t_lsr(5, 4, 5);
+  rom.t_alu(R::T_MUL, 5, 2);
+  rom.t_sub_reg(2, 5, 4);
+  rom.t_sub(0, 1);
+  rom.t_b(inner, R::NE);
+  rom.t_b(outer);
+
+  rom.align(4);
+  rom.bind(main);
+  rom.mov32(0, entry | 1);
+  rom.bx(0);
+  return rom.finish();
+}
+
+static std::vector<uint8_t> arm_ldst() {
+  R rom;
+  R::Label outer = rom.label(), inner = rom.label();
+  rom.bind(outer);
+  rom.mov32(8, 0x03000000);
+  rom.mov32(0, 2048);
+  rom.bind(inner);
+  rom.ldr(1, 8);
+  rom.dp_imm(R::ADD, false, 1, 1, 1);
+  rom.ldrh(2, 8, 4);
+  rom.strh(2, 8, 6);
+  rom.ldr(3, 8, 8, false, true);
+  rom.str(3, 8, 9, false, true);
+  rom.str(1, 8, 4, true);
+  rom.dp_imm(R::SUB, true, 0, 0, 1);
+  rom.b(inner, R::NE);
+  rom.b(outer);
+  return rom.finish();
+}
+
+static std::vector<uint8_t> thumb_ldst() {
+  R rom;
+  R::Label main = rom.label(), outer = rom.label(), inner = rom.label();
+  rom.b(main);
+
+  uint32_t entry = rom.here();
+  rom.bind(outer);
+  rom.t_mov(7, 3);
+  rom.t_lsl(7, 7, 24); // IWRAM
+  rom.t_mov(0, 0xff);
+  rom.t_lsl(0, 0, 3);
+  rom.bind(inner);
+  rom.t_ldr(1, 7);
+  rom.t_add(1, 1);
+  rom.t_str(1, 7);
+  rom.t_ldr(2, 7, 4);
+  rom.t_str(2, 7, 8);
+  rom.t_add(7, 4);
+  rom.t_sub(0, 1);
+  rom.t_b(inner, R::NE);
+  rom.t_b(outer);
+
+  rom.align(4);
+  rom.bind(main);
+  rom.mov32(0, entry | 1);
+  rom.bx(0);
+  return rom.finish();
+}
+
+// 16K EWRAM -> IWRAM block copies, 8 words per LDM/STM pair
+static std::vector<uint8_t> ldm_stm_copy() {
+  R rom;
+  R::Label outer = rom.label(), inner = rom.label();
+  rom.bind(outer);
+  rom.mov32(0, 0x02000000);
+  rom.mov32(1, 0x03000000);
+  rom.mov32(10, 16384 / 32);
+  rom.bind(inner);
+  rom.ldmia(0, 0x03fc); // r2-r9
+  rom.stmia(1, 0x03fc);
+  rom.dp_imm(R::SUB, true, 10, 10, 1);
+  rom.b(inner, R::NE);
+  rom.b(outer);
+  return rom.finish();
+}
+
+// Fills the whole mode 3 frame buffer with a new color every pass
+static std::vector<uint8_t> mode3_fill() {
+  R rom;
+  R::Label outer = rom.label(), inner = rom.label();
+  rom.mov32(0, 0x04000000);
+  rom.mov32(1, 0x0403); // Mode 3, BG2 on
+  rom.strh(1, 0);
+  rom.mov32(2, 0x001f001f);
+  rom.mov32(5, 0x00210021);
+  rom.bind(outer);
+  rom.mov32(0, 0x06000000);
+  rom.mov32(3, SCREEN_WIDTH * SCREEN_HEIGHT / 2);
+  rom.bind(inner);
+  rom.str(2, 0, 4, true);
+  rom.dp_imm(R::SUB, true, 3, 3, 1);
+  rom.b(inner, R::NE);
+  rom.dp_reg(R::ADD, false, 2, 2, 5);
+  rom.b(outer);
+  return rom.finish();
+}
+
+// Sets up a grey ramp palette, then fills the mode 4 frame buffer
+static std::vector<uint8_t> mode4_fill() {
+  R rom;
+  R::Label palette = rom.label(), outer = rom.label(), inner = rom.label();
+  rom.mov32(0, 0x04000000);
+  rom.mov32(1, 0x0404); // Mode 4, BG2 on
+  rom.strh(1, 0);
+
+  rom.mov32(0, 0x05000000);
+  rom.dp_imm(R::MOV, false, 1, 0, 0);
+  rom.mov32(3, 0x0421);
+  rom.dp_imm(R::MOV, false, 4, 0, 0);
+  rom.bind(palette);
+  rom.strh(1, 0);
+  rom.dp_imm(R::ADD, false, 0, 0, 2);
+  rom.dp_reg(R::ADD, false, 1, 1, 3);
+  rom.dp_imm(R::ADD, false, 4, 4, 1);
+  rom.dp_imm(R::CMP, true, 0, 4, 1, 12); // 256
+  rom.b(palette, R::LT);
+
+  rom.mov32(2, 0x03020100);
+  rom.mov32(5, 0x01010101);
+  rom.bind(outer);
+  rom.mov32(0, 0x06000000);
+  rom.mov32(3, SCREEN_WIDTH * SCREEN_HEIGHT / 4);
+  rom.bind(inner);
+  rom.str(2, 0, 4, true);
+  rom.dp_imm(R::SUB, true, 3, 3, 1);
+  rom.b(inner, R::NE);
+  rom.dp_reg(R::ADD, false, 2, 2, 5);
+  rom.b(outer);
+  return rom.finish();
+}
+
+// Thumb code shaped like compiled C: a counted loop walking an array and
+// calling a leaf function, with CMP against the bound
+static std::vector<uint8_t> thumb_calls() {
+  R rom;
+  R::Label main = rom.label(), outer = rom.label(), inner = rom.label(),
+           func = rom.label();
+  rom.b(main);
+
+  uint32_t entry = rom.here();
+  rom.t_mov(4, 0xff);
+  rom.t_lsl(4, 4, 2);
+  rom.bind(outer);
+  rom.t_mov(7, 3);
+  rom.t_lsl(7, 7, 24); // IWRAM
+  rom.t_mov(3, 0);
+  rom.bind(inner);
+  rom.t_ldr(1, 7);
+  rom.t_add(7, 4);
+  rom.t_bl(func);
+  rom.t_add(3, 1);
+  rom.t_alu(R::T_CMP, 3, 4);
+  rom.t_b(inner, R::NE);
+  rom.t_b(outer);
+
+  rom.bind(func);
+  rom.t_add_reg(2, 2, 1);
+  rom.t_str(2, 7);
+  rom.t_bx(14);
+
+  rom.align(4);
+  rom.bind(main);
+  rom.mov32(0, entry | 1);
+  rom.bx(0);
+  return rom.finish();
+}
+
+// ARM loop calling a short Thumb function through BX and back
+static std::vector<uint8_t> interwork() {
+  R rom;
+  R::Label main = rom.label(), outer = rom.label(), inner = rom.label();
+  rom.b(main);
+
+  uint32_t func = rom.here();
+  rom.t_add_reg(0, 0, 1);
+  rom.t_alu(R::T_EOR, 1, 0);
+  rom.t_bx(14);
+
+  rom.align(4);
+  rom.bind(main);
+  rom.mov32(4, func | 1);
+  rom.bind(outer);
+  rom.mov32(5, 4096);
+  rom.bind(inner);
+  rom.dp_reg(R::MOV, false, 14, 0, 15); // Returns past the BX
+  rom.bx(4);
+  rom.dp_imm(R::SUB, true, 5, 5, 1);
+  rom.b(inner, R::NE);
+  rom.b(outer);
+  return rom.finish();
+}
+
+int main(int argc, char *argv[]) {
+  static const struct {
+    const char *name;
+    std::vector<uint8_t> (*build)();
+  } programs[] = {
+      {"arm_alu", arm_alu},           {"thumb_alu", thumb_alu},
+      {"arm_ldst", arm_ldst},         {"thumb_ldst", thumb_ldst},
+      {"ldm_stm_copy", ldm_stm_copy}, {"mode3_fill", mode3_fill},
+      {"mode4_fill", mode4_fill},     {"interwork", interwork},
+      {"thumb_calls", thumb_calls},
+  };
+
+  uint32_t frames = (argc > 1) ? atoi(argv[1]) : FRAMES;
+
+  printf("%-14s %14s %10s %10s %8s\n", "rom", "instructions", "MIPS",
+         "frames/s", "fused");
+  for (const auto &program : programs) {
+    std::vector<uint8_t> data = program.build();
+
+    CPU *cpu = new CPU();
+    Bus *bus = new Bus(*cpu);
+    PPU *ppu = new PPU(*bus, true);
+    bus->attach_ppu(ppu);
+    cpu->set_bus(bus);
+    bus->load_rom(data.data(), data.size());
+    bus->update_wait();
+    cpu->reset();
+
+    auto start_time = std::chrono::steady_clock::now();
+    uint64_t executed = cpu->run_cycles(uint64_t(frames) * CYCLES_PER_FRAME);
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - start_time).count();
+
+    // Share of instructions that ran as half of a fused pair
+    uint64_t interval_frames, host_ns;
+    Perf::Frame sum = bus->perf.take_interval(interval_frames, host_ns);
+    uint64_t fused = 0;
+    for (int f = 0; f < Perf::FUSION_COUNT; f++) {
+      fused += sum.fused[f];
+    }
+
+    printf("%-14s %14llu %10.2f %10.1f %7.1f%%%s\n", program.name,
+           static_cast<unsigned long long>(executed), executed / elapsed / 1e6,
+           frames / elapsed, executed ? 200.0 * fused / executed : 0.0,
+           cpu->is_running() ? "" : "  (stopped)");
+
+    delete cpu;
+  }
+
+  return 0;
+}
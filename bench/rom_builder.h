@@ -0,0 +1,273 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+/*
+ * Tiny ARM/Thumb emitter for synthetic benchmark ROMs. Code is laid out from
+ * the start of the cartridge (0x08000000), which is where the CPU starts
+ * without a BIOS. Branch targets are labels that can be bound before or after
+ * use; finish() patches the forward references.
+ */
+class RomBuilder {
+public:
+  static constexpr uint32_t BASE = 0x08000000;
+
+  enum COND {
+    EQ = 0x0,
+    NE = 0x1,
+    CS = 0x2,
+    CC = 0x3,
+    MI = 0x4,
+    PL = 0x5,
+    GE = 0xa,
+    LT = 0xb,
+    GT = 0xc,
+    LE = 0xd,
+    AL = 0xe,
+  };
+
+  enum DPROC {
+    AND = 0x0,
+    EOR = 0x1,
+    SUB = 0x2,
+    RSB = 0x3,
+    ADD = 0x4,
+    ADC = 0x5,
+    SBC = 0x6,
+    TST = 0x8,
+    CMP = 0xa,
+    ORR = 0xc,
+    MOV = 0xd,
+    BIC = 0xe,
+    MVN = 0xf,
+  };
+
+  enum SHIFT {
+    LSL = 0,
+    LSR = 1,
+    ASR = 2,
+    ROR = 3,
+  };
+
+  // Thumb format 4 ALU opcodes
+  enum TALU {
+    T_AND = 0x0,
+    T_EOR = 0x1,
+    T_LSL = 0x2,
+    T_LSR = 0x3,
+    T_ASR = 0x4,
+    T_ADC = 0x5,
+    T_SBC = 0x6,
+    T_ROR = 0x7,
+    T_TST = 0x8,
+    T_NEG = 0x9,
+    T_CMP = 0xa,
+    T_CMN = 0xb,
+    T_ORR = 0xc,
+    T_MUL = 0xd,
+    T_BIC = 0xe,
+    T_MVN = 0xf,
+  };
+
+  using Label = uint32_t;
+
+  inline uint32_t here() { return BASE + code.size(); }
+
+  inline Label label() {
+    labels.push_back(UNBOUND);
+    return labels.size() - 1;
+  }
+  inline void bind(Label l) { labels[l] = here(); }
+
+  inline void align(uint32_t n) {
+    while (code.size() % n) {
+      code.push_back(0);
+    }
+  }
+
+  /* ARM */
+
+  inline void arm(uint32_t instr) { emit32(instr); }
+
+  // <op>{s} rd, rn, #imm8 ror (2 * rot)
+  inline void dp_imm(DPROC op, bool s, uint8_t rd, uint8_t rn, uint8_t imm,
+                     uint8_t rot = 0) {
+    emit32(0xE2000000 | op << 21 | s << 20 | rn << 16 | rd << 12 |
+           (rot & 0xf) << 8 | imm);
+  }
+
+  // <op>{s} rd, rn, rm, <shift> #amount
+  inline void dp_reg(DPROC op, bool s, uint8_t rd, uint8_t rn, uint8_t rm,
+                     SHIFT shift = LSL, uint8_t amount = 0) {
+    emit32(0xE0000000 | op << 21 | s << 20 | rn << 16 | rd << 12 |
+           (amount & 0x1f) << 7 | shift << 5 | rm);
+  }
+
+  // Any 32-bit constant as MOV + up to three ORRs
+  inline void mov32(uint8_t rd, uint32_t val) {
+    dp_imm(MOV, false, rd, 0, val & 0xff);
+    for (int byte = 1; byte < 4; byte++) {
+      uint8_t imm = (val >> (byte * 8)) & 0xff;
+      if (imm) {
+        dp_imm(ORR, false, rd, rd, imm, 16 - byte * 4);
+      }
+    }
+  }
+
+  // ldr/str{b} rd, [rn, #offset], or rd, [rn], #offset when post
+  inline void ldr(uint8_t rd, uint8_t rn, uint16_t offset = 0,
+                  bool post = false, bool byte = false) {
+    sdt(true, rd, rn, offset, post, byte);
+  }
+  inline void str(uint8_t rd, uint8_t rn, uint16_t offset = 0,
+                  bool post = false, bool byte = false) {
+    sdt(false, rd, rn, offset, post, byte);
+  }
+
+  // ldrh/strh rd, [rn, #offset]
+  inline void ldrh(uint8_t rd, uint8_t rn, uint8_t offset = 0) {
+    emit32(0xE1D000B0 | rn << 16 | rd << 12 | (offset >> 4) << 8 |
+           (offset & 0xf));
+  }
+  inline void strh(uint8_t rd, uint8_t rn, uint8_t offset = 0) {
+    emit32(0xE1C000B0 | rn << 16 | rd << 12 | (offset >> 4) << 8 |
+           (offset & 0xf));
+  }
+
+  // ldmia/stmia rn!, {list}
+  inline void ldmia(uint8_t rn, uint16_t list) {
+    emit32(0xE8B00000 | rn << 16 | list);
+  }
+  inline void stmia(uint8_t rn, uint16_t list) {
+    emit32(0xE8A00000 | rn << 16 | list);
+  }
+
+  inline void b(Label target, COND cond = AL) {
+    fixups.push_back({static_cast<uint32_t>(code.size()), target, false});
+    emit32(cond << 28 | 0x0A000000);
+  }
+
+  inline void bx(uint8_t rm) { emit32(0xE12FFF10 | rm); }
+
+  /* Thumb */
+
+  inline void thumb(uint16_t instr) { emit16(instr); }
+
+  inline void t_mov(uint8_t rd, uint8_t imm) { emit16(0x2000 | rd << 8 | imm); }
+  inline void t_cmp(uint8_t rd, uint8_t imm) { emit16(0x2800 | rd << 8 | imm); }
+  inline void t_add(uint8_t rd, uint8_t imm) { emit16(0x3000 | rd << 8 | imm); }
+  inline void t_sub(uint8_t rd, uint8_t imm) { emit16(0x3800 | rd << 8 | imm); }
+
+  // add/sub rd, rs, rn
+  inline void t_add_reg(uint8_t rd, uint8_t rs, uint8_t rn) {
+    emit16(0x1800 | rn << 6 | rs << 3 | rd);
+  }
+  inline void t_sub_reg(uint8_t rd, uint8_t rs, uint8_t rn) {
+    emit16(0x1A00 | rn << 6 | rs << 3 | rd);
+  }
+
+  // lsl/lsr rd, rs, #amount
+  inline void t_lsl(uint8_t rd, uint8_t rs, uint8_t amount) {
+    emit16(0x0000 | (amount & 0x1f) << 6 | rs << 3 | rd);
+  }
+  inline void t_lsr(uint8_t rd, uint8_t rs, uint8_t amount) {
+    emit16(0x0800 | (amount & 0x1f) << 6 | rs << 3 | rd);
+  }
+
+  inline void t_alu(TALU op, uint8_t rd, uint8_t rs) {
+    emit16(0x4000 | op << 6 | rs << 3 | rd);
+  }
+
+  // ldr/str rd, [rb, #offset], offset in bytes
+  inline void t_ldr(uint8_t rd, uint8_t rb, uint8_t offset = 0) {
+    emit16(0x6800 | (offset >> 2) << 6 | rb << 3 | rd);
+  }
+  inline void t_str(uint8_t rd, uint8_t rb, uint8_t offset = 0) {
+    emit16(0x6000 | (offset >> 2) << 6 | rb << 3 | rd);
+  }
+
+  inline void t_b(Label target, COND cond = AL) {
+    fixups.push_back({static_cast<uint32_t>(code.size()), target, true});
+    emit16((cond == AL) ? 0xE000 : (0xD000 | cond << 8));
+  }
+
+  // Prefix + suffix pair
+  inline void t_bl(Label target) {
+    fixups.push_back({static_cast<uint32_t>(code.size()), target, true, true});
+    emit16(0xF000);
+    emit16(0xF800);
+  }
+
+  inline void t_bx(uint8_t rs) { emit16(0x4700 | rs << 3); }
+
+  // Patches branch offsets and returns the ROM image
+  inline std::vector<uint8_t> finish() {
+    for (const Fixup &f : fixups) {
+      uint32_t pc = BASE + f.pos + (f.thumb ? 4 : 8);
+      int32_t offset = static_cast<int32_t>(labels[f.target] - pc);
+      if (!f.thumb) {
+        uint32_t instr = read32(f.pos) | ((offset >> 2) & 0xffffff);
+        write32(f.pos, instr);
+      } else if (f.link) {
+        write16(f.pos, read16(f.pos) | ((offset >> 12) & 0x7ff));
+        write16(f.pos + 2, read16(f.pos + 2) | ((offset >> 1) & 0x7ff));
+      } else {
+        uint16_t instr = read16(f.pos);
+        instr |= ((instr & 0xF000) == 0xE000) ? ((offset >> 1) & 0x7ff)
+                                              : ((offset >> 1) & 0xff);
+        write16(f.pos, instr);
+      }
+    }
+    fixups.clear();
+    return code;
+  }
+
+private:
+  static constexpr uint32_t UNBOUND = ~0u;
+
+  struct Fixup {
+    uint32_t pos;
+    Label target;
+    bool thumb;
+    bool link = false;
+  };
+
+  std::vector<uint8_t> code;
+  std::vector<uint32_t> labels;
+  std::vector<Fixup> fixups;
+
+  inline void sdt(bool l, uint8_t rd, uint8_t rn, uint16_t offset, bool post,
+                  bool byte) {
+    // Pre-indexed without writeback, or post-indexed (always writes back)
+    emit32(0xE4800000 | !post << 24 | byte << 22 | l << 20 | rn << 16 |
+           rd << 12 | (offset & 0xfff));
+  }
+
+  inline void emit32(uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+      code.push_back(v >> (i * 8));
+    }
+  }
+  inline void emit16(uint16_t v) {
+    code.push_back(v);
+    code.push_back(v >> 8);
+  }
+
+  inline uint32_t read32(uint32_t pos) {
+    return code[pos] | code[pos + 1] << 8 | code[pos + 2] << 16 |
+           code[pos + 3] << 24;
+  }
+  inline uint16_t read16(uint32_t pos) {
+    return code[pos] | code[pos + 1] << 8;
+  }
+
+  inline void write32(uint32_t pos, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+      code[pos + i] = v >> (i * 8);
+    }
+  }
+  inline void write16(uint32_t pos, uint16_t v) {
+    code[pos] = v;
+    code[pos + 1] = v >> 8;
+  }
+};
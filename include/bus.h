@@ -1,6 +1,11 @@
 #pragma once
 #include "cpu.h"
+#include "dma.h"
+#include "movie.h"
+#include "perf.h"
 #include "ppu.h"
+#include "scheduler.h"
+#include "timer.h"
 
 #define BIOS_START (0x00000000) // BIOS - System ROM (16 KiB)
 #define BIOS_END (0x00003FFF)
@@ -38,10 +43,34 @@
 
 class Bus {
 public:
+  // Bit positions in REG_IE / REG_IF
+  enum IRQ {
+    IRQ_VBLANK = 0,
+    IRQ_HBLANK = 1,
+    IRQ_VCOUNTER = 2,
+    IRQ_TIMER0 = 3,
+    IRQ_TIMER1 = 4,
+    IRQ_TIMER2 = 5,
+    IRQ_TIMER3 = 6,
+    IRQ_COMM = 7,
+    IRQ_DMA0 = 8,
+    IRQ_DMA1 = 9,
+    IRQ_DMA2 = 10,
+    IRQ_DMA3 = 11,
+    IRQ_KEYPAD = 12,
+    IRQ_GAMEPAK = 13,
+  };
+
   Bus(CPU &cpu);
   ~Bus();
 
   void attach_ppu(PPU *ppu);
+  inline PPU *get_ppu() { return ppu; }
+
+  // Owned by the caller; while attached, keys only change at the start of
+  // VBlank (see Movie)
+  inline void attach_movie(Movie *movie) { this->movie = movie; }
+  inline Movie *get_movie() { return movie; }
 
   void write32(uint32_t addr, uint32_t data, CPU::CYCLE_TYPE type);
   uint32_t read32(uint32_t addr, CPU::CYCLE_TYPE type);
@@ -53,18 +82,94 @@ public:
   uint8_t read8(uint32_t addr, CPU::CYCLE_TYPE type);
 
   bool load_bios(const char *bios_file);
+  // Minimal stand-in for the BIOS image, loaded until load_bios() succeeds
+  void load_hle_bios();
   bool load_rom(const char *rom_file);
+  bool load_rom(const uint8_t *data, size_t size);
+
+  // Four character game code from the cartridge header
+  std::string get_game_code();
+
+  inline const uint8_t *get_rom() { return rom; }
+  inline size_t get_rom_size() { return rom_size; }
+  inline const uint8_t *get_bios() { return bios; }
 
   void update_wait();
 
   void set_last_cycle_type(CPU::CYCLE_TYPE cycle_type);
 
-  inline void tick_ppu(uint32_t cycles) { ppu->tick(cycles); }
+  void request_irq(IRQ irq);
+  // False while IME or IE rule out every interrupt
+  inline bool irqs_enabled() {
+    return iwpdc.ime.bits.disable && (iwpdc.ie.full & 0x3fff);
+  }
+
+  void set_keyinput(uint16_t keys);
+  inline uint16_t get_keyinput() { return keypad.keyinput.full; }
+
+  inline void trigger_dma(DMA::TIMING timing) { dma.trigger(timing); }
+
+  // A sample was consumed from each FIFO clocked by timer `id`
+  void fifo_tick(uint8_t id);
+
+  // Host memory backing [addr, addr + len) if the whole range is plain,
+  // contiguous memory without side effects, nullptr otherwise
+  uint8_t *get_host_ptr(uint32_t addr, uint32_t len, bool write);
+
+  // Accounts for `count` word accesses from `addr` up that the CPU made
+  // directly on get_host_ptr() memory: 1N + (count - 1)S, the same as a
+  // run of read32/write32 after a non-sequential access
+  void burst32(uint32_t addr, uint32_t count, bool write);
+
+  // Host memory the CPU may fetch opcodes from directly: the mirror of
+  // BIOS, EWRAM, IWRAM or ROM containing `addr`, as guest range
+  // [base, base + size). nullptr for everything else.
+  const uint8_t *get_fetch_page(uint32_t addr, uint32_t &base,
+                                uint32_t &size);
+
+  // Timing and counters for an opcode fetch the CPU read from a fetch page
+  inline void fetch_cycles(uint32_t addr, uint32_t size,
+                           CPU::CYCLE_TYPE type) {
+    uint32_t region = (addr >> 24) & 0xf;
+    perf.count_read(addr, size == 4 ? Perf::WORD : Perf::HALF);
+    if (prefetch.enabled && region - 0x8 < 0x6) {
+      cpu.cycle(prefetch_fetch(addr, size, type));
+    } else {
+      if (last_cycle_type == CPU::CYCLE_TYPE::NON_SEQ) {
+        type = CPU::CYCLE_TYPE::NON_SEQ;
+      }
+      cpu.cycle((size == 4 ? wait32 : wait16)[type][region]);
+    }
+    last_cycle_type = CPU::CYCLE_TYPE::SEQ;
+  }
+
+  // Data accesses to the cartridge interrupt the prefetch buffer
+  inline void stop_prefetch(uint32_t addr) {
+    if ((addr >> 24) - 0x8 < 0x6) {
+      prefetch.active = false;
+    }
+  }
+
+  inline uint32_t get_wait(uint32_t addr, uint32_t size,
+                           CPU::CYCLE_TYPE type) {
+    return (size == 4 ? wait32 : wait16)[type][(addr >> 24) & 0xf];
+  }
+
+  Scheduler scheduler;
+
+  // CPU and DMA accesses; FAST accesses (PPU, idle loop analysis) are free
+  // and not counted
+  Perf perf;
 
 private:
+  friend struct Bench;
+
   // std::unique_ptr<CPU> cpu;
   CPU &cpu;
   PPU *ppu;
+  Movie *movie;
+  Timer timer;
+  DMA dma;
 
   enum IO_REGS {
     /* LCD I/O Registers */
@@ -221,11 +326,11 @@ private:
   uint8_t bios[BIOS_END - BIOS_START + 1];
   uint8_t ewram[EWRAM_END - EWRAM_START + 1];
   uint8_t iwram[IWRAM_END - IWRAM_START + 1];
-  uint8_t mmio[MMIO_END - MMIO_START + 1];
   uint8_t palram[PALRAM_END - PALRAM_START + 1];
   uint8_t vram[VRAM_END - VRAM_START + 1];
   uint8_t oam[OAM_END - OAM_START + 1];
   uint8_t rom[CART_0_END - CART_0_START + 1];
+  size_t rom_size; // Bytes loaded, the rest of `rom` is zero
   // uint8_t cart_1[CART_1_END - CART_1_START + 1];
   // uint8_t cart_2[CART_2_END - CART_2_START + 1];
   uint8_t sram[SRAM_END - SRAM_START + 1];
@@ -243,9 +348,29 @@ private:
 
   IWPDC iwpdc;
   KEYPAD keypad;
+  SOUND sound;
+
+  // Bytes queued in Direct Sound FIFO A/B (the samples themselves are not
+  // mixed yet), used to request sound DMA when a FIFO runs low
+  uint8_t fifo_len[2];
 
   CPU::CYCLE_TYPE last_cycle_type;
 
+  // Game Pak prefetch buffer (WAITCNT bit 14). While the CPU runs from ROM
+  // and leaves the cartridge bus alone, it reads up to 8 halfwords past the
+  // last opcode fetch; a sequential fetch finding its opcode there takes 1
+  // cycle. Branches and cartridge data accesses start it over.
+  struct {
+    bool enabled;
+    bool active;       // head is valid, the last fetch came from ROM
+    uint32_t head;     // Address the next sequential fetch reads
+    uint32_t count;    // Halfwords buffered from head on
+    uint32_t progress; // Cycles into reading the halfword after those
+    uint64_t last;     // Scheduler time the buffer was last brought up to date
+  } prefetch;
+
+  uint32_t prefetch_fetch(uint32_t addr, uint32_t size, CPU::CYCLE_TYPE type);
+
   uint32_t wait16[2][16]{
       {1, 1, 3, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 1}, // NON_SEQ
       {1, 1, 3, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 1}, // SEQ
@@ -258,9 +383,43 @@ private:
 
   uint32_t read_open_bus(uint32_t addr);
   uint32_t read_sram(uint32_t addr);
-  void write_mmio(uint32_t addr, uint8_t data);
-  uint8_t read_mmio(uint32_t addr);
 
-  uint8_t read_keypad(uint32_t addr);
-  uint8_t read_lcd(uint32_t addr);
+  using IoWrite = void (Bus::*)(uint32_t addr, uint16_t data, uint16_t lanes);
+  using IoRead = uint16_t (Bus::*)(uint32_t addr);
+
+  // One descriptor per halfword of the I/O region. Accesses of any width are
+  // a masked store/load on `data` (`lanes` selects the bytes written), the
+  // optional callbacks handle side effects and computed values.
+  struct IoReg {
+    uint16_t *data; // nullptr if the register has no plain storage
+    uint16_t rmask;
+    uint16_t wmask;
+    IoWrite write; // runs after the masked store
+    IoRead read;   // replaces the load from `data`
+  };
+
+  IoReg io[(MMIO_END - MMIO_START + 1) / 2];
+
+  void init_io();
+  void map_io(uint32_t addr, uint16_t *data, uint16_t rmask, uint16_t wmask,
+              IoWrite write = nullptr, IoRead read = nullptr);
+  void write_io(uint32_t addr, uint16_t data, uint16_t lanes);
+  uint16_t read_io(uint32_t addr);
+
+  void update_irq();
+  void check_keypad_irq();
+
+  void write_dispcnt(uint32_t addr, uint16_t data, uint16_t lanes);
+  void write_affine_ref(uint32_t addr, uint16_t data, uint16_t lanes);
+  void write_soundcnt_h(uint32_t addr, uint16_t data, uint16_t lanes);
+  void write_fifo(uint32_t addr, uint16_t data, uint16_t lanes);
+  void write_dma_control(uint32_t addr, uint16_t data, uint16_t lanes);
+  void write_timer_control(uint32_t addr, uint16_t data, uint16_t lanes);
+  uint16_t read_timer_counter(uint32_t addr);
+  void write_keycnt(uint32_t addr, uint16_t data, uint16_t lanes);
+  void write_irq(uint32_t addr, uint16_t data, uint16_t lanes);
+  void write_if(uint32_t addr, uint16_t data, uint16_t lanes);
+  void write_waitcnt(uint32_t addr, uint16_t data, uint16_t lanes);
+  void write_postflg(uint32_t addr, uint16_t data, uint16_t lanes);
+  uint16_t read_postflg(uint32_t addr);
 };
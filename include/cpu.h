@@ -1,6 +1,12 @@
 #pragma once
+#include "trace.h"
+#include <array>
 #include <cstdint>
+#include <fstream>
 #include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #define NYI(str)                                                               \
   std::cout << "NYI: " << str << std::endl;                                    \
@@ -8,6 +14,7 @@
   return;
 
 class Bus;
+class Profiler;
 
 class CPU {
 
@@ -23,12 +30,66 @@ public:
 
   void set_bus(Bus *bus);
 
+  // load() then run()
   void start(const char *rom_file, const char *bios_file);
 
-  uint32_t get_reg(uint8_t rn);
-  void set_reg(uint8_t rn, uint32_t val);
+  // Loads the images and resets, without running
+  void load(const char *rom_file, const char *bios_file);
+
+  // SDL frontend: runs in real time until the window closes, writing every
+  // instruction to `trace_file` if given (see trace.h). Tracing turns off
+  // fusion. Events are polled once per frame.
+  void run(const char *trace_file = nullptr);
+
+  // The active bank always lives in regs, so these are plain array accesses
+  inline uint32_t get_reg(uint8_t rn) { return regs[rn]; }
+  inline void set_reg(uint8_t rn, uint32_t val) {
+    if (rn == 15) {
+      val &= (cpsr & CONTROL::T) ? ~0x1 : ~0x3;
+    }
+    regs[rn] = val;
+  }
+  inline bool in_thumb() { return cpsr & CONTROL::T; }
+  inline bool irqs_masked() { return cpsr & CONTROL::I; }
+  inline bool in_irq_mode() { return (cpsr & CONTROL::M) == MODE::IRQ; }
 
   void cycle(uint32_t count);
+
+  void reset();
+
+  // Executes one instruction or a fused pair, or skips to the next event
+  // while halted. Returns the number of instructions executed.
+  uint32_t step();
+
+  // Runs headless for at least `count` cycles without tracing, returns the
+  // number of instructions executed
+  uint64_t run_cycles(uint64_t count);
+
+  // Runs headless until the next frame is complete (start of VBlank),
+  // returns the number of instructions executed
+  uint64_t run_frame();
+
+  // False once an unimplemented instruction or stop() stopped the CPU
+  inline bool is_running() { return running; }
+  inline void stop() { running = false; }
+
+  // Driven by the interrupt controller in Bus
+  inline void set_irq_line(bool line) { irq_line = line; }
+  inline void halt() { halted = true; }
+  inline void wake() { halted = false; }
+
+  // SWIs with a native implementation skip the BIOS unless this is off
+  inline void set_hle_bios(bool enable) { hle_bios = enable; }
+
+  // Idle loops the heuristics miss, one "<game code> <branch address>" per
+  // line, e.g. "AXVE 0x08000a3c". Entries for other games are ignored.
+  bool load_idle_overrides(const char *path);
+  void dump_idle_loops();
+
+  // Starts sampling every `interval` cycles into a buffer of `capacity`
+  // samples. The CPU owns the profiler, it lives until the CPU is destroyed.
+  Profiler *enable_profiler(uint32_t interval, size_t capacity);
+
   // inline void CPU::cycle(uint32_t count) {
   //   for (uint32_t i = 0; i < count; i++) {
   //     // if (cycles % 64 == 0) {
@@ -39,6 +100,9 @@ public:
   // }
 
 private:
+  friend struct Bench;
+  friend struct Test; // tests/
+
   // instr[31:28]
   enum COND {
     EQ = 0x0,
@@ -66,7 +130,39 @@ private:
     M = 1 << 4 | 1 << 3 | 1 << 2 | 1 << 1 | 1 << 0,
   };
 
-  bool eval_cond(COND cond);
+  // 16x16 bit truth table, bit `nzcv` of cond_table[cond] is set when the
+  // condition passes with those flags
+  static constexpr std::array<uint16_t, 16> cond_table = [] {
+    std::array<uint16_t, 16> table{};
+    for (uint32_t nzcv = 0; nzcv < 16; nzcv++) {
+      bool n = nzcv & 0x8;
+      bool z = nzcv & 0x4;
+      bool c = nzcv & 0x2;
+      bool v = nzcv & 0x1;
+      bool pass[16] = {
+          z,       !z,               // EQ NE
+          c,       !c,               // CS CC
+          n,       !n,               // MI PL
+          v,       !v,               // VS VC
+          c && !z, !c || z,          // HI LS
+          n == v,  n != v,           // GE LT
+          !z && n == v, z || n != v, // GT LE
+          true,    false,            // AL, NV never executes
+      };
+      for (uint32_t cond = 0; cond < 16; cond++) {
+        table[cond] |= pass[cond] << nzcv;
+      }
+    }
+    return table;
+  }();
+
+  inline bool eval_cond(COND cond) {
+    if (cond == AL) {
+      return true;
+    }
+    flush_flags();
+    return (cond_table[cond] >> (cpsr >> 28)) & 0x1;
+  }
 
   uint32_t get_cpsr();
   void set_cpsr(uint32_t val);
@@ -77,7 +173,11 @@ private:
   void thumb_fetch();
   uint16_t thumb_fetch_next();
 
-  void step(uint64_t count);
+  // Opcode reads through fetch_mem, falling back to the bus for memory
+  // without a fetch page (BIOS when outside it, I/O, VRAM, ...)
+  uint32_t fetch32(uint32_t addr, CYCLE_TYPE type);
+  uint16_t fetch16(uint32_t addr, CYCLE_TYPE type);
+  bool refresh_fetch(uint32_t addr);
 
   // cspr[31:28] = N Z C V
   enum FLAG {
@@ -98,33 +198,98 @@ private:
     SYS = 0x1f,
   };
 
-  uint32_t regs[16];
+  // NZCV are evaluated lazily. While `flags.op` isn't FLAGS_CLEAN the
+  // NZCV bits in cpsr are stale and `flags` describes the last flag setting
+  // operation; flush_flags() writes them back whenever the whole register is
+  // read. Ordered so each kind needs more of the old flags than the next.
+  enum FLAGS_OP : uint8_t {
+    FLAGS_CLEAN, // cpsr is up to date
+    FLAGS_NZ,    // C, V from cpsr
+    FLAGS_LOGIC, // C = carry, V from cpsr
+    FLAGS_ADD,   // res = op1 + op2 + carry
+    FLAGS_SUB,   // res = op1 - op2 - !carry
+  };
+
+  // Everything the interpreter touches on every instruction, kept together
+  // from the start of a cache line
+  alignas(64) uint32_t regs[16]; // Active bank, swapped by set_mode()
+  uint32_t cpsr;
+  uint32_t pipeline[2];
+  // Host memory backing guest addresses [fetch_base, fetch_base + fetch_size)
+  // around the PC, replaced by refresh_fetch() when a fetch falls outside it
+  // (branches and page crossings)
+  const uint8_t *fetch_mem;
+  uint32_t fetch_base;
+  uint32_t fetch_size;
+  uint32_t cycles;
+  struct {
+    FLAGS_OP op;
+    bool carry;
+    uint32_t res;
+    uint32_t op1;
+    uint32_t op2;
+  } flags;
+
+  // Inactive banks, r8-r14 for usr/sys and fiq, r13-r14 for the others
+  uint32_t regs_usr[7];
   uint32_t regs_fiq[7];
   uint32_t regs_svc[2];
   uint32_t regs_abt[2];
   uint32_t regs_irq[2];
   uint32_t regs_und[2];
 
-  uint32_t cpsr;
   uint32_t spsr_fiq;
   uint32_t spsr_svc;
   uint32_t spsr_abt;
   uint32_t spsr_irq;
   uint32_t spsr_und;
 
-  uint32_t pipeline[2];
-  uint32_t cycles;
+  inline bool lazy_c() {
+    switch (flags.op) {
+    case FLAGS_LOGIC:
+      return flags.carry;
+    case FLAGS_ADD:
+      return static_cast<uint64_t>(flags.op1) + flags.op2 + flags.carry >
+             0xffffffff;
+    case FLAGS_SUB:
+      return static_cast<uint64_t>(flags.op1) >=
+             static_cast<uint64_t>(flags.op2) + !flags.carry;
+    default:
+      return cpsr & C;
+    }
+  }
 
-  inline MODE get_mode() { return static_cast<MODE>(cpsr & CONTROL::M); }
-  inline void set_mode(MODE mode) {
-    cpsr &= ~CONTROL::M;
-    cpsr |= mode;
+  inline bool lazy_v() {
+    switch (flags.op) {
+    case FLAGS_ADD:
+      return (~(flags.op1 ^ flags.op2) & (flags.op1 ^ flags.res)) >> 31;
+    case FLAGS_SUB:
+      return ((flags.op1 ^ flags.op2) & (flags.op1 ^ flags.res)) >> 31;
+    default:
+      return cpsr & V;
+    }
+  }
+
+  inline void flush_flags() {
+    if (flags.op == FLAGS_CLEAN) {
+      return;
+    }
+    uint32_t nzcv = (flags.res & N) | (flags.res ? 0 : Z) |
+                    (lazy_c() ? C : 0) | (lazy_v() ? V : 0);
+    cpsr = (cpsr & ~(N | Z | C | V)) | nzcv;
+    flags.op = FLAGS_CLEAN;
   }
 
+  inline MODE get_mode() { return static_cast<MODE>(cpsr & CONTROL::M); }
+  // Saves r8-r14 to the outgoing mode's bank and loads the new mode's
+  void set_mode(MODE mode);
+  uint32_t *banked_sp_lr(MODE mode);
+
   inline uint32_t get_psr() {
     switch (get_mode()) {
     case USR:
     case SYS:
+      flush_flags();
       return cpsr;
     case FIQ:
       return spsr_fiq;
@@ -145,7 +310,7 @@ private:
     switch (get_mode()) {
     case USR:
     case SYS:
-      cpsr = val;
+      set_cpsr(val);
       break;
     case FIQ:
       spsr_fiq = val;
@@ -170,25 +335,127 @@ private:
   // uint32_t get_psr();
   // void set_psr(uint32_t val);
 
-  inline bool get_cc(FLAG f) { return get_psr() & f; }
+  inline bool get_cc(FLAG f) {
+    if (flags.op == FLAGS_CLEAN) {
+      return cpsr & f;
+    }
+    switch (f) {
+    case N:
+      return flags.res >> 31;
+    case Z:
+      return flags.res == 0;
+    case C:
+      return lazy_c();
+    default:
+      return lazy_v();
+    }
+  }
   inline void set_cc(FLAG f, bool val) {
-    uint32_t psr = get_psr();
+    flush_flags();
     if (val) {
-      psr |= f;
+      cpsr |= f;
     } else {
-      psr &= ~f;
+      cpsr &= ~f;
     }
-    set_psr(psr);
+  }
+
+  // Flag setting instructions record their result here instead of updating
+  // NZCV; N and Z come from `res`, C and V from the operands when needed
+  inline void set_nz(uint32_t res) {
+    if (flags.op >= FLAGS_LOGIC) {
+      flush_flags(); // C and V must survive
+    }
+    flags.op = FLAGS_NZ;
+    flags.res = res;
+  }
+  inline void set_logic(uint32_t res, bool carry) {
+    if (flags.op >= FLAGS_ADD) {
+      flush_flags(); // V must survive
+    }
+    flags.op = FLAGS_LOGIC;
+    flags.res = res;
+    flags.carry = carry;
+  }
+  inline void set_add(uint32_t op1, uint32_t op2, bool carry, uint32_t res) {
+    flags = {FLAGS_ADD, carry, res, op1, op2};
+  }
+  inline void set_sub(uint32_t op1, uint32_t op2, bool carry, uint32_t res) {
+    flags = {FLAGS_SUB, carry, res, op1, op2};
   }
 
   // bool get_cc(FLAG f);
   // void set_cc(FLAG f, bool val);
 
-  void reset();
-
   bool running;
+  bool halted;
+  bool irq_line;
+
+  // KEYINPUT the frontend holds, active low
+  uint16_t keys;
+  void poll_events();
+
+  // Written for every instruction while tracing, see run()
+  bool tracing;
+  TraceWriter trace_log;
+  void trace(uint32_t instr);
+
+  // Decode and execute one already fetched instruction
+  void arm_execute(uint32_t instr);
+  void thumb_execute(uint16_t instr);
+
+  void irq();
+
+  Profiler *profiler; // nullptr unless profiling
+  void profile(uint32_t addr);
+
+  // Macro-op fusion (fusion.cpp). Checked with the next instruction already
+  // in pipeline[0]; runs the pair and returns true if it is a fusable one.
+  bool arm_fuse(uint32_t instr);
+  bool thumb_fuse(uint16_t instr);
+
+  // High level emulation of the BIOS calls (bios.cpp). Runs SWI `number`
+  // and returns true, or returns false to enter the BIOS instead.
+  bool hle_bios;
+  bool hle_waiting; // IntrWait halted and runs again after the IRQ
+  bool hle_swi(uint8_t number);
+  void hle_return(uint32_t cycles);
+  bool hle_intr_wait(bool vblank);
+  uint32_t hle_register_ram_reset(uint32_t flags);
+  uint32_t hle_cpu_set(bool fast);
+  uint32_t hle_bg_affine_set();
+  uint32_t hle_obj_affine_set();
+  // Decompressors, `vram` variants store halfwords only
+  uint32_t hle_lz77(bool vram);
+  uint32_t hle_huffman();
+  uint32_t hle_rl(bool vram);
+  uint32_t hle_diff(bool wide, bool vram);
+  uint32_t hle_store(uint32_t dst, std::vector<uint8_t> &data, uint32_t unit);
+
+  // Idle loop detection (idle.cpp)
+  static constexpr uint32_t IDLE_LOOP_MAX = 8;    // instructions
+  static constexpr uint32_t IDLE_CACHE_SIZE = 64; // direct mapped
+
+  struct IdleLoop {
+    uint32_t branch; // address of the backward branch closing the loop
+    uint32_t target;
+    bool thumb;
+    bool idle; // at first sight, check_idle_loop() checks again on a hit
+    bool override;
+    uint64_t hits;
+    uint64_t skipped; // cycles fast-forwarded
+  };
+
+  std::unordered_map<uint32_t, IdleLoop> idle_loops;
+  IdleLoop *idle_cache[IDLE_CACHE_SIZE];
+  std::vector<std::pair<std::string, uint32_t>> idle_overrides;
 
-  void run();
+  void check_idle_loop(uint32_t branch, uint32_t target, bool thumb);
+  bool analyse_idle_loop(uint32_t branch, uint32_t target, bool thumb);
+  bool arm_idle_access(uint32_t addr, uint32_t instr, uint32_t &reads,
+                       uint32_t &writes);
+  bool thumb_idle_access(uint32_t addr, uint16_t instr, uint32_t &reads,
+                         uint32_t &writes);
+  bool idle_load_safe(uint32_t addr);
 
   Bus *bus;
 
@@ -238,8 +505,91 @@ private:
     ROR = 3,
   };
 
-  bool barrel_shift(uint32_t &val, SHIFT shift_type, uint8_t shift_amount,
-                    bool shift_by_reg);
+  // Barrel shifter specialised on the shift type and where the amount comes
+  // from, returns the carry out. Immediate amounts are instr[11:7], where #0
+  // encodes LSR #32, ASR #32 and RRX and LSL #0 passes the operand through.
+  // Register amounts are the bottom byte of Rs, where 0 leaves both the
+  // operand and C alone.
+  template <SHIFT type, bool by_reg>
+  inline bool shift(uint32_t &val, uint32_t amount) {
+    if constexpr (by_reg) {
+      if (amount == 0) {
+        return get_cc(C);
+      }
+    }
+
+    bool carry;
+    if constexpr (type == LSL) {
+      if (!by_reg && amount == 0) {
+        return get_cc(C);
+      }
+      if (amount < 32) {
+        carry = (val >> (32 - amount)) & 0x1;
+        val <<= amount;
+      } else {
+        carry = amount == 32 && (val & 0x1);
+        val = 0;
+      }
+    } else if constexpr (type == LSR) {
+      if constexpr (!by_reg) {
+        amount = ((amount - 1) & 0x1f) + 1; // 0 -> 32
+      }
+      if (amount < 32) {
+        carry = (val >> (amount - 1)) & 0x1;
+        val >>= amount;
+      } else {
+        carry = amount == 32 && (val >> 31);
+        val = 0;
+      }
+    } else if constexpr (type == ASR) {
+      if constexpr (!by_reg) {
+        amount = ((amount - 1) & 0x1f) + 1; // 0 -> 32
+      }
+      if (amount < 32) {
+        carry = (static_cast<int32_t>(val) >> (amount - 1)) & 0x1;
+        val = static_cast<int32_t>(val) >> amount;
+      } else {
+        carry = val >> 31;
+        val = carry ? 0xffffffff : 0;
+      }
+    } else {
+      if (!by_reg && amount == 0) {
+        // RRX
+        uint32_t carry_in = get_cc(C);
+        carry = val & 0x1;
+        val = val >> 1 | carry_in << 31;
+      } else {
+        amount &= 0x1f;
+        val = (val >> amount) | (val << ((32 - amount) & 0x1f));
+        carry = val >> 31;
+      }
+    }
+    return carry;
+  }
+
+  // Picks the specialisation from the encoded shift, callers with constant
+  // arguments inline straight to it
+  inline bool barrel_shift(uint32_t &val, SHIFT shift_type, uint32_t amount,
+                           bool shift_by_reg) {
+    switch (shift_type << 1 | shift_by_reg) {
+    case LSL << 1:
+      return shift<LSL, false>(val, amount);
+    case LSL << 1 | 1:
+      return shift<LSL, true>(val, amount);
+    case LSR << 1:
+      return shift<LSR, false>(val, amount);
+    case LSR << 1 | 1:
+      return shift<LSR, true>(val, amount);
+    case ASR << 1:
+      return shift<ASR, false>(val, amount);
+    case ASR << 1 | 1:
+      return shift<ASR, true>(val, amount);
+    case ROR << 1:
+      return shift<ROR, false>(val, amount);
+    default:
+      return shift<ROR, true>(val, amount);
+    }
+  }
 
   // ARM instructions
   bool arm_is_bx(uint32_t instr);
@@ -283,6 +633,7 @@ private:
   void thumb_ppr(uint16_t instr);
   void thumb_mls(uint16_t instr);
   void thumb_cb(uint16_t instr);
+  void thumb_cb_taken(uint16_t instr);
   void thumb_swi(uint16_t instr);
   void thumb_ub(uint16_t instr);
   void thumb_lbl(uint16_t instr);
@@ -0,0 +1,50 @@
+#pragma once
+#include "mmio.h"
+#include <cstdint>
+
+class Bus;
+class CPU;
+
+class DMA {
+public:
+  enum TIMING {
+    IMMEDIATE = 0,
+    VBLANK = 1,
+    HBLANK = 2,
+    SPECIAL = 3, // Sound FIFO for DMA1/2, video capture for DMA3
+  };
+
+  DMA(Bus &bus, CPU &cpu);
+  ~DMA();
+
+  void set_control(uint8_t id, uint8_t byte, uint8_t data);
+
+  // Start every enabled channel waiting on `timing`
+  void trigger(TIMING timing);
+
+  // Sound FIFO A (0) or B (1) is running low
+  void request_fifo(uint8_t fifo);
+
+  DMAREG dma[4];
+
+private:
+  enum ADDR_CONTROL {
+    INCREMENT = 0,
+    DECREMENT = 1,
+    FIXED = 2,
+    RELOAD = 3,
+  };
+
+  Bus &bus;
+  CPU &cpu;
+
+  // Internal registers, latched from dma[] when a channel is enabled
+  uint32_t src[4];
+  uint32_t dst[4];
+  uint32_t count[4];
+
+  void latch(uint8_t id);
+  void transfer(uint8_t id, bool fifo);
+  bool fast_transfer(uint32_t src_addr, uint32_t dst_addr, uint32_t units,
+                     uint32_t size);
+};
@@ -0,0 +1,80 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * C interface for embedding the core in another program. The emulator is
+ * headless: it never opens a window or touches SDL, the host drives it one
+ * frame or a number of cycles at a time and reads the frame buffer directly.
+ *
+ * Threading: instances share no mutable state, so different instances may
+ * run on different threads at the same time. A single instance is not
+ * thread safe; calls on it must not overlap, and the frame buffer of an
+ * instance must not be read while a gba_run_* call on it is in progress.
+ *
+ * Functions returning int return 0 on success and -1 on failure.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GBA_SCREEN_WIDTH 240
+#define GBA_SCREEN_HEIGHT 160
+
+// Key bits for gba_set_keys(), set = pressed (the hardware register is
+// active low, the API is not)
+#define GBA_KEY_A (1 << 0)
+#define GBA_KEY_B (1 << 1)
+#define GBA_KEY_SELECT (1 << 2)
+#define GBA_KEY_START (1 << 3)
+#define GBA_KEY_RIGHT (1 << 4)
+#define GBA_KEY_LEFT (1 << 5)
+#define GBA_KEY_UP (1 << 6)
+#define GBA_KEY_DOWN (1 << 7)
+#define GBA_KEY_R (1 << 8)
+#define GBA_KEY_L (1 << 9)
+
+typedef struct gba gba_t;
+
+// NULL if out of memory
+gba_t *gba_create(void);
+void gba_destroy(gba_t *gba);
+
+// Optional. Without an image a minimal stand-in is used and the common SWIs
+// run natively. Resets like gba_reset(); on failure nothing changes.
+int gba_load_bios(gba_t *gba, const char *path);
+// SWIs with a native implementation skip the BIOS unless this is 0 (default 1)
+void gba_set_hle_bios(gba_t *gba, int enable);
+
+// Loads the cartridge (at most 32 MiB, `data` is copied) and resets. On
+// failure nothing changes.
+int gba_load_rom(gba_t *gba, const char *path);
+int gba_load_rom_memory(gba_t *gba, const void *data, size_t size);
+// Power cycle: a fresh machine from the loaded images, ready to run from the
+// first instruction. Keys are released and the counters start again at 0.
+int gba_reset(gba_t *gba);
+
+// Runs until the next frame is complete (start of VBlank). Returns -1 if the
+// CPU stopped at an unimplemented instruction, it won't run any further.
+int gba_run_frame(gba_t *gba);
+// Runs for at least `cycles` cycles (16.78 MHz), returns the number of
+// instructions executed
+uint64_t gba_run_cycles(gba_t *gba, uint64_t cycles);
+
+// Takes effect immediately, GBA_KEY_* bits
+void gba_set_keys(gba_t *gba, uint16_t pressed);
+
+// GBA_SCREEN_WIDTH * GBA_SCREEN_HEIGHT pixels, XRGB8888 in host byte order,
+// rows without padding, read in place without a copy. The pixels are updated
+// while the emulator runs. The pointer stays valid until the next
+// gba_destroy(), gba_reset() or successful load.
+const uint32_t *gba_get_framebuffer(gba_t *gba);
+
+// Frames completed and cycles run since the last reset
+uint64_t gba_get_frame_count(gba_t *gba);
+uint64_t gba_get_cycles(gba_t *gba);
+
+#ifdef __cplusplus
+}
+#endif
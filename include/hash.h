@@ -0,0 +1,45 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// CRC-32 as used by zip and PNG, `crc` continues an earlier call
+inline uint32_t crc32(const uint8_t *data, size_t size, uint32_t crc = 0) {
+  static const auto table = [] {
+    std::array<uint32_t, 256> t;
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++) {
+        c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+      }
+      t[i] = c;
+    }
+    return t;
+  }();
+
+  crc = ~crc;
+  for (size_t i = 0; i < size; i++) {
+    crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+// Fast 64-bit hash for comparing frame buffers and memory, not stable across
+// byte orders. Eight bytes per multiply.
+inline uint64_t hash64(const void *data, size_t size) {
+  const uint8_t *p = static_cast<const uint8_t *>(data);
+  uint64_t h = 0x9E3779B97F4A7C15 ^ size;
+  for (; size >= 8; size -= 8, p += 8) {
+    uint64_t w;
+    memcpy(&w, p, 8);
+    h = (h ^ w) * 0xBF58476D1CE4E5B9;
+    h ^= h >> 31;
+  }
+  uint64_t tail = 0;
+  memcpy(&tail, p, size);
+  h = (h ^ tail) * 0x94D049BB133111EB;
+  h ^= h >> 29;
+  h *= 0xBF58476D1CE4E5B9;
+  return h ^ (h >> 32);
+}
@@ -250,7 +250,7 @@ struct LCD {
       uint16_t : 16;        // Not used
     } bits;
     uint8_t bytes[4];
-    uint8_t halfwords[2];
+    uint16_t halfwords[2];
     uint32_t full;
   } mosaic;
 
@@ -340,6 +340,98 @@ struct LCD {
   } oamdata;
 };
 
+struct SOUND {
+  union {
+    struct {
+      uint16_t psgVolume : 2;  // Sound # 1-4 Volume   (0=25%, 1=50%, 2=100%,
+                               // 3=Prohibited)
+      uint16_t dmaAVolume : 1; // DMA Sound A Volume   (0=50%, 1=100%)
+      uint16_t dmaBVolume : 1; // DMA Sound B Volume   (0=50%, 1=100%)
+      uint16_t : 4;            // Not used
+      uint16_t dmaARight : 1;  // DMA Sound A Enable RIGHT (0=Disable,
+                               // 1=Enable)
+      uint16_t dmaALeft : 1;   // DMA Sound A Enable LEFT  (0=Disable,
+                               // 1=Enable)
+      uint16_t dmaATimer : 1;  // DMA Sound A Timer Select (0=Timer 0,
+                               // 1=Timer 1)
+      uint16_t dmaAReset : 1;  // DMA Sound A Reset FIFO   (1=Reset)
+      uint16_t dmaBRight : 1;  // DMA Sound B Enable RIGHT (0=Disable,
+                               // 1=Enable)
+      uint16_t dmaBLeft : 1;   // DMA Sound B Enable LEFT  (0=Disable,
+                               // 1=Enable)
+      uint16_t dmaBTimer : 1;  // DMA Sound B Timer Select (0=Timer 0,
+                               // 1=Timer 1)
+      uint16_t dmaBReset : 1;  // DMA Sound B Reset FIFO   (1=Reset)
+    } bits;
+    uint8_t bytes[2];
+    uint16_t full;
+  } soundcnt_h;
+};
+
+struct DMAREG {
+  union {
+    uint8_t bytes[4];
+    uint16_t halfwords[2];
+    uint32_t full;
+  } sad; // Source Address      (27bit DMA0, 28bit DMA1-3)
+
+  union {
+    uint8_t bytes[4];
+    uint16_t halfwords[2];
+    uint32_t full;
+  } dad; // Destination Address (27bit DMA0-2, 28bit DMA3)
+
+  union {
+    uint8_t bytes[2];
+    uint16_t full;
+  } cnt_l; // Word Count (14bit DMA0-2 (0=4000h), 16bit DMA3 (0=10000h))
+
+  union {
+    struct {
+      uint16_t : 5;            // Not used
+      uint16_t dstControl : 2; // Dest Addr Control  (0=Increment,
+                               // 1=Decrement, 2=Fixed, 3=Increment/Reload)
+      uint16_t srcControl : 2; // Source Adr Control (0=Increment,
+                               // 1=Decrement, 2=Fixed, 3=Prohibited)
+      uint16_t repeat : 1;     // DMA Repeat         (0=Off, 1=On)
+      uint16_t type : 1;       // DMA Transfer Type  (0=16bit, 1=32bit)
+      uint16_t gamePakDRQ : 1; // Game Pak DRQ       (0=Normal, 1=DRQ)
+                               // (DMA3 only)
+      uint16_t timing : 2;     // DMA Start Timing   (0=Immediately,
+                               // 1=VBlank, 2=HBlank, 3=Special)
+      uint16_t irq : 1;        // IRQ upon end of Word Count (0=Disable,
+                               // 1=Enable)
+      uint16_t enable : 1;     // DMA Enable         (0=Off, 1=On)
+    } bits;
+    uint8_t bytes[2];
+    uint16_t full;
+  } cnt_h;
+};
+
+struct TIMER {
+  // REG_TMxCNT_L writes go to the reload value, reads return the counter
+  union {
+    uint8_t bytes[2];
+    uint16_t full;
+  } reload;
+
+  union {
+    struct {
+      uint8_t prescaler : 2; // Prescaler Selection (0=F/1, 1=F/64, 2=F/256,
+                             // 3=F/1024)
+      bool countUp : 1;      // Count-up Timing     (0=Normal, 1=See below)
+                             // (not used in TM0CNT_H)
+      uint8_t : 3;           // Not used
+      bool irq : 1;    // Timer IRQ Enable    (0=Disable, 1=IRQ on Timer
+                       // overflow)
+      bool enable : 1; // Timer Start/Stop    (0=Stop, 1=Operate)
+      uint8_t : 8;     // Not used
+    } bits;
+    uint8_t bytes[2];
+    uint16_t full;
+  } cnt_h;
+};
+
 struct KEYPAD {
   union {
     struct {
@@ -0,0 +1,85 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class Bus;
+class CPU;
+
+/*
+ * Input movies. KEYINPUT only ever changes at the start of VBlank while a
+ * movie is attached, so a movie is the start state plus the frames on which
+ * the keys changed, and replaying it from the same start state repeats the
+ * run exactly. The PPU calls next_frame() once per frame, which is all the
+ * overhead there is during playback.
+ *
+ * File layout, little endian:
+ *    0  "GBAM"
+ *    4  u16 version
+ *    6  u16 flags, MOVIE_HLE_BIOS
+ *    8  u32 CRC-32 of the ROM
+ *   12  u32 ROM size
+ *   16  u32 CRC-32 of the 16 KiB BIOS image, the stand-in included
+ *   20  4 bytes game code
+ *   24  u32 frames, the replay stops at the start of VBlank after the last
+ *   28  u16 KEYINPUT at reset
+ *   30  u16 reserved
+ *   32  Changes: ULEB128 frames since the previous change, then u16 KEYINPUT
+ */
+
+#define MOVIE_MAGIC "GBAM"
+#define MOVIE_VERSION 1
+#define MOVIE_HEADER_SIZE 32
+
+#define MOVIE_HLE_BIOS (1 << 0)
+
+class Movie {
+public:
+  Movie(CPU &cpu, Bus &bus);
+
+  // Records from the current state, which must be straight after reset
+  void record(bool hle_bios);
+  bool save(const char *path);
+
+  // Checks the header against the loaded ROM and BIOS, prints why and
+  // returns false if the movie can't replay here
+  bool load(const char *path);
+  // Sets the start keys, the CPU stops once the last frame is reached
+  void replay();
+
+  inline bool is_recording() { return recording; }
+  inline bool get_hle_bios() { return flags & MOVIE_HLE_BIOS; }
+  inline uint32_t get_frames() { return frames; }
+  inline uint32_t get_frame() { return frame; }
+
+  // Keys the frontend holds, they reach the game on the next frame
+  inline void set_keys(uint16_t keys) { pending = keys; }
+
+  // Start of VBlank, before the VBlank IRQ is raised
+  void next_frame();
+
+private:
+  struct Change {
+    uint32_t frame;
+    uint16_t keys;
+  };
+
+  CPU &cpu;
+  Bus &bus;
+
+  bool recording;
+  uint16_t flags;
+  uint32_t rom_crc;
+  uint32_t rom_size;
+  uint32_t bios_crc;
+  char game_code[4];
+  uint32_t frames;
+  uint16_t start_keys;
+
+  std::vector<Change> changes;
+  size_t next;     // Replay position in `changes`
+  uint32_t frame;  // VBlanks seen so far
+  uint16_t pending;
+
+  void read_start_state();
+};
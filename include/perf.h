@@ -0,0 +1,83 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+
+/*
+ * Per-frame performance counters. Everything is counted with plain
+ * increments on the emulation thread; when a frame ends (start of VBlank) the
+ * running counts become the last frame snapshot and are added to the interval
+ * the frontend prints from.
+ */
+class Perf {
+public:
+  enum WIDTH {
+    BYTE,
+    HALF,
+    WORD,
+  };
+
+  // Instruction pairs the CPU executed as one (fusion.cpp)
+  enum FUSION {
+    FUSE_BL,      // Thumb BL prefix + suffix
+    FUSE_CMP_B,   // CMP + B<cond>
+    FUSE_LDR_ADD, // LDR + ADD bumping the base register
+    FUSION_COUNT,
+  };
+
+  struct Frame {
+    uint64_t arm_instrs;
+    uint64_t thumb_instrs;
+    uint64_t cycles;
+    uint64_t cpu_ns;      // Host time emulating, minus everything below
+    uint64_t ppu_ns;      // Rendering scanlines
+    uint64_t frontend_ns; // Presenting frames and polling events
+    uint64_t sleep_ns;    // Throttling to real time
+    uint64_t fused[FUSION_COUNT];
+    // By address bits 27:24 and access width
+    uint64_t reads[16][3];
+    uint64_t writes[16][3];
+  };
+
+  Perf();
+
+  inline void count_arm() { current.arm_instrs++; }
+  inline void count_thumb() { current.thumb_instrs++; }
+  inline void count_fused(FUSION kind) { current.fused[kind]++; }
+  inline void count_read(uint32_t addr, WIDTH width, uint32_t n = 1) {
+    current.reads[(addr >> 24) & 0xf][width] += n;
+  }
+  inline void count_write(uint32_t addr, WIDTH width, uint32_t n = 1) {
+    current.writes[(addr >> 24) & 0xf][width] += n;
+  }
+
+  inline void add_ppu_ns(uint64_t ns) { current.ppu_ns += ns; }
+  inline void add_frontend_ns(uint64_t ns) { current.frontend_ns += ns; }
+  inline void add_sleep_ns(uint64_t ns) { current.sleep_ns += ns; }
+
+  // Closes the running frame, `now` is the scheduler timestamp
+  void end_frame(uint64_t now);
+
+  inline const Frame &last_frame() { return last; }
+  inline uint64_t frame_count() { return frames; }
+
+  // Returns the sum over all frames since the previous call and resets it
+  Frame take_interval(uint64_t &frames, uint64_t &host_ns);
+
+  // One summary block averaged over `frames` frames
+  static void print(FILE *fp, const Frame &sum, uint64_t frames,
+                    uint64_t host_ns);
+
+private:
+  Frame current;
+  Frame last;
+  Frame interval;
+
+  uint64_t frames;
+  uint64_t interval_frames;
+
+  uint64_t frame_cycles; // Scheduler timestamp at the start of the frame
+  uint64_t frame_ns;     // Host clock at the start of the frame
+  uint64_t interval_ns;  // Host clock at the start of the interval
+
+  static uint64_t host_now();
+};
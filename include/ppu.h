@@ -10,23 +10,42 @@ class Bus;
 
 class PPU {
 public:
-  PPU(Bus &bus);
+  // A headless PPU renders into its frame buffer but never opens a window
+  PPU(Bus &bus, bool headless = false);
   ~PPU();
 
-  void tick(uint32_t cycles);
+  // Cycles per scanline: 960 drawing, 272 in HBlank
+  static constexpr uint32_t HDRAW_CYCLES = 960;
+  static constexpr uint32_t HBLANK_CYCLES = 272;
 
   bool sdl_init();
 
   void sdl_quit();
 
+  // Frame rate and MIPS of the last frame in the top left corner
+  inline void set_overlay(bool enabled) { overlay = enabled; }
+  inline void toggle_overlay() { overlay = !overlay; }
+
+  // XRGB8888, SCREEN_WIDTH * SCREEN_HEIGHT pixels
+  inline const uint32_t *get_frame() { return frame; }
+  uint64_t hash_frame();
+  // Uncompressed 24-bit PNG of the frame buffer
+  bool save_png(const char *path);
+
   LCD lcd;
 
 private:
+  friend struct Bench;
+
   Bus &bus;
 
+  bool headless;
+  bool overlay;
+
   uint32_t dots;
 
   uint32_t *frame;
+  uint32_t *screen; // What present() shows, frame plus the overlay
 
   SDL_Window *window;
   SDL_Renderer *renderer;
@@ -34,4 +53,17 @@ private:
   uint32_t pitch;
 
   void render_scanline(uint32_t y);
+
+  void hblank(uint64_t late);
+  void hdraw(uint64_t late);
+  void present();
+  void draw_overlay(uint32_t *out);
+  void draw_text(uint32_t *out, uint32_t x, uint32_t y, const char *text);
+
+  static void on_hblank(void *ctx, uint64_t late) {
+    static_cast<PPU *>(ctx)->hblank(late);
+  }
+  static void on_hdraw(void *ctx, uint64_t late) {
+    static_cast<PPU *>(ctx)->hdraw(late);
+  }
 };
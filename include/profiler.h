@@ -0,0 +1,90 @@
+#pragma once
+#include "scheduler.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * Sampling guest profiler. A scheduler event marks a sample as due every
+ * `interval` cycles and the CPU takes it before its next instruction, so an
+ * idle profiler costs nothing and a disabled one is a single null check.
+ *
+ * The call chain comes from a shadow stack of link events: BL, SWI and IRQ
+ * entry push (target, return address), reaching the return address pops.
+ * Returns the shadow stack doesn't see (longjmp, stack switching) just leave
+ * stale frames behind until it overflows and drops the oldest ones.
+ */
+class Profiler {
+public:
+  static constexpr uint32_t MAX_DEPTH = 16;
+
+  struct Sample {
+    uint32_t pc;
+    uint32_t lr;
+    uint32_t cpsr; // Mode and Thumb state at the time of the sample
+    bool halted;
+    uint8_t depth;
+    uint32_t stack[MAX_DEPTH]; // Call targets, outermost first
+  };
+
+  // `capacity` samples are allocated up front, sampling stops once full
+  Profiler(Scheduler &scheduler, uint32_t interval, size_t capacity);
+  ~Profiler();
+
+  inline bool sample_due() { return due; }
+
+  // Called with the address of every instruction about to execute
+  inline void step(uint32_t addr) {
+    if (depth && frames[depth - 1].ret == addr) {
+      depth--;
+    }
+  }
+
+  void call(uint32_t target, uint32_t ret);
+  void sample(uint32_t pc, uint32_t lr, uint32_t cpsr, bool halted);
+
+  inline const std::vector<Sample> &get_samples() { return samples; }
+  inline uint64_t get_dropped() { return dropped; }
+
+  // Either an ELF file with a symbol table or a text map with one
+  // "<hex address> ... <name>" per line (nm output, linker map symbol lines)
+  bool load_symbols(const char *path);
+
+  // One "frame;frame;...;leaf count" line per distinct stack, the format
+  // flamegraph.pl and speedscope read
+  bool write_collapsed(const char *path);
+
+private:
+  struct Frame {
+    uint32_t target;
+    uint32_t ret;
+  };
+
+  struct Symbol {
+    uint32_t addr;
+    uint32_t size; // 0 if unknown, then it extends to the next symbol
+    std::string name;
+  };
+
+  Scheduler &scheduler;
+  uint32_t interval;
+  bool due;
+
+  Frame frames[MAX_DEPTH];
+  uint8_t depth;
+
+  std::vector<Sample> samples;
+  uint64_t dropped;
+
+  std::vector<Symbol> symbols; // Sorted by address
+
+  bool load_elf(const std::vector<uint8_t> &file);
+  bool load_map(const std::vector<uint8_t> &file);
+  std::string symbolize(uint32_t addr);
+
+  void tick(uint64_t late);
+
+  static void on_sample(void *ctx, uint64_t late) {
+    static_cast<Profiler *>(ctx)->tick(late);
+  }
+};
@@ -0,0 +1,85 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Windowed-sinc polyphase resampler. Sits between the APU mixer and any sink
+ * (host audio device, WAV dump): the mixer pushes interleaved stereo frames at
+ * the native GBA rate and the sink pulls frames at the host rate.
+ */
+class Resampler {
+public:
+  enum QUALITY {
+    LOW,    // 8 taps
+    MEDIUM, // 16 taps
+    HIGH,   // 32 taps
+  };
+
+  enum KERNEL {
+    SCALAR,
+    SSE,
+    AVX,
+  };
+
+  Resampler(double in_rate, double out_rate, QUALITY quality = MEDIUM);
+
+  void set_rates(double in_rate, double out_rate);
+  void set_quality(QUALITY quality);
+
+  // Scales the input/output ratio on the fly (1.0 = nominal), so the caller
+  // can absorb drift between the emulated and host clocks, e.g. by nudging it
+  // based on how full the host audio queue is.
+  void set_ratio_adjust(double adjust);
+
+  // Forces a specific dot-product kernel; returns false if the host CPU does
+  // not support it. The best supported kernel is picked by default.
+  bool set_kernel(KERNEL kernel);
+  KERNEL get_kernel() { return kernel; }
+
+  // Interleaved stereo input (L, R, L, R, ...)
+  void push(const float *samples, size_t frames);
+  void push(const int16_t *samples, size_t frames);
+
+  // Interleaved stereo output, returns the number of frames written
+  size_t pull(float *out, size_t frames);
+  size_t pull(int16_t *out, size_t frames);
+
+  // Number of output frames that can be pulled without more input
+  size_t available();
+
+  void reset();
+
+private:
+  static constexpr uint32_t PHASES = 256;
+
+  using DotFunc = void (*)(const float *h0, const float *h1, float t,
+                           const float *l, const float *r, uint32_t taps,
+                           float &out_l, float &out_r);
+
+  double in_rate;
+  double out_rate;
+  double adjust;
+  double step;
+
+  QUALITY quality;
+  KERNEL kernel;
+  DotFunc dot;
+
+  uint32_t taps;
+
+  // (PHASES + 1) rows of `taps` coefficients, row p holds the filter for a
+  // fractional offset of p / PHASES
+  std::vector<float> coeffs;
+
+  // Deinterleaved input history so the kernels can load channels directly
+  std::vector<float> hist_l;
+  std::vector<float> hist_r;
+
+  // Position of the next output frame in the history, in input samples
+  double pos;
+
+  void build_filter();
+  void update_step();
+  void compact();
+};
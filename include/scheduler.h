@@ -0,0 +1,65 @@
+#pragma once
+#include <cstdint>
+
+/*
+ * Keeps the global cycle timestamp and a small fixed set of pending events.
+ * Hardware that changes state on its own (timers, ...) schedules its next
+ * interesting point in time here instead of being stepped every cycle.
+ */
+class Scheduler {
+public:
+  enum EVENT {
+    PPU_HBLANK, // End of the visible part of a line
+    PPU_HDRAW,  // Start of the next line
+    TIMER0_OVERFLOW,
+    TIMER1_OVERFLOW,
+    TIMER2_OVERFLOW,
+    TIMER3_OVERFLOW,
+    PROFILER_SAMPLE,
+    EVENT_COUNT,
+  };
+
+  // `late` is how many cycles past its timestamp the event is being handled
+  using Handler = void (*)(void *ctx, uint64_t late);
+
+  Scheduler();
+
+  void set_handler(EVENT event, Handler handler, void *ctx);
+
+  void schedule(EVENT event, uint64_t delay);
+  void schedule_at(EVENT event, uint64_t when);
+  void cancel(EVENT event);
+
+  inline bool is_scheduled(EVENT event) { return slots[event].active; }
+  inline uint64_t when(EVENT event) { return slots[event].when; }
+
+  inline uint64_t now() { return timestamp; }
+  inline uint64_t next() { return next_event; }
+
+  inline void tick(uint32_t cycles) {
+    timestamp += cycles;
+    if (timestamp >= next_event && !dispatching) {
+      run_events();
+    }
+  }
+
+private:
+  struct Slot {
+    uint64_t when;
+    bool active;
+    Handler handler;
+    void *ctx;
+  };
+
+  Slot slots[EVENT_COUNT];
+
+  uint64_t timestamp;
+  uint64_t next_event;
+
+  // Handlers can burn cycles themselves (e.g. a DMA started by an event), the
+  // outer dispatch loop picks up whatever became due meanwhile
+  bool dispatching;
+
+  void run_events();
+  void update_next();
+};
@@ -0,0 +1,45 @@
+#pragma once
+#include "mmio.h"
+#include "scheduler.h"
+#include <cstdint>
+
+class Bus;
+
+/*
+ * The four hardware timers are never ticked. A running timer only remembers
+ * the counter value at the timestamp it was (re)started; reads compute the
+ * current value from the elapsed cycles and the overflow is a scheduler event.
+ * Count-up timers are only touched when the timer below them overflows.
+ */
+class Timer {
+public:
+  Timer(Bus &bus, Scheduler &scheduler);
+  ~Timer();
+
+  uint16_t get_counter(uint8_t id);
+  void set_control(uint8_t id, uint8_t data);
+
+  TIMER tm[4];
+
+private:
+  Bus &bus;
+  Scheduler &scheduler;
+
+  // Counter value at `start`, only valid for running (non count-up) timers
+  uint16_t counter[4];
+  uint64_t start[4];
+
+  inline bool is_ticking(uint8_t id) {
+    return tm[id].cnt_h.bits.enable && !(id && tm[id].cnt_h.bits.countUp);
+  }
+
+  void latch(uint8_t id);
+  void schedule_overflow(uint8_t id);
+  void overflow(uint8_t id, uint64_t late);
+  void count_up(uint8_t id);
+  void overflowed(uint8_t id);
+
+  template <uint8_t id> static void on_overflow(void *ctx, uint64_t late) {
+    static_cast<Timer *>(ctx)->overflow(id, late);
+  }
+};
@@ -0,0 +1,120 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+/*
+ * Compact instruction traces. Every record is the state CPU::trace() sees
+ * before an instruction executes: r0-r15, CPSR, SPSR and the opcode. Most
+ * instructions change one or two registers, so a record stores a mask of
+ * what changed and only those values. Every `interval` records a keyframe
+ * holds everything in full, and an index of keyframes at the end of the file
+ * lets a reader seek to any instruction.
+ *
+ * File layout, little endian:
+ *   Header: "GBAT", u16 version, u16 reserved, u32 keyframe interval
+ *   Records, each starting with a ULEB128 head:
+ *     bits 0-1   PC: TRACE_PC_NEXT, TRACE_PC_DELTA (zigzag ULEB128 follows)
+ *                or TRACE_KEYFRAME (18 registers, then the opcode, raw u32)
+ *     bit  2     Opcode follows as raw u16 (Thumb) or u32, otherwise it is
+ *                the one last seen at this PC since the keyframe
+ *     bits 3-19  Changed: CPSR, r0-r14, SPSR. CPSR and SPSR are stored
+ *                XORed with the previous CPSR / the new CPSR and rotated so
+ *                the flags come first; r0-r14 as zigzag ULEB128 deltas.
+ *   Index: u64 record, u64 file offset for every keyframe
+ *   Footer: u64 index offset, u64 records, "GBTI"
+ *
+ * A trace without a footer (the emulator didn't exit cleanly) is still
+ * readable, the reader rebuilds the index with one pass.
+ */
+
+#define TRACE_MAGIC "GBAT"
+#define TRACE_INDEX_MAGIC "GBTI"
+#define TRACE_VERSION 1
+#define TRACE_HEADER_SIZE 12
+#define TRACE_FOOTER_SIZE 20
+
+#define TRACE_PC_NEXT 0
+#define TRACE_PC_DELTA 1
+#define TRACE_KEYFRAME 2
+
+#define TRACE_REGS 18 // r0-r15, CPSR, SPSR
+#define TRACE_DEFAULT_INTERVAL 65536
+
+// Opcodes remembered per PC between keyframes, direct mapped
+#define TRACE_OPCODE_CACHE 4096
+
+struct TraceRecord {
+  uint32_t regs[TRACE_REGS];
+  uint32_t instr;
+};
+
+// Delta state shared by the writer and the reader
+struct TraceState {
+  TraceRecord last;
+  struct {
+    uint32_t pc;
+    uint32_t instr;
+  } opcodes[TRACE_OPCODE_CACHE];
+
+  void clear();
+};
+
+class TraceWriter {
+public:
+  TraceWriter();
+  ~TraceWriter();
+
+  bool open(const char *path, uint32_t interval = TRACE_DEFAULT_INTERVAL);
+  inline bool is_open() { return fp != nullptr; }
+
+  void write(const TraceRecord &record);
+
+  // Writes the index, returns false if anything failed to write
+  bool close();
+
+private:
+  FILE *fp;
+  bool failed;
+  uint32_t interval;
+  uint64_t records;
+  uint64_t offset; // File offset of `buffer`
+  std::vector<uint8_t> buffer;
+  size_t used;
+  std::vector<uint64_t> index; // Record, offset pairs
+  TraceState state;
+
+  void flush();
+};
+
+class TraceReader {
+public:
+  TraceReader();
+  ~TraceReader();
+
+  bool open(const char *path);
+  void close();
+
+  inline uint64_t get_records() { return records; }
+  inline uint32_t get_interval() { return interval; }
+
+  // Positions the reader so the next record read is `record`
+  bool seek(uint64_t record);
+
+  // False at the end of the trace or if it's corrupt
+  bool read(TraceRecord &record);
+
+private:
+  const uint8_t *data;
+  size_t size;
+  size_t end; // Where the records stop and the index starts
+  size_t pos;
+  uint32_t interval;
+  uint64_t records;
+  uint64_t next; // Number of the record at `pos`
+  std::vector<uint64_t> index;
+  TraceState state;
+
+  bool decode(TraceRecord &record);
+  bool rebuild_index();
+};
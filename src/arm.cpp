@@ -1,5 +1,6 @@
 #include "bus.h"
 #include "cpu.h"
+#include "profiler.h"
 #include <cstdint>
 
 inline bool compare_instr(uint32_t instr, uint32_t mask, uint32_t format) {
@@ -82,62 +83,6 @@ bool CPU::arm_is_dproc(uint32_t instr) {
   return compare_instr(instr, mask, dproc_format);
 }
 
-bool CPU::barrel_shift(uint32_t &val, SHIFT shift_type, uint8_t shift_amount,
-                       bool shift_by_reg) {
-  bool carry_out = get_cc(C);
-
-  if (shift_by_reg && shift_amount == 0) {
-    return carry_out;
-  }
-
-  switch (shift_type) {
-  case LSL:
-    if (shift_amount == 0) {
-    } else if (shift_amount == 32) {
-      carry_out = val & 0x1;
-      val = 0;
-    } else {
-      carry_out = shift_amount > 32 ? 0 : (val << (shift_amount - 1)) >> 31;
-      val = shift_amount > 32 ? 0 : val << shift_amount;
-    }
-    break;
-  case LSR:
-    if ((!shift_by_reg && shift_amount == 0) || shift_amount == 32) {
-      carry_out = val >> 31;
-      val = 0;
-    } else {
-      carry_out = shift_amount > 32 ? 0 : (val >> (shift_amount - 1)) & 0x1;
-      val = shift_amount > 32 ? 0 : val >> shift_amount;
-    }
-    break;
-  case ASR:
-    if (!shift_by_reg && shift_amount == 0) {
-      carry_out = val >> 31;
-      val = carry_out ? 0xffffffff : 0;
-    } else {
-      carry_out = shift_amount > 31
-                      ? val >> 31
-                      : (static_cast<int32_t>(val) >> (shift_amount - 1)) & 0x1;
-      val = shift_amount > 31 ? val >> 31 ? 0xffffffff : 0
-                              : static_cast<int32_t>(val) >> shift_amount;
-    }
-    break;
-  case ROR:
-    if (!shift_by_reg && shift_amount == 0) {
-      uint32_t carry_in = carry_out;
-      carry_out = val & 0x1;
-      val = val >> 1 | carry_in << 31;
-    } else {
-      val = (val >> (shift_amount & 0x1f)) | (val << ((-shift_amount) & 0x1f));
-      carry_out = val >> 31;
-    }
-    break;
-  default:
-    break;
-  }
-  return carry_out;
-}
-
 void CPU::arm_bx(uint32_t instr) {
   uint8_t rn = instr & 0xf;
   uint32_t reg_val = get_reg(rn);
@@ -173,13 +118,14 @@ void CPU::arm_bdt(uint32_t instr) {
   uint32_t bank = 0;
 
   bool r15_transfer = (reg_list >> 0xf) & 0x1;
+  bool restore = false;
 
   if (s) {
     if (l && r15_transfer) {
-      cpsr = get_psr();
+      restore = true; // Exception return, see below
     } else {
       bank = cpsr;
-      cpsr = (cpsr & ~0xff) | MODE::USR;
+      set_mode(MODE::USR);
     }
   }
 
@@ -212,36 +158,79 @@ void CPU::arm_bdt(uint32_t instr) {
 
   bus->set_last_cycle_type(CYCLE_TYPE::NON_SEQ);
 
-  for (int i = first_reg; i < 16; i++) {
-    if (!(reg_list & (1 << i))) {
-      continue;
-    }
-    if (p)
-      addr += 4;
-    if (l) {
-      uint32_t val = bus->read32(addr, CYCLE_TYPE::SEQ);
-      if (w && i == first_reg) {
-        set_reg(rn, addr_copy);
+  // Stack and memcpy style transfers within plain memory skip the bus: one
+  // bounds check, then straight between the register file and host memory.
+  // PC and user bank transfers keep the per-word path.
+  uint32_t start = (addr + (p ? 4 : 0)) & ~0x3;
+  uint32_t *mem = nullptr;
+  if (!s && !r15_transfer) {
+    mem = reinterpret_cast<uint32_t *>(bus->get_host_ptr(start, size, !l));
+  }
+
+  if (mem) {
+    uint32_t *word = mem;
+    for (int i = first_reg; i < 15; i++) {
+      if (!(reg_list & (1 << i))) {
+        continue;
       }
-      set_reg(i, val);
-    } else {
-      bus->write32(addr, get_reg(i) + ((i == 15) << 2), CYCLE_TYPE::SEQ);
-      if (w && i == first_reg) {
-        set_reg(rn, addr_copy);
+      if (l) {
+        uint32_t val = *word++;
+        if (w && i == first_reg) {
+          set_reg(rn, addr_copy);
+        }
+        regs[i] = val;
+      } else {
+        *word++ = regs[i];
+        if (w && i == first_reg) {
+          set_reg(rn, addr_copy);
+        }
       }
     }
+    bus->burst32(start, size / 4, !l);
+  } else {
+    for (int i = first_reg; i < 16; i++) {
+      if (!(reg_list & (1 << i))) {
+        continue;
+      }
+      if (p)
+        addr += 4;
+      if (l) {
+        uint32_t val = bus->read32(addr, CYCLE_TYPE::SEQ);
+        if (w && i == first_reg) {
+          set_reg(rn, addr_copy);
+        }
+        if (i == 15 && restore) {
+          regs[15] = val; // Aligned once the state it returns to is known
+        } else {
+          set_reg(i, val);
+        }
+      } else {
+        bus->write32(addr, get_reg(i) + ((i == 15) << 2), CYCLE_TYPE::SEQ);
+        if (w && i == first_reg) {
+          set_reg(rn, addr_copy);
+        }
+      }
 
-    if (!p)
-      addr -= 4;
+      if (!p)
+        addr += 4;
+    }
   }
 
   if (bank) {
-    cpsr = bank;
+    set_mode(static_cast<MODE>(bank & CONTROL::M));
+  }
+  if (restore) {
+    // CPSR = SPSR only once the registers and the base were written in the
+    // exception mode's bank
+    set_cpsr(get_psr());
+    set_reg(15, regs[15]);
   }
 
   if (l) {
     // cylce 1I
-    if (r15_transfer) {
+    if (r15_transfer && (cpsr & CONTROL::T)) {
+      thumb_fetch(); // LDM ^ returning to Thumb code
+    } else if (r15_transfer) {
       arm_fetch(); // 1N + 1S, next fetch -> +1S
     }
   } else {
@@ -269,14 +258,30 @@ void CPU::arm_bl(uint32_t instr) {
   set_reg(15, pc + offset);
 
   arm_fetch(); // 1N + 1S, next fetch -> +1S
+
+  if (l && profiler) {
+    profiler->call(pc + offset, pc - 4);
+  }
+
+  if (!l && (offset & 0x80000000)) {
+    check_idle_loop(pc - 8, pc + offset, false);
+  }
 }
 
 void CPU::arm_swi(uint32_t instr) {
-  regs_svc[1] = regs[15] - 4;
-  spsr_svc = cpsr;
+  if (hle_bios && hle_swi((instr >> 16) & 0xff)) {
+    return;
+  }
+  uint32_t lr = regs[15] - 4;
+  spsr_svc = get_cpsr();
   set_mode(MODE::SVC);
+  regs[14] = lr;
+  cpsr |= CONTROL::I;
   set_reg(15, 0x00000008);
   arm_fetch();
+  if (profiler) {
+    profiler->call(0x00000008, lr);
+  }
 }
 
 void CPU::arm_und(uint32_t instr) {}
@@ -379,8 +384,7 @@ void CPU::arm_mul(uint32_t instr) {
     res = get_reg(rn) * get_reg(rm);
     set_reg(rd, res);
     if (s) {
-      set_cc(FLAG::N, res >> 31);
-      set_cc(FLAG::Z, res == 0);
+      set_nz(res);
     }
     break;
   case 0x1:
@@ -388,8 +392,7 @@ void CPU::arm_mul(uint32_t instr) {
     res = get_reg(rm) * get_reg(rs) + get_reg(rn);
     set_reg(rd, res);
     if (s) {
-      set_cc(FLAG::N, res >> 31);
-      set_cc(FLAG::Z, res == 0);
+      set_nz(res);
     }
     cycle(1);
     break;
@@ -554,15 +557,14 @@ void CPU::arm_psrt(uint32_t instr) {
       psr |= op & mask;
       set_psr(psr);
     } else {
-      cpsr &= ~mask;
-      cpsr |= op & mask;
+      set_cpsr((get_cpsr() & ~mask) | (op & mask));
     }
   } else {
     uint8_t rd = (instr >> 12) & 0xf;
     if (psr) {
       set_reg(rd, get_psr());
     } else {
-      set_reg(rd, cpsr);
+      set_reg(rd, get_cpsr());
     }
   }
 }
@@ -577,15 +579,17 @@ void CPU::arm_dproc(uint32_t instr) {
   uint32_t op1 = get_reg(rn);
   uint32_t op2;
 
-  bool carry = get_cc(C);
+  bool carry;
 
   bool r15_transfer = (rd == 15);
 
   if (i) {
-    uint8_t imm = instr & 0xff;
-    uint8_t shift_amount = (instr >> 8) & 0xf;
-    op2 = imm;
-    carry = barrel_shift(op2, SHIFT::ROR, shift_amount * 2, true);
+    // 8 bit immediate rotated right by twice instr[11:8], C only changes
+    // when it is actually rotated
+    uint32_t imm = instr & 0xff;
+    uint32_t rotate = (instr >> 7) & 0x1e;
+    op2 = (imm >> rotate) | (imm << ((32 - rotate) & 0x1f));
+    carry = rotate ? op2 >> 31 : get_cc(C);
   } else {
     uint8_t rm = instr & 0xf;
     op2 = get_reg(rm);
@@ -594,7 +598,7 @@ void CPU::arm_dproc(uint32_t instr) {
 
     if (shift_by_reg) {
       uint8_t rs = (instr >> 8) & 0xf;
-      uint8_t shift_amount = get_reg(rs) & 0xf;
+      uint32_t shift_amount = get_reg(rs) & 0xff;
       if (rn == 15) {
         op1 += 4;
       }
@@ -602,186 +606,129 @@ void CPU::arm_dproc(uint32_t instr) {
         op2 += 4;
       }
       carry = barrel_shift(op2, shift_type, shift_amount, true);
+      // clock 1I
+    } else if ((instr & 0xff0) == 0) {
+      // LSL #0, by far the most common operand
+      carry = get_cc(C);
     } else {
       uint8_t amount = (instr >> 7) & 0x1f;
       carry = barrel_shift(op2, shift_type, amount, false);
     }
-
-    // clock 1I
   }
 
   uint32_t res;
   switch (opcode) {
   case DPROC_OPCODE::AND:
-    // std::cout << "AND" << std::endl;
     res = op1 & op2;
     if (s) {
-      set_cc(FLAG::N, res >> 31);
-      set_cc(FLAG::Z, res == 0);
-      set_cc(FLAG::C, carry);
+      set_logic(res, carry);
     }
     set_reg(rd, res);
     break;
   case DPROC_OPCODE::EOR:
-    // std::cout << "EOR" << std::endl;
     res = op1 ^ op2;
     if (s) {
-      set_cc(FLAG::N, res >> 31);
-      set_cc(FLAG::Z, res == 0);
-      set_cc(FLAG::C, carry);
+      set_logic(res, carry);
     }
     set_reg(rd, res);
     break;
   case DPROC_OPCODE::SUB:
-    // std::cout << "SUB" << std::endl;
     res = op1 - op2;
     if (s) {
-      set_cc(FLAG::N, res >> 31);
-      set_cc(FLAG::Z, res == 0);
-      set_cc(FLAG::C, op1 >= op2);
-      set_cc(FLAG::V,
-             ((op1 >> 31) != (op2 >> 31)) && ((op1 >> 31) != (res >> 31)));
+      set_sub(op1, op2, true, res);
     }
     set_reg(rd, res);
     break;
   case DPROC_OPCODE::RSB:
-    // std::cout << "RSB" << std::endl;
     res = op2 - op1;
     if (s) {
-      set_cc(FLAG::N, res >> 31);
-      set_cc(FLAG::Z, res == 0);
-      set_cc(FLAG::C, op2 >= op1);
-      set_cc(FLAG::V,
-             ((op2 >> 31) != (op1 >> 31)) && ((op2 >> 31) != (res >> 31)));
+      set_sub(op2, op1, true, res);
     }
     set_reg(rd, res);
     break;
   case DPROC_OPCODE::ADD:
-    // std::cout << "ADD" << std::endl;
     res = op1 + op2;
     if (s) {
-      set_cc(FLAG::N, res >> 31);
-      set_cc(FLAG::Z, res == 0);
-      set_cc(FLAG::C, (op1 >> 31) + (op2 >> 31) > (res >> 31));
-      set_cc(FLAG::V,
-             ((op1 >> 31) == (op2 >> 31)) && (op1 >> 31 != (res >> 31)));
+      set_add(op1, op2, false, res);
     }
     set_reg(rd, res);
     break;
-  case DPROC_OPCODE::ADC:
-    // std::cout << "ADC" << std::endl;
-    res = op1 + op2 + get_cc(FLAG::C);
+  case DPROC_OPCODE::ADC: {
+    bool c = get_cc(FLAG::C);
+    res = op1 + op2 + c;
     if (s) {
-      set_cc(FLAG::N, res >> 31);
-      set_cc(FLAG::Z, res == 0);
-      set_cc(FLAG::C, (op1 >> 31) + (op2 >> 31) + carry > (res >> 31));
-      set_cc(FLAG::V,
-             ((op1 >> 31) == (op2 >> 31)) && (op1 >> 31 != (res >> 31)));
+      set_add(op1, op2, c, res);
     }
     set_reg(rd, res);
     break;
-  case DPROC_OPCODE::SBC:
-    // std::cout << "SBC" << std::endl;
-    res = op1 - op2 - !get_cc(FLAG::C);
+  }
+  case DPROC_OPCODE::SBC: {
+    bool c = get_cc(FLAG::C);
+    res = op1 - op2 - !c;
     if (s) {
-      set_cc(FLAG::N, res >> 31);
-      set_cc(FLAG::Z, res == 0);
-      set_cc(FLAG::C, static_cast<uint64_t>(op1) >=
-                          static_cast<uint64_t>(op2) + !get_cc(FLAG::C));
-      set_cc(FLAG::V,
-             ((op1 >> 31) != (op2 >> 31)) && ((op1 >> 31) != (res >> 31)));
+      set_sub(op1, op2, c, res);
     }
     set_reg(rd, res);
     break;
-  case DPROC_OPCODE::RSC:
-    // std::cout << "RSC" << std::endl;
-    res = op2 - op1 - !get_cc(FLAG::C);
+  }
+  case DPROC_OPCODE::RSC: {
+    bool c = get_cc(FLAG::C);
+    res = op2 - op1 - !c;
     if (s) {
-      set_cc(FLAG::N, res >> 31);
-      set_cc(FLAG::Z, res == 0);
-      set_cc(FLAG::C, static_cast<uint64_t>(op2) >=
-                          static_cast<uint64_t>(op1) + !get_cc(FLAG::C));
-      set_cc(FLAG::V,
-             ((op2 >> 31) != (op1 >> 31)) && ((op2 >> 31) != (res >> 31)));
+      set_sub(op2, op1, c, res);
     }
+    set_reg(rd, res);
     break;
+  }
   case DPROC_OPCODE::TST:
-    // std::cout << "TST" << std::endl;
     res = op1 & op2;
     if (s) {
-      set_cc(FLAG::N, res >> 31);
-      set_cc(FLAG::Z, res == 0);
-      set_cc(FLAG::C, carry);
+      set_logic(res, carry);
     }
     break;
   case DPROC_OPCODE::TEQ:
-    // std::cout << "TEQ" << std::endl;
     res = op1 ^ op2;
     if (s) {
-      set_cc(FLAG::N, res >> 31);
-      set_cc(FLAG::Z, res == 0);
-      set_cc(FLAG::C, carry);
+      set_logic(res, carry);
     }
     break;
   case DPROC_OPCODE::CMP:
-    // std::cout << "CMP" << std::endl;
     res = op1 - op2;
     if (s) {
-      set_cc(FLAG::N, res >> 31);
-      set_cc(FLAG::Z, res == 0);
-      set_cc(FLAG::C, op1 >= op2);
-      set_cc(FLAG::V,
-             ((op1 >> 31) != (op2 >> 31)) && ((op1 >> 31) != (res >> 31)));
+      set_sub(op1, op2, true, res);
     }
     break;
   case DPROC_OPCODE::CMN:
-    // std::cout << "CMN" << std::endl;
     res = op1 + op2;
     if (s) {
-      set_cc(FLAG::N, res >> 31);
-      set_cc(FLAG::Z, res == 0);
-      set_cc(FLAG::C, (op1 >> 31) + (op2 >> 31) > (res >> 31));
-      set_cc(FLAG::V,
-             ((op1 >> 31) == (op2 >> 31)) && (op1 >> 31 != (res >> 31)));
+      set_add(op1, op2, false, res);
     }
     break;
   case DPROC_OPCODE::ORR:
-    // std::cout << "ORR" << std::endl;
     res = op1 | op2;
     if (s) {
-      set_cc(FLAG::N, res >> 31);
-      set_cc(FLAG::Z, res == 0);
-      set_cc(FLAG::C, carry);
+      set_logic(res, carry);
     }
     set_reg(rd, res);
     break;
   case DPROC_OPCODE::MOV:
-    // std::cout << "MOV" << std::endl;
     res = op2;
     if (s) {
-      set_cc(FLAG::N, res >> 31);
-      set_cc(FLAG::Z, res == 0);
-      set_cc(FLAG::C, carry);
+      set_logic(res, carry);
     }
     set_reg(rd, res);
     break;
   case DPROC_OPCODE::BIC:
-    // std::cout << "BIC" << std::endl;
     res = op1 & (~op2);
     if (s) {
-      set_cc(FLAG::N, res >> 31);
-      set_cc(FLAG::Z, res == 0);
-      set_cc(FLAG::C, carry);
+      set_logic(res, carry);
     }
     set_reg(rd, res);
     break;
   case DPROC_OPCODE::MVN:
-    // std::cout << "MVN" << std::endl;
     res = ~op2;
     if (s) {
-      set_cc(FLAG::N, res >> 31);
-      set_cc(FLAG::Z, res == 0);
-      set_cc(FLAG::C, carry);
+      set_logic(res, carry);
     }
     set_reg(rd, res);
     break;
@@ -790,8 +737,17 @@ void CPU::arm_dproc(uint32_t instr) {
   }
 
   if (r15_transfer) {
-    arm_fetch(); // 1N + 1S
-    if (s)
-      cpsr = get_psr();
+    if (s) {
+      // Exception return, the PC is aligned for the state it returns to
+      set_cpsr(get_psr());
+      if (opcode < DPROC_OPCODE::TST || opcode > DPROC_OPCODE::CMN) {
+        set_reg(15, res);
+      }
+    }
+    if (cpsr & CONTROL::T) {
+      thumb_fetch();
+    } else {
+      arm_fetch(); // 1N + 1S
+    }
   }
 }
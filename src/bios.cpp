@@ -0,0 +1,581 @@
+#include "bus.h"
+#include "cpu.h"
+#include <array>
+#include <cmath>
+#include <cstring>
+
+// High level emulation of the BIOS calls. A handled SWI runs natively and
+// never enters the BIOS; it is charged roughly the cycles the BIOS routine
+// takes, and the return refills the pipeline like the MOVS PC, LR the BIOS
+// leaves with. Anything not handled here still goes through the BIOS image,
+// or the stub Bus::load_hle_bios() put there instead.
+
+// All cycle costs in this file, this one and those the handlers return, are
+// estimates counted from the BIOS routines' instructions and the wait states
+// of the memory they touch. None were measured against a BIOS image or
+// hardware, so timing sensitive code can drift from real hardware.
+
+// SWI exception, the BIOS dispatcher and its return, from BIOS memory
+#define HLE_SWI_CYCLES 36
+
+#define HLE_DISPCNT 0x04000000
+#define HLE_IF 0x04000202
+#define HLE_IME 0x04000208
+#define HLE_RCNT 0x04000134
+#define HLE_HALTCNT 0x04000301
+#define HLE_IRQ_FLAGS 0x03007FF8 // Set by the game's IRQ handler for IntrWait
+
+// sin(2 * pi * i / 256) in 1.14 fixed point, the BIOS affine table
+static const std::array<int16_t, 256> sine_table = [] {
+  std::array<int16_t, 256> table{};
+  double pi = std::acos(-1.0);
+  for (int i = 0; i < 256; i++) {
+    table[i] = static_cast<int16_t>(std::lround(std::sin(i * pi / 128) *
+                                                0x4000));
+  }
+  return table;
+}();
+
+// arctan(i) for i in 1.14 fixed point, the BIOS polynomial
+static int32_t arctan(int32_t i) {
+  int32_t a = -((i * i) >> 14);
+  int32_t b = ((0xA9 * a) >> 14) + 0x390;
+  b = ((b * a) >> 14) + 0x91C;
+  b = ((b * a) >> 14) + 0xFB6;
+  b = ((b * a) >> 14) + 0x16AA;
+  b = ((b * a) >> 14) + 0x2081;
+  b = ((b * a) >> 14) + 0x3651;
+  b = ((b * a) >> 14) + 0xA2F9;
+  return (i * b) >> 16;
+}
+
+// Angle of (x, y) as 0x0000-0xFFFF for a full turn
+static uint32_t arctan2(int32_t x, int32_t y) {
+  if (y == 0) {
+    return (x >= 0) ? 0x0000 : 0x8000;
+  }
+  if (x == 0) {
+    return (y >= 0) ? 0x4000 : 0xC000;
+  }
+  if (y >= 0) {
+    if (x >= 0 ? x >= y : -x >= y) {
+      return arctan((y << 14) / x) + (x >= 0 ? 0x0000 : 0x8000);
+    }
+    return 0x4000 - arctan((x << 14) / y);
+  }
+  if (x <= 0 ? -x > -y : x >= -y) {
+    return arctan((y << 14) / x) + (x <= 0 ? 0x8000 : 0x10000);
+  }
+  return 0xC000 - arctan((x << 14) / y);
+}
+
+static inline uint32_t clz(uint32_t val) {
+  return val ? __builtin_clz(val) : 32;
+}
+
+bool CPU::hle_swi(uint8_t number) {
+  uint32_t cycles = 0;
+  switch (number) {
+  case 0x01: // RegisterRamReset
+    cycles = hle_register_ram_reset(regs[0]);
+    break;
+  case 0x02: // Halt
+  case 0x03: // Stop, which only ends on interrupts here too
+    bus->write8(HLE_HALTCNT, 0, CYCLE_TYPE::FAST);
+    break;
+  case 0x04: // IntrWait
+    return hle_intr_wait(false);
+  case 0x05: // VBlankIntrWait
+    return hle_intr_wait(true);
+  case 0x06: // Div
+  case 0x07: { // DivArm
+    int32_t num = regs[number == 0x06 ? 0 : 1];
+    int32_t den = regs[number == 0x06 ? 1 : 0];
+    if (den == 0) {
+      // The BIOS never finishes, pick something a game can live with
+      regs[0] = (num < 0) ? -1 : 1;
+      regs[1] = num;
+      regs[3] = 1;
+    } else if (den == -1) {
+      regs[0] = -static_cast<uint32_t>(num); // No overflow trap for INT_MIN
+      regs[1] = 0;
+      regs[3] = regs[0] & 0x80000000 ? -regs[0] : regs[0];
+    } else {
+      int32_t quot = num / den;
+      regs[0] = quot;
+      regs[1] = num % den;
+      regs[3] = (quot < 0) ? -static_cast<uint32_t>(quot) : quot;
+    }
+    // Shift and subtract, one pass per quotient bit
+    uint32_t abs_num = (num < 0) ? -static_cast<uint32_t>(num) : num;
+    uint32_t abs_den = (den < 0) ? -static_cast<uint32_t>(den) : den;
+    int32_t bits = clz(abs_den) - clz(abs_num) + 1;
+    cycles = 11 + 13 * (bits > 1 ? bits : 1) + (number == 0x07 ? 3 : 0);
+    break;
+  }
+  case 0x08: { // Sqrt
+    uint32_t val = regs[0];
+    uint32_t bits = 32 - clz(val);
+    uint32_t root = 0;
+    for (uint32_t bit = 1u << 30; bit; bit >>= 2) {
+      if (val >= root + bit) {
+        val -= root + bit;
+        root = (root >> 1) + bit;
+      } else {
+        root >>= 1;
+      }
+    }
+    regs[0] = root;
+    // One pass per result bit
+    cycles = 15 + 11 * ((bits + 1) / 2);
+    break;
+  }
+  case 0x09: // ArcTan
+    regs[0] = static_cast<uint16_t>(arctan(static_cast<int16_t>(regs[0])));
+    cycles = 37;
+    break;
+  case 0x0A: // ArcTan2
+    regs[0] = arctan2(regs[0], regs[1]) & 0xffff;
+    cycles = 37 + 60; // Plus the division
+    break;
+  case 0x0B: // CpuSet
+    cycles = hle_cpu_set(false);
+    break;
+  case 0x0C: // CpuFastSet
+    cycles = hle_cpu_set(true);
+    break;
+  case 0x0E: // BgAffineSet
+    cycles = hle_bg_affine_set();
+    break;
+  case 0x0F: // ObjAffineSet
+    cycles = hle_obj_affine_set();
+    break;
+  case 0x11: // LZ77UnCompWram
+  case 0x12: // LZ77UnCompVram
+    cycles = hle_lz77(number == 0x12);
+    break;
+  case 0x13: // HuffUnComp
+    cycles = hle_huffman();
+    break;
+  case 0x14: // RLUnCompWram
+  case 0x15: // RLUnCompVram
+    cycles = hle_rl(number == 0x15);
+    break;
+  case 0x16: // Diff8bitUnFilterWram
+  case 0x17: // Diff8bitUnFilterVram
+  case 0x18: // Diff16bitUnFilter
+    cycles = hle_diff(number == 0x18, number != 0x16);
+    break;
+  default:
+    return false;
+  }
+  hle_return(cycles);
+  return true;
+}
+
+void CPU::hle_return(uint32_t cycles) {
+  cycle(HLE_SWI_CYCLES + cycles);
+  if (cpsr & CONTROL::T) {
+    set_reg(15, regs[15] - 2);
+    thumb_fetch();
+  } else {
+    set_reg(15, regs[15] - 4);
+    arm_fetch();
+  }
+}
+
+bool CPU::hle_intr_wait(bool vblank) {
+  if (vblank) {
+    regs[0] = 1;
+    regs[1] = 1;
+  }
+  bus->write16(HLE_IME, 1, CYCLE_TYPE::FAST);
+
+  // r0 = 1 waits for a new request, but only on the first pass
+  uint16_t flags = bus->read16(HLE_IRQ_FLAGS, CYCLE_TYPE::FAST);
+  if (regs[0] && !hle_waiting) {
+    flags &= ~regs[1];
+  }
+  hle_waiting = !(flags & regs[1]);
+  if (!hle_waiting) {
+    bus->write16(HLE_IRQ_FLAGS, flags & ~regs[1], CYCLE_TYPE::FAST);
+    hle_return(0);
+    return true;
+  }
+  bus->write16(HLE_IRQ_FLAGS, flags, CYCLE_TYPE::FAST);
+
+  // Sleeps with the PC back on the SWI, so the IRQ returns into it and it
+  // checks again
+  cycle(HLE_SWI_CYCLES);
+  bus->write8(HLE_HALTCNT, 0, CYCLE_TYPE::FAST);
+  if (cpsr & CONTROL::T) {
+    set_reg(15, regs[15] - 4);
+    thumb_fetch();
+  } else {
+    set_reg(15, regs[15] - 8);
+    arm_fetch();
+  }
+  return true;
+}
+
+uint32_t CPU::hle_register_ram_reset(uint32_t flags) {
+  static const struct {
+    uint32_t addr;
+    uint32_t len;
+  } memory[] = {
+      {EWRAM_START, EWRAM_END - EWRAM_START + 1},
+      {IWRAM_START, 0x7e00}, // Keeps the stacks and IRQ vector
+      {PALRAM_START, PALRAM_END - PALRAM_START + 1},
+      {VRAM_START, VRAM_END - VRAM_START + 1},
+      {OAM_START, OAM_END - OAM_START + 1},
+  };
+  static const struct {
+    uint32_t flag;
+    uint32_t start;
+    uint32_t end;
+  } io[] = {
+      {1 << 5, 0x04000120, 0x04000130}, // SIO
+      {1 << 5, 0x04000140, 0x04000160}, // SIO JOY Bus
+      {1 << 6, 0x04000060, 0x040000b0}, // Sound
+      {1 << 7, 0x04000000, 0x04000060}, // LCD
+      {1 << 7, 0x040000b0, 0x04000110}, // DMA, timers
+      {1 << 7, 0x04000132, 0x04000136}, // KEYCNT, RCNT
+      {1 << 7, 0x04000200, 0x0400020c}, // IE, IF, WAITCNT, IME
+  };
+
+  uint32_t cycles = 0;
+  for (uint32_t i = 0; i < 5; i++) {
+    if (!(flags & (1 << i))) {
+      continue;
+    }
+    memset(bus->get_host_ptr(memory[i].addr, memory[i].len, true), 0,
+           memory[i].len);
+    // STMIA fill loop, the data writes plus about a cycle per word
+    cycles += memory[i].len / 4 *
+              (bus->get_wait(memory[i].addr, 4, CYCLE_TYPE::SEQ) + 1);
+  }
+  for (const auto &range : io) {
+    if (!(flags & range.flag)) {
+      continue;
+    }
+    for (uint32_t addr = range.start; addr < range.end; addr += 2) {
+      bus->write16(addr, 0, CYCLE_TYPE::FAST);
+      cycles += 4;
+    }
+  }
+  if (flags & (1 << 7)) {
+    // Identity affine transforms for BG2 and BG3
+    for (uint32_t addr : {0x04000020, 0x04000026, 0x04000030, 0x04000036}) {
+      bus->write16(addr, 0x100, CYCLE_TYPE::FAST);
+    }
+    // IF is write-1-to-clear, the zero above acknowledged nothing
+    bus->write16(HLE_IF, 0xffff, CYCLE_TYPE::FAST);
+  }
+  if (flags & (1 << 5)) {
+    // SIO back in general purpose mode
+    bus->write16(HLE_RCNT, 0x8000, CYCLE_TYPE::FAST);
+  }
+
+  // Forced blank no matter the flags
+  bus->write16(HLE_DISPCNT, 0x0080, CYCLE_TYPE::FAST);
+  return cycles;
+}
+
+uint32_t CPU::hle_cpu_set(bool fast) {
+  uint32_t src = regs[0];
+  uint32_t dst = regs[1];
+  bool fill = regs[2] & (1 << 24);
+  uint32_t size = (fast || (regs[2] & (1 << 26))) ? 4 : 2;
+  uint32_t units = regs[2] & 0x1fffff;
+  if (fast) {
+    units = (units + 7) & ~7; // Whole blocks of 8 words
+  }
+
+  // The BIOS refuses to read from itself
+  if (!(src & 0x0e000000) || !units) {
+    return 10;
+  }
+  src &= ~(size - 1);
+  dst &= ~(size - 1);
+
+  uint32_t len = units * size;
+  const uint8_t *from = bus->get_host_ptr(src, fill ? size : len, false);
+  uint8_t *to = bus->get_host_ptr(dst, len, true);
+  if (from && to && !fill && from < to && to < from + len) {
+    // Onto its own tail: forward a unit (CpuFastSet: 8 words) at a time like
+    // the BIOS loops, which repeats the pattern
+    uint32_t step = fast ? 32 : size;
+    for (uint32_t i = 0; i < len; i += step) {
+      memmove(to + i, from + i, step);
+    }
+  } else if (from && to && !fill) {
+    memmove(to, from, len);
+  } else if (from && to) {
+    for (uint32_t i = 0; i < len; i += size) {
+      memcpy(to + i, from, size);
+    }
+  } else {
+    // I/O, SRAM or a range crossing the end of a region
+    for (uint32_t i = 0; i < units; i++) {
+      uint32_t from_addr = fill ? src : src + i * size;
+      if (size == 4) {
+        bus->write32(dst + i * 4, bus->read32(from_addr, CYCLE_TYPE::FAST),
+                     CYCLE_TYPE::FAST);
+      } else {
+        bus->write16(dst + i * 2, bus->read16(from_addr, CYCLE_TYPE::FAST),
+                     CYCLE_TYPE::FAST);
+      }
+    }
+  }
+
+  // CpuSet moves one unit per 4 instruction loop, CpuFastSet 8 words per
+  // LDMIA/STMIA pair. The loops run from BIOS, so only data accesses wait.
+  uint32_t reads = fill ? 1 : units;
+  uint32_t read_wait = bus->get_wait(src, size, CYCLE_TYPE::SEQ);
+  uint32_t write_wait = bus->get_wait(dst, size, CYCLE_TYPE::SEQ);
+  if (fast) {
+    uint32_t blocks = units / 8;
+    return 20 + blocks * (fill ? 6 : 8) + reads * read_wait +
+           units * write_wait;
+  }
+  return 20 + units * (fill ? 5 : 7) + reads * read_wait + units * write_wait;
+}
+
+uint32_t CPU::hle_bg_affine_set() {
+  uint32_t src = regs[0];
+  uint32_t dst = regs[1];
+  for (uint32_t n = 0; n < regs[2]; n++, src += 20, dst += 16) {
+    // 19.8 texture origin, screen origin, 8.8 scales, angle in 8.8 turns
+    int32_t ox = bus->read32(src, CYCLE_TYPE::FAST);
+    int32_t oy = bus->read32(src + 4, CYCLE_TYPE::FAST);
+    int16_t cx = bus->read16(src + 8, CYCLE_TYPE::FAST);
+    int16_t cy = bus->read16(src + 10, CYCLE_TYPE::FAST);
+    int16_t sx = bus->read16(src + 12, CYCLE_TYPE::FAST);
+    int16_t sy = bus->read16(src + 14, CYCLE_TYPE::FAST);
+    uint8_t angle = bus->read16(src + 16, CYCLE_TYPE::FAST) >> 8;
+
+    int32_t sin = sine_table[angle];
+    int32_t cos = sine_table[(angle + 64) & 0xff];
+    int32_t pa = (sx * cos) >> 14;
+    int32_t pb = -(sx * sin) >> 14;
+    int32_t pc = (sy * sin) >> 14;
+    int32_t pd = (sy * cos) >> 14;
+
+    bus->write16(dst, pa, CYCLE_TYPE::FAST);
+    bus->write16(dst + 2, pb, CYCLE_TYPE::FAST);
+    bus->write16(dst + 4, pc, CYCLE_TYPE::FAST);
+    bus->write16(dst + 6, pd, CYCLE_TYPE::FAST);
+    bus->write32(dst + 8, ox - (pa * cx + pb * cy), CYCLE_TYPE::FAST);
+    bus->write32(dst + 12, oy - (pc * cx + pd * cy), CYCLE_TYPE::FAST);
+  }
+  return 10 + 60 * regs[2];
+}
+
+uint32_t CPU::hle_obj_affine_set() {
+  uint32_t src = regs[0];
+  uint32_t dst = regs[1];
+  uint32_t stride = regs[3]; // 2 for a packed matrix, 8 straight into OAM
+  for (uint32_t n = 0; n < regs[2]; n++, src += 8, dst += 4 * stride) {
+    int16_t sx = bus->read16(src, CYCLE_TYPE::FAST);
+    int16_t sy = bus->read16(src + 2, CYCLE_TYPE::FAST);
+    uint8_t angle = bus->read16(src + 4, CYCLE_TYPE::FAST) >> 8;
+
+    int32_t sin = sine_table[angle];
+    int32_t cos = sine_table[(angle + 64) & 0xff];
+    bus->write16(dst, (sx * cos) >> 14, CYCLE_TYPE::FAST);
+    bus->write16(dst + stride, -(sx * sin) >> 14, CYCLE_TYPE::FAST);
+    bus->write16(dst + 2 * stride, (sy * sin) >> 14, CYCLE_TYPE::FAST);
+    bus->write16(dst + 3 * stride, (sy * cos) >> 14, CYCLE_TYPE::FAST);
+  }
+  return 10 + 40 * regs[2];
+}
+
+// The decompressors read the source a byte at a time like the BIOS, build
+// the output on the host and store it in one go. Every source format starts
+// with a header word: type in bits 4-7, the decompressed size in 8-31.
+
+uint32_t CPU::hle_store(uint32_t dst, std::vector<uint8_t> &data,
+                        uint32_t unit) {
+  // The BIOS only ever stores whole units
+  data.resize((data.size() + unit - 1) & ~(unit - 1));
+  uint32_t units = data.size() / unit;
+  uint8_t *to = bus->get_host_ptr(dst, data.size(), true);
+  if (to) {
+    memcpy(to, data.data(), data.size());
+  } else {
+    for (uint32_t i = 0; i < data.size(); i += unit) {
+      uint32_t val = 0;
+      memcpy(&val, &data[i], unit);
+      if (unit == 4) {
+        bus->write32(dst + i, val, CYCLE_TYPE::FAST);
+      } else if (unit == 2) {
+        bus->write16(dst + i, val, CYCLE_TYPE::FAST);
+      } else {
+        bus->write8(dst + i, val, CYCLE_TYPE::FAST);
+      }
+    }
+  }
+  return units * bus->get_wait(dst, unit, CYCLE_TYPE::SEQ);
+}
+
+uint32_t CPU::hle_lz77(bool vram) {
+  uint32_t src = regs[0];
+  if (!(src & 0x0e000000)) {
+    return 10;
+  }
+  uint32_t header = bus->read32(src, CYCLE_TYPE::FAST);
+  src += 4;
+
+  // Flag byte, MSB first: 0 a literal byte, 1 a 2 byte reference of
+  // length 3-18 up to 4K back into the output
+  std::vector<uint8_t> out;
+  uint32_t size = header >> 8;
+  out.reserve(size);
+  while (out.size() < size) {
+    uint8_t flags = bus->read8(src++, CYCLE_TYPE::FAST);
+    for (int i = 0; i < 8 && out.size() < size; i++, flags <<= 1) {
+      if (!(flags & 0x80)) {
+        out.push_back(bus->read8(src++, CYCLE_TYPE::FAST));
+        continue;
+      }
+      uint8_t hi = bus->read8(src++, CYCLE_TYPE::FAST);
+      uint8_t lo = bus->read8(src++, CYCLE_TYPE::FAST);
+      uint32_t len = (hi >> 4) + 3;
+      uint32_t disp = ((hi & 0xf) << 8 | lo) + 1;
+      for (uint32_t n = 0; n < len && out.size() < size; n++) {
+        // Corrupt data may point before the start, the BIOS reads
+        // whatever is in front of the destination
+        out.push_back(disp <= out.size() ? out[out.size() - disp] : 0);
+      }
+    }
+  }
+
+  // About 10 cycles of BIOS code per byte, plus the source reads
+  uint32_t read_bytes = src - regs[0];
+  return 20 + 10 * size +
+         read_bytes * bus->get_wait(regs[0], 1, CYCLE_TYPE::SEQ) +
+         hle_store(regs[1], out, vram ? 2 : 1);
+}
+
+uint32_t CPU::hle_huffman() {
+  uint32_t src = regs[0];
+  if (!(src & 0x0e000000)) {
+    return 10;
+  }
+  uint32_t header = bus->read32(src, CYCLE_TYPE::FAST);
+
+  // Tree after the header: size byte, then nodes of a 6 bit offset to the
+  // child pair and two flags telling whether each child is a data leaf
+  uint32_t bits = header & 0xf;
+  uint32_t tree = src + 4;
+  uint32_t start = tree + (bus->read8(tree, CYCLE_TYPE::FAST) + 1) * 2;
+  uint32_t stream = start;
+  uint32_t root = tree + 1;
+
+  std::vector<uint8_t> out;
+  uint32_t size = header >> 8;
+  out.reserve(size + 4);
+  uint32_t word = 0;
+  uint32_t filled = 0;
+  uint32_t node_addr = root;
+  uint8_t node = bus->read8(node_addr, CYCLE_TYPE::FAST);
+  uint32_t symbols = 0;
+  while (out.size() < size && (bits == 4 || bits == 8)) {
+    uint32_t code = bus->read32(stream, CYCLE_TYPE::FAST);
+    stream += 4;
+    for (int i = 31; i >= 0 && out.size() < size; i--) {
+      bool right = (code >> i) & 0x1;
+      uint32_t child = (node_addr & ~0x1) + (node & 0x3f) * 2 + 2 + right;
+      uint8_t val = bus->read8(child, CYCLE_TYPE::FAST);
+      if (!(node & (right ? 0x40 : 0x80))) {
+        node_addr = child;
+        node = val;
+        continue;
+      }
+
+      // Symbols pack into words from the low bits up
+      word |= (val & ((1 << bits) - 1)) << filled;
+      filled += bits;
+      symbols++;
+      if (filled == 32) {
+        for (int b = 0; b < 4; b++) {
+          out.push_back(word >> (b * 8));
+        }
+        word = 0;
+        filled = 0;
+      }
+      node_addr = root;
+      node = bus->read8(node_addr, CYCLE_TYPE::FAST);
+    }
+  }
+
+  // About 12 cycles per bit of input and 20 per symbol
+  uint32_t read_words = (stream - start) / 4;
+  return 30 + 12 * 32 * read_words + 20 * symbols +
+         read_words * bus->get_wait(regs[0], 4, CYCLE_TYPE::SEQ) +
+         hle_store(regs[1], out, 4);
+}
+
+uint32_t CPU::hle_rl(bool vram) {
+  uint32_t src = regs[0];
+  if (!(src & 0x0e000000)) {
+    return 10;
+  }
+  uint32_t header = bus->read32(src, CYCLE_TYPE::FAST);
+  src += 4;
+
+  // Flag byte: bit 7 set repeats the next byte 3-130 times, clear copies
+  // 1-128 bytes
+  std::vector<uint8_t> out;
+  uint32_t size = header >> 8;
+  out.reserve(size + 130);
+  while (out.size() < size) {
+    uint8_t flag = bus->read8(src++, CYCLE_TYPE::FAST);
+    if (flag & 0x80) {
+      uint8_t val = bus->read8(src++, CYCLE_TYPE::FAST);
+      out.insert(out.end(), (flag & 0x7f) + 3, val);
+    } else {
+      for (uint32_t n = 0; n <= (flag & 0x7fu); n++) {
+        out.push_back(bus->read8(src++, CYCLE_TYPE::FAST));
+      }
+    }
+  }
+  out.resize(size);
+
+  // About 6 cycles per byte
+  uint32_t read_bytes = src - regs[0];
+  return 20 + 6 * size +
+         read_bytes * bus->get_wait(regs[0], 1, CYCLE_TYPE::SEQ) +
+         hle_store(regs[1], out, vram ? 2 : 1);
+}
+
+uint32_t CPU::hle_diff(bool wide, bool vram) {
+  uint32_t src = regs[0];
+  if (!(src & 0x0e000000)) {
+    return 10;
+  }
+  uint32_t header = bus->read32(src, CYCLE_TYPE::FAST);
+  src += 4;
+
+  // Each unit is stored as the difference to the one before
+  uint32_t size = header >> 8;
+  uint32_t unit = wide ? 2 : 1;
+  std::vector<uint8_t> out(size);
+  uint16_t val = 0;
+  for (uint32_t i = 0; i + unit <= size; i += unit) {
+    if (wide) {
+      val += bus->read16(src + i, CYCLE_TYPE::FAST);
+      out[i] = val;
+      out[i + 1] = val >> 8;
+    } else {
+      val += bus->read8(src + i, CYCLE_TYPE::FAST);
+      out[i] = val;
+    }
+  }
+
+  // About 8 cycles per unit
+  uint32_t units = size / unit;
+  return 20 + 8 * units +
+         units * bus->get_wait(regs[0], unit, CYCLE_TYPE::SEQ) +
+         hle_store(regs[1], out, (vram || wide) ? 2 : 1);
+}
@@ -1,11 +1,37 @@
 #include "bus.h"
 #include <cstdio>
+#include <cstring>
 
-Bus::Bus(CPU &cpu) : cpu(cpu) { keypad.keyinput.full = 0xffff; };
+// VRAM is 96K mirrored in 128K steps, the last 32K mirror the upper 32K
+static inline uint32_t vram_offset(uint32_t addr) {
+  uint32_t offset = addr & 0x1ffff;
+  return (offset >= 0x18000) ? offset - 0x8000 : offset;
+}
+
+Bus::Bus(CPU &cpu)
+    : cpu(cpu), ppu(nullptr), movie(nullptr), timer(*this, scheduler),
+      dma(*this, cpu), rom_size(0) {
+  keypad.keyinput.full = 0xffff;
+  keypad.keycnt.full = 0;
+  iwpdc.ime.full = 0;
+  iwpdc.ie.full = 0;
+  iwpdc.i_f.full = 0;
+  iwpdc.waitcnt.full = 0;
+  iwpdc.postflag.full = 0;
+  iwpdc.haltcnt.full = 0;
+  sound.soundcnt_h.full = 0;
+  fifo_len[0] = fifo_len[1] = 0;
+  prefetch.enabled = prefetch.active = false;
+  load_hle_bios();
+};
 
 Bus::~Bus() { delete ppu; }
 
-void Bus::attach_ppu(PPU *ppu) { this->ppu = ppu; }
+void Bus::attach_ppu(PPU *ppu) {
+  this->ppu = ppu;
+  // Most of the I/O table points into the PPU's registers
+  init_io();
+}
 // void Bus::tick_ppu() { ppu->tick(); }
 
 bool Bus::load_bios(const char *bios_file) {
@@ -14,8 +40,9 @@ bool Bus::load_bios(const char *bios_file) {
     return false;
   }
 
-  if (fread(bios, sizeof(uint8_t), sizeof(bios), fp)) {
+  if (fread(bios, sizeof(uint8_t), sizeof(bios), fp) != sizeof(bios)) {
     fclose(fp);
+    load_hle_bios();
     return false;
   }
 
@@ -26,6 +53,28 @@ bool Bus::load_bios(const char *bios_file) {
   return true;
 }
 
+void Bus::load_hle_bios() {
+  // Exception vectors, then the IRQ handler the real BIOS has at 0x128: it
+  // saves the scratch registers and calls the game's handler at 0x03007FFC.
+  // SWIs CPU::hle_swi() doesn't handle return straight away.
+  static const uint32_t code[] = {
+      0xE3A0F302, // 0x00 reset:    mov pc, #0x08000000
+      0xE1B0F00E, // 0x04 und:      movs pc, lr
+      0xE1B0F00E, // 0x08 swi:      movs pc, lr
+      0xE25EF004, // 0x0C pabt:     subs pc, lr, #4
+      0xE25EF008, // 0x10 dabt:     subs pc, lr, #8
+      0xE1B0F00E, // 0x14 reserved: movs pc, lr
+      0xE92D500F, // 0x18 irq:      stmfd sp!, {r0-r3, r12, lr}
+      0xE3A00301, //                mov r0, #0x04000000
+      0xE28FE000, //                add lr, pc, #0
+      0xE510F004, //                ldr pc, [r0, #-4]
+      0xE8BD500F, //                ldmfd sp!, {r0-r3, r12, lr}
+      0xE25EF004, //                subs pc, lr, #4
+  };
+  memset(bios, 0, sizeof(bios));
+  memcpy(bios, code, sizeof(code));
+}
+
 bool Bus::load_rom(const char *rom_file) {
   FILE *fp = fopen(rom_file, "rb");
   if (!fp) {
@@ -38,10 +87,12 @@ bool Bus::load_rom(const char *rom_file) {
 
   fseek(fp, 0, SEEK_SET);
 
-  if (fread(rom, sizeof(uint8_t), file_size, fp)) {
+  if (file_size > sizeof(rom) ||
+      fread(rom, sizeof(uint8_t), file_size, fp) != file_size) {
     fclose(fp);
     return false;
   }
+  rom_size = file_size;
 
   if (fclose(fp)) {
     return false;
@@ -50,6 +101,190 @@ bool Bus::load_rom(const char *rom_file) {
   return true;
 }
 
+bool Bus::load_rom(const uint8_t *data, size_t size) {
+  if (size > sizeof(rom)) {
+    return false;
+  }
+
+  memcpy(rom, data, size);
+  memset(rom + size, 0, sizeof(rom) - size);
+  rom_size = size;
+  return true;
+}
+
+std::string Bus::get_game_code() {
+  return std::string(reinterpret_cast<const char *>(rom + 0xac), 4);
+}
+
+void Bus::request_irq(IRQ irq) {
+  iwpdc.i_f.full |= 1 << irq;
+  update_irq();
+}
+
+void Bus::update_irq() {
+  uint16_t pending = iwpdc.ie.full & iwpdc.i_f.full & 0x3fff;
+
+  // HALT ends on any enabled request, even with IME off
+  if (pending) {
+    cpu.wake();
+  }
+  cpu.set_irq_line(iwpdc.ime.bits.disable && pending);
+}
+
+void Bus::set_keyinput(uint16_t keys) {
+  keypad.keyinput.full = keys;
+  check_keypad_irq();
+}
+
+void Bus::check_keypad_irq() {
+  if (!keypad.keycnt.bits.irqEnable) {
+    return;
+  }
+  uint16_t select = keypad.keycnt.full & 0x3ff;
+  uint16_t pressed = ~keypad.keyinput.full & 0x3ff;
+  bool cond = keypad.keycnt.bits.irqCond ? (pressed & select) == select
+                                         : (pressed & select) != 0;
+  if (cond) {
+    request_irq(IRQ_KEYPAD);
+  }
+}
+
+void Bus::fifo_tick(uint8_t id) {
+  for (uint8_t fifo = 0; fifo < 2; fifo++) {
+    uint8_t timer_select = fifo ? sound.soundcnt_h.bits.dmaBTimer
+                                : sound.soundcnt_h.bits.dmaATimer;
+    if (timer_select != id) {
+      continue;
+    }
+    if (fifo_len[fifo] > 0) {
+      fifo_len[fifo]--;
+    }
+    if (fifo_len[fifo] <= 16) {
+      dma.request_fifo(fifo);
+    }
+  }
+}
+
+uint8_t *Bus::get_host_ptr(uint32_t addr, uint32_t len, bool write) {
+  uint32_t offset;
+  switch ((addr >> 24) & 0xff) {
+  case 0x02: // EWRAM
+    offset = addr & 0x3ffff;
+    return (offset + len <= sizeof(ewram)) ? ewram + offset : nullptr;
+  case 0x03: // IWRAM
+    offset = addr & 0x7fff;
+    return (offset + len <= sizeof(iwram)) ? iwram + offset : nullptr;
+  case 0x05: // PALRAM
+    offset = addr & 0x3ff;
+    return (offset + len <= sizeof(palram)) ? palram + offset : nullptr;
+  case 0x06: // VRAM, the mirrored upper 32K goes through the slow path
+    offset = addr & 0x1ffff;
+    return (offset + len <= sizeof(vram)) ? vram + offset : nullptr;
+  case 0x07: // OAM
+    offset = addr & 0x3ff;
+    return (offset + len <= sizeof(oam)) ? oam + offset : nullptr;
+  case 0x08 ... 0x0D: // ROM
+    if (write) {
+      return nullptr;
+    }
+    offset = addr & 0x1ffffff;
+    return (offset + len <= sizeof(rom)) ? rom + offset : nullptr;
+  default:
+    return nullptr;
+  }
+}
+
+const uint8_t *Bus::get_fetch_page(uint32_t addr, uint32_t &base,
+                                   uint32_t &size) {
+  switch ((addr >> 24) & 0xff) {
+  case 0x00: // BIOS, only readable while executing inside it
+    if (addr >= sizeof(bios)) {
+      return nullptr;
+    }
+    base = 0;
+    size = sizeof(bios);
+    return bios;
+  case 0x02: // EWRAM
+    base = addr & ~0x3ffff;
+    size = sizeof(ewram);
+    return ewram;
+  case 0x03: // IWRAM
+    base = addr & ~0x7fff;
+    size = sizeof(iwram);
+    return iwram;
+  case 0x08 ... 0x0D: // ROM, one page per wait state mirror
+    base = addr & ~0x1ffffff;
+    size = sizeof(rom);
+    return rom;
+  default:
+    return nullptr;
+  }
+}
+
+uint32_t Bus::prefetch_fetch(uint32_t addr, uint32_t size,
+                             CPU::CYCLE_TYPE type) {
+  uint32_t region = (addr >> 24) & 0xf;
+  uint64_t now = scheduler.now();
+
+  if (!prefetch.active || type != CPU::CYCLE_TYPE::SEQ ||
+      addr != prefetch.head) {
+    // A plain access, the buffer starts reading ahead after it
+    if (last_cycle_type == CPU::CYCLE_TYPE::NON_SEQ) {
+      type = CPU::CYCLE_TYPE::NON_SEQ;
+    }
+    uint32_t cycles = (size == 4 ? wait32 : wait16)[type][region];
+    prefetch.active = true;
+    prefetch.head = addr + size;
+    prefetch.count = 0;
+    prefetch.progress = 0;
+    prefetch.last = now + cycles;
+    return cycles;
+  }
+
+  // Halfwords read since the last fetch, while the CPU was busy elsewhere
+  uint32_t seq = wait16[CPU::CYCLE_TYPE::SEQ][region];
+  if (now > prefetch.last) {
+    uint64_t idle = prefetch.progress + (now - prefetch.last);
+    uint64_t count = prefetch.count + idle / seq;
+    if (count >= 8) {
+      prefetch.count = 8;
+      prefetch.progress = 0;
+    } else {
+      prefetch.count = count;
+      prefetch.progress = idle % seq;
+    }
+    prefetch.last = now;
+  }
+
+  uint32_t halfwords = size / 2;
+  prefetch.head += size;
+  if (prefetch.count >= halfwords) {
+    // Straight from the buffer, which keeps reading meanwhile
+    prefetch.count -= halfwords;
+    return 1;
+  }
+
+  // Waits for the rest, the buffer is empty afterwards
+  uint32_t cycles = (halfwords - prefetch.count) * seq - prefetch.progress;
+  prefetch.count = 0;
+  prefetch.progress = 0;
+  prefetch.last = now + cycles;
+  return cycles;
+}
+
+void Bus::burst32(uint32_t addr, uint32_t count, bool write) {
+  uint32_t region = (addr >> 24) & 0xf;
+  stop_prefetch(addr);
+  if (write) {
+    perf.count_write(addr, Perf::WORD, count);
+  } else {
+    perf.count_read(addr, Perf::WORD, count);
+  }
+  cpu.cycle(wait32[CPU::CYCLE_TYPE::NON_SEQ][region] +
+            (count - 1) * wait32[CPU::CYCLE_TYPE::SEQ][region]);
+  last_cycle_type = CPU::CYCLE_TYPE::SEQ;
+}
+
 void Bus::set_last_cycle_type(CPU::CYCLE_TYPE cycle_type) {
   last_cycle_type = cycle_type;
 }
@@ -90,32 +325,29 @@ void Bus::update_wait() {
     wait32[n][x] = wait16[n][x] + wait16[s][x];
     wait32[s][x] = 2 * wait16[s][x];
   }
+
+  prefetch.enabled = iwpdc.waitcnt.bits.prefetch;
+  prefetch.active = false;
 }
 
 void Bus::write32(uint32_t addr, uint32_t data, CPU::CYCLE_TYPE type) {
   addr &= ~0x3;
   switch ((addr >> 24) & 0xff) {
   case 0x02:
-    *reinterpret_cast<uint32_t *>(ewram + (addr & 0x3fff)) = data;
+    *reinterpret_cast<uint32_t *>(ewram + (addr & 0x3ffff)) = data;
     break;
   case 0x03:
     *reinterpret_cast<uint32_t *>(iwram + (addr & 0x7fff)) = data;
     break;
   case 0x04:
-    write_mmio(addr + 0, ((data) >> 0) & 0xff);
-    write_mmio(addr + 1, ((data) >> 8) & 0xff);
-    write_mmio(addr + 2, ((data) >> 16) & 0xff);
-    write_mmio(addr + 3, ((data) >> 24) & 0xff);
+    write_io(addr + 0, data & 0xffff, 0xffff);
+    write_io(addr + 2, data >> 16, 0xffff);
     break;
   case 0x05:
     *reinterpret_cast<uint32_t *>(palram + (addr & 0x3ff)) = data;
     break;
   case 0x06:
-    addr &= 0x1ffff;
-    if (addr >= 0x18000) {
-      addr &= 0x7fff;
-    }
-    *reinterpret_cast<uint32_t *>(vram + addr) = data;
+    *reinterpret_cast<uint32_t *>(vram + vram_offset(addr)) = data;
     break;
   case 0x07:
     *reinterpret_cast<uint32_t *>(oam + (addr & 0x3ff)) = data;
@@ -130,6 +362,7 @@ void Bus::write32(uint32_t addr, uint32_t data, CPU::CYCLE_TYPE type) {
   if (type == CPU::CYCLE_TYPE::FAST) {
     return;
   }
+  perf.count_write(addr, Perf::WORD);
   if (last_cycle_type == CPU::CYCLE_TYPE::NON_SEQ) {
     type = CPU::CYCLE_TYPE::NON_SEQ;
   }
@@ -141,24 +374,19 @@ void Bus::write16(uint32_t addr, uint16_t data, CPU::CYCLE_TYPE type) {
   addr &= ~0x1;
   switch ((addr >> 24) & 0xff) {
   case 0x02:
-    *reinterpret_cast<uint16_t *>(ewram + (addr & 0x3fff)) = data;
+    *reinterpret_cast<uint16_t *>(ewram + (addr & 0x3ffff)) = data;
     break;
   case 0x03:
     *reinterpret_cast<uint16_t *>(iwram + (addr & 0x7fff)) = data;
     break;
   case 0x04:
-    write_mmio(addr + 0, ((data) >> 0) & 0xff);
-    write_mmio(addr + 1, ((data) >> 8) & 0xff);
+    write_io(addr, data, 0xffff);
     break;
   case 0x05:
     *reinterpret_cast<uint16_t *>(palram + (addr & 0x3ff)) = data;
     break;
   case 0x06:
-    addr &= 0x1ffff;
-    if (addr >= 0x18000) {
-      addr &= 0x7fff;
-    }
-    *reinterpret_cast<uint16_t *>(vram + addr) = data;
+    *reinterpret_cast<uint16_t *>(vram + vram_offset(addr)) = data;
     break;
   case 0x07:
     *reinterpret_cast<uint16_t *>(oam + (addr & 0x3ff)) = data;
@@ -169,6 +397,7 @@ void Bus::write16(uint32_t addr, uint16_t data, CPU::CYCLE_TYPE type) {
   if (type == CPU::CYCLE_TYPE::FAST) {
     return;
   }
+  perf.count_write(addr, Perf::HALF);
   if (last_cycle_type == CPU::CYCLE_TYPE::NON_SEQ) {
     type = CPU::CYCLE_TYPE::NON_SEQ;
   }
@@ -179,23 +408,20 @@ void Bus::write16(uint32_t addr, uint16_t data, CPU::CYCLE_TYPE type) {
 void Bus::write8(uint32_t addr, uint8_t data, CPU::CYCLE_TYPE type) {
   switch ((addr >> 24) & 0xff) {
   case 0x02:
-    *reinterpret_cast<uint8_t *>(ewram + (addr & 0x3fff)) = data;
+    *reinterpret_cast<uint8_t *>(ewram + (addr & 0x3ffff)) = data;
     break;
   case 0x03:
     *reinterpret_cast<uint8_t *>(iwram + (addr & 0x7fff)) = data;
     break;
   case 0x04:
-    write_mmio(addr + 0, ((data) >> 0) & 0xff);
+    write_io(addr & ~0x1, data << ((addr & 0x1) * 8),
+             0xff << ((addr & 0x1) * 8));
     break;
   case 0x05:
     *reinterpret_cast<uint8_t *>(palram + (addr & 0x3ff)) = data;
     break;
   case 0x06:
-    addr &= 0x1ffff;
-    if (addr >= 0x18000) {
-      addr &= 0x7fff;
-    }
-    *reinterpret_cast<uint8_t *>(vram + addr) = data;
+    *reinterpret_cast<uint8_t *>(vram + vram_offset(addr)) = data;
     break;
   case 0x07:
     *reinterpret_cast<uint8_t *>(oam + (addr & 0x3ff)) = data;
@@ -206,6 +432,7 @@ void Bus::write8(uint32_t addr, uint8_t data, CPU::CYCLE_TYPE type) {
   if (type == CPU::CYCLE_TYPE::FAST) {
     return;
   }
+  perf.count_write(addr, Perf::BYTE);
   if (last_cycle_type == CPU::CYCLE_TYPE::NON_SEQ) {
     type = CPU::CYCLE_TYPE::NON_SEQ;
   }
@@ -225,30 +452,28 @@ uint32_t Bus::read32(uint32_t addr, CPU::CYCLE_TYPE type) {
     }
     break;
   case 0x02: // EWRAM
-    data = *reinterpret_cast<uint32_t *>(ewram + (addr & 0x3fff));
+    data = *reinterpret_cast<uint32_t *>(ewram + (addr & 0x3ffff));
     break;
   case 0x03: // IWRAM
     data = *reinterpret_cast<uint32_t *>(iwram + (addr & 0x7fff));
     break;
   case 0x04: // MMIO
-    data = (read_mmio(addr + 0) << 0) | (read_mmio(addr + 1) << 8) |
-           (read_mmio(addr + 2) << 16) | (read_mmio(addr + 3) << 24);
+    data = read_io(addr + 0) | (read_io(addr + 2) << 16);
     break;
   case 0x05: // PALRAM
     data = *reinterpret_cast<uint32_t *>(palram + (addr & 0x3ff));
     break;
   case 0x06: // VRAM
-    addr &= 0x1ffff;
-    if (addr >= 0x18000) {
-      addr &= 0x7fff;
-    }
-    data = *reinterpret_cast<uint32_t *>(vram + addr);
+    data = *reinterpret_cast<uint32_t *>(vram + vram_offset(addr));
     break;
   case 0x07: // OAM
     data = *reinterpret_cast<uint32_t *>(oam + (addr & 0x3ff));
     break;
   case 0x08 ... 0x0D:
     data = *reinterpret_cast<uint32_t *>(rom + (addr & 0x1ffffff));
+    if (type != CPU::CYCLE_TYPE::FAST) {
+      prefetch.active = false;
+    }
     break;
   case 0x0E ... 0x0F:
     data = read_sram(addr);
@@ -260,6 +485,7 @@ uint32_t Bus::read32(uint32_t addr, CPU::CYCLE_TYPE type) {
   if (type == CPU::CYCLE_TYPE::FAST) {
     return data;
   }
+  perf.count_read(addr, Perf::WORD);
   if (last_cycle_type == CPU::CYCLE_TYPE::NON_SEQ) {
     type = CPU::CYCLE_TYPE::NON_SEQ;
   }
@@ -280,29 +506,28 @@ uint16_t Bus::read16(uint32_t addr, CPU::CYCLE_TYPE type) {
     }
     break;
   case 0x02: // EWRAM
-    data = *reinterpret_cast<uint16_t *>(ewram + (addr & 0x3fff));
+    data = *reinterpret_cast<uint16_t *>(ewram + (addr & 0x3ffff));
     break;
   case 0x03: // IWRAM
     data = *reinterpret_cast<uint16_t *>(iwram + (addr & 0x7fff));
     break;
   case 0x04: // MMIO
-    data = (read_mmio(addr + 0) << 0) | (read_mmio(addr + 1) << 8);
+    data = read_io(addr);
     break;
   case 0x05: // PALRAM
     data = *reinterpret_cast<uint16_t *>(palram + (addr & 0x3ff));
     break;
   case 0x06: // VRAM
-    addr &= 0x1ffff;
-    if (addr >= 0x18000) {
-      addr &= 0x7fff;
-    }
-    data = *reinterpret_cast<uint16_t *>(vram + addr);
+    data = *reinterpret_cast<uint16_t *>(vram + vram_offset(addr));
     break;
   case 0x07: // OAM
     data = *reinterpret_cast<uint16_t *>(oam + (addr & 0x3ff));
     break;
   case 0x08 ... 0x0D:
     data = *reinterpret_cast<uint16_t *>(rom + (addr & 0x1ffffff));
+    if (type != CPU::CYCLE_TYPE::FAST) {
+      prefetch.active = false;
+    }
     break;
   case 0x0E ... 0x0F:
     data = read_sram(addr);
@@ -314,6 +539,7 @@ uint16_t Bus::read16(uint32_t addr, CPU::CYCLE_TYPE type) {
   if (type == CPU::CYCLE_TYPE::FAST) {
     return data;
   }
+  perf.count_read(addr, Perf::HALF);
   if (last_cycle_type == CPU::CYCLE_TYPE::NON_SEQ) {
     type = CPU::CYCLE_TYPE::NON_SEQ;
   }
@@ -333,29 +559,28 @@ uint8_t Bus::read8(uint32_t addr, CPU::CYCLE_TYPE type) {
     }
     break;
   case 0x02: // EWRAM
-    data = *reinterpret_cast<uint8_t *>(ewram + (addr & 0x3fff));
+    data = *reinterpret_cast<uint8_t *>(ewram + (addr & 0x3ffff));
     break;
   case 0x03: // IWRAM
     data = *reinterpret_cast<uint8_t *>(iwram + (addr & 0x7fff));
     break;
   case 0x04: // MMIO
-    data = (read_mmio(addr + 0) << 0);
+    data = read_io(addr & ~0x1) >> ((addr & 0x1) * 8);
     break;
   case 0x05: // PALRAM
     data = *reinterpret_cast<uint8_t *>(palram + (addr & 0x3ff));
     break;
   case 0x06: // VRAM
-    addr &= 0x1ffff;
-    if (addr >= 0x18000) {
-      addr &= 0x7fff;
-    }
-    data = *reinterpret_cast<uint8_t *>(vram + addr);
+    data = *reinterpret_cast<uint8_t *>(vram + vram_offset(addr));
     break;
   case 0x07: // OAM
     data = *reinterpret_cast<uint8_t *>(oam + (addr & 0x3ff));
     break;
   case 0x08 ... 0x0D:
     data = *reinterpret_cast<uint8_t *>(rom + (addr & 0x1ffffff));
+    if (type != CPU::CYCLE_TYPE::FAST) {
+      prefetch.active = false;
+    }
     break;
   case 0x0E ... 0x0F:
     data = read_sram(addr);
@@ -367,6 +592,7 @@ uint8_t Bus::read8(uint32_t addr, CPU::CYCLE_TYPE type) {
   if (type == CPU::CYCLE_TYPE::FAST) {
     return data;
   }
+  perf.count_read(addr, Perf::BYTE);
   if (last_cycle_type == CPU::CYCLE_TYPE::NON_SEQ) {
     type = CPU::CYCLE_TYPE::NON_SEQ;
   }
@@ -379,342 +605,214 @@ uint32_t Bus::read_open_bus(uint32_t addr) { return 0; }
 
 uint32_t Bus::read_sram(uint32_t addr) { return 0; }
 
-void Bus::write_mmio(uint32_t addr, uint8_t data) {
-  switch (addr) {
+void Bus::map_io(uint32_t addr, uint16_t *data, uint16_t rmask,
+                 uint16_t wmask, IoWrite write, IoRead read) {
+  IoReg &reg = io[(addr - MMIO_START) >> 1];
+  reg.data = data;
+  reg.rmask = rmask;
+  reg.wmask = wmask;
+  reg.write = write;
+  reg.read = read;
+}
+
+void Bus::init_io() {
+  for (IoReg &reg : io) {
+    reg = {nullptr, 0, 0, nullptr, nullptr};
+  }
+
   /* LCD I/O Registers */
-  case REG_DISPCNT:
-    if (cpu.get_reg(15) >= 0x4000) {
-      // The CGB mode enable bit 3 can only be set by the bios
-      data &= 0xf7;
-    }
+  map_io(REG_DISPCNT, &ppu->lcd.dispcnt.full, 0xffff, 0xffff,
+         &Bus::write_dispcnt);
+  map_io(REG_GREENSWP, &ppu->lcd.greenswp.full, 0xffff, 0xffff);
+  map_io(REG_DISPSTAT, &ppu->lcd.dispstat.full, 0xffff, 0xffb8);
+  map_io(REG_VCOUNT, &ppu->lcd.vcount.full, 0xffff, 0x0000);
+  map_io(REG_BG0CNT, &ppu->lcd.bgcnt[0].full, 0xffff, 0xdfff);
+  map_io(REG_BG1CNT, &ppu->lcd.bgcnt[1].full, 0xffff, 0xdfff);
+  map_io(REG_BG2CNT, &ppu->lcd.bgcnt[2].full, 0xffff, 0xffff);
+  map_io(REG_BG3CNT, &ppu->lcd.bgcnt[3].full, 0xffff, 0xffff);
+  for (int i = 0; i < 4; i++) {
+    map_io(REG_BG0HOFS + i * 4, &ppu->lcd.bghofs[i].full, 0x0000, 0x01ff);
+    map_io(REG_BG0VOFS + i * 4, &ppu->lcd.bgvofs[i].full, 0x0000, 0x01ff);
+  }
+  for (int i = 0; i < 2; i++) {
+    uint32_t base = REG_BG2PA + i * 0x10;
+    map_io(base + 0x0, &ppu->lcd.bgpa[i].full, 0x0000, 0xffff);
+    map_io(base + 0x2, &ppu->lcd.bgpb[i].full, 0x0000, 0xffff);
+    map_io(base + 0x4, &ppu->lcd.bgpc[i].full, 0x0000, 0xffff);
+    map_io(base + 0x6, &ppu->lcd.bgpd[i].full, 0x0000, 0xffff);
+    map_io(base + 0x8, &ppu->lcd.bgx[i].halfwords[0], 0x0000, 0xffff,
+           &Bus::write_affine_ref);
+    map_io(base + 0xA, &ppu->lcd.bgx[i].halfwords[1], 0x0000, 0xffff,
+           &Bus::write_affine_ref);
+    map_io(base + 0xC, &ppu->lcd.bgy[i].halfwords[0], 0x0000, 0xffff,
+           &Bus::write_affine_ref);
+    map_io(base + 0xE, &ppu->lcd.bgy[i].halfwords[1], 0x0000, 0xffff,
+           &Bus::write_affine_ref);
+  }
+  map_io(REG_WIN0H, &ppu->lcd.winh[0].full, 0x0000, 0xffff);
+  map_io(REG_WIN1H, &ppu->lcd.winh[1].full, 0x0000, 0xffff);
+  map_io(REG_WIN0V, &ppu->lcd.winv[0].full, 0x0000, 0xffff);
+  map_io(REG_WIN1V, &ppu->lcd.winv[1].full, 0x0000, 0xffff);
+  map_io(REG_WININ, &ppu->lcd.winin.full, 0xffff, 0x3f3f);
+  map_io(REG_WINOUT, &ppu->lcd.winout.full, 0xffff, 0x3f3f);
+  map_io(REG_MOSAIC, &ppu->lcd.mosaic.halfwords[0], 0x0000, 0xffff);
+  map_io(REG_BLDCNT, &ppu->lcd.bldcnt.full, 0xffff, 0x3fff);
+  map_io(REG_BLDALPHA, &ppu->lcd.bldalpha.full, 0xffff, 0x1f1f);
+  map_io(REG_BLDY, &ppu->lcd.bldy.halfwords[0], 0x0000, 0xffff);
+
+  /* Sound Registers */
+  map_io(REG_SOUNDCNT_H, &sound.soundcnt_h.full, 0xffff, 0xffff,
+         &Bus::write_soundcnt_h);
+  for (uint32_t addr = REG_FIFO_A_L; addr <= REG_FIFO_B_H; addr += 2) {
+    map_io(addr, nullptr, 0x0000, 0x0000, &Bus::write_fifo);
+  }
 
-    ppu->lcd.dispcnt.bytes[0] = data;
-    break;
-  case REG_DISPCNT + 1:
-    ppu->lcd.dispcnt.bytes[1] = data;
-    break;
-  case REG_GREENSWP:
-    ppu->lcd.greenswp.bytes[0] = data;
-    break;
-  case REG_GREENSWP + 1:
-    ppu->lcd.greenswp.bytes[1] = data;
-    break;
-  case REG_DISPSTAT:
-    ppu->lcd.dispstat.bytes[0] &= 0x47;
-    ppu->lcd.dispstat.bytes[0] |= data & ~0x47;
-    break;
-  case REG_DISPSTAT + 1:
-    ppu->lcd.dispstat.bytes[1] = data;
-    break;
-  case REG_BG0CNT:
-    ppu->lcd.bgcnt[0].bytes[0] = data;
-    break;
-  case REG_BG0CNT + 1:
-    ppu->lcd.bgcnt[0].bytes[1] = data & 0xDF;
-    break;
-  case REG_BG1CNT:
-    ppu->lcd.bgcnt[1].bytes[0] = data;
-    break;
-  case REG_BG1CNT + 1:
-    ppu->lcd.bgcnt[1].bytes[1] = data & 0xDF;
-    break;
-  case REG_BG2CNT:
-    ppu->lcd.bgcnt[2].bytes[0] = data;
-    break;
-  case REG_BG2CNT + 1:
-    ppu->lcd.bgcnt[2].bytes[1] = data;
-    break;
-  case REG_BG3CNT:
-    ppu->lcd.bgcnt[3].bytes[0] = data;
-    break;
-  case REG_BG3CNT + 1:
-    ppu->lcd.bgcnt[3].bytes[1] = data;
-    break;
-  case REG_BG0HOFS:
-    ppu->lcd.bghofs[0].bytes[0] = data;
-    break;
-  case REG_BG0HOFS + 1:
-    ppu->lcd.bghofs[0].bytes[1] = data & 0x1;
-    break;
-  case REG_BG0VOFS:
-    ppu->lcd.bgvofs[0].bytes[0] = data;
-    break;
-  case REG_BG0VOFS + 1:
-    ppu->lcd.bgvofs[0].bytes[1] = data & 0x1;
-    break;
-  case REG_BG1HOFS:
-    ppu->lcd.bghofs[1].bytes[0] = data;
-    break;
-  case REG_BG1HOFS + 1:
-    ppu->lcd.bghofs[1].bytes[1] = data & 0x1;
-    break;
-  case REG_BG1VOFS:
-    ppu->lcd.bgvofs[1].bytes[0] = data;
-    break;
-  case REG_BG1VOFS + 1:
-    ppu->lcd.bgvofs[1].bytes[1] = data & 0x1;
-    break;
-  case REG_BG2HOFS:
-    ppu->lcd.bghofs[2].bytes[0] = data;
-    break;
-  case REG_BG2HOFS + 1:
-    ppu->lcd.bghofs[2].bytes[1] = data & 0x1;
-    break;
-  case REG_BG2VOFS:
-    ppu->lcd.bgvofs[2].bytes[0] = data;
-    break;
-  case REG_BG2VOFS + 1:
-    ppu->lcd.bgvofs[2].bytes[1] = data & 0x1;
-    break;
-  case REG_BG3HOFS:
-    ppu->lcd.bghofs[3].bytes[0] = data;
-    break;
-  case REG_BG3HOFS + 1:
-    ppu->lcd.bghofs[3].bytes[1] = data & 0x1;
-    break;
-  case REG_BG3VOFS:
-    ppu->lcd.bgvofs[3].bytes[0] = data;
-    break;
-  case REG_BG3VOFS + 1:
-    ppu->lcd.bgvofs[3].bytes[1] = data & 0x1;
-    break;
-  case REG_BG2PA:
-    ppu->lcd.bgpa[0].bytes[0] = data;
-    break;
-  case REG_BG2PA + 1:
-    ppu->lcd.bgpa[0].bytes[1] = data;
-    break;
-  case REG_BG2PB:
-    ppu->lcd.bgpb[0].bytes[0] = data;
-    break;
-  case REG_BG2PB + 1:
-    ppu->lcd.bgpb[0].bytes[1] = data;
-    break;
-  case REG_BG2PC:
-    ppu->lcd.bgpc[0].bytes[0] = data;
-    break;
-  case REG_BG2PC + 1:
-    ppu->lcd.bgpc[0].bytes[1] = data;
-    break;
-  case REG_BG2PD:
-    ppu->lcd.bgpd[0].bytes[0] = data;
-    break;
-  case REG_BG2PD + 1:
-    ppu->lcd.bgpd[0].bytes[1] = data;
-    break;
-  case REG_BG2X:
-    internalPX[0].bytes[0] = ppu->lcd.bgx[0].bytes[0] = data;
-    break; // gba->ppu.reload_internal_affine_regs = true; break;
-  case REG_BG2X + 1:
-    internalPX[0].bytes[1] = ppu->lcd.bgx[0].bytes[1] = data;
-    break; // gba->ppu.reload_internal_affine_regs = true; break;
-  case REG_BG2X + 2:
-    internalPX[0].bytes[2] = ppu->lcd.bgx[0].bytes[2] = data;
-    break; // gba->ppu.reload_internal_affine_regs = true; break;
-  case REG_BG2X + 3:
-    internalPX[0].bytes[3] = ppu->lcd.bgx[0].bytes[3] = data;
-    break; // gba->ppu.reload_internal_affine_regs = true; break;
-  case REG_BG2Y:
-    internalPY[0].bytes[0] = ppu->lcd.bgy[0].bytes[0] = data;
-    break; // gba->ppu.reload_internal_affine_regs = true; break;
-  case REG_BG2Y + 1:
-    internalPY[0].bytes[1] = ppu->lcd.bgy[0].bytes[1] = data;
-    break; // gba->ppu.reload_internal_affine_regs = true; break;
-  case REG_BG2Y + 2:
-    internalPY[0].bytes[2] = ppu->lcd.bgy[0].bytes[2] = data;
-    break; // gba->ppu.reload_internal_affine_regs = true; break;
-  case REG_BG2Y + 3:
-    internalPY[0].bytes[3] = ppu->lcd.bgy[0].bytes[3] = data;
-    break; // gba->ppu.reload_internal_affine_regs = true; break;
-  case REG_BG3PA:
-    ppu->lcd.bgpa[1].bytes[0] = data;
-    break;
-  case REG_BG3PA + 1:
-    ppu->lcd.bgpa[1].bytes[1] = data;
-    break;
-  case REG_BG3PB:
-    ppu->lcd.bgpb[1].bytes[0] = data;
-    break;
-  case REG_BG3PB + 1:
-    ppu->lcd.bgpb[1].bytes[1] = data;
-    break;
-  case REG_BG3PC:
-    ppu->lcd.bgpc[1].bytes[0] = data;
-    break;
-  case REG_BG3PC + 1:
-    ppu->lcd.bgpc[1].bytes[1] = data;
-    break;
-  case REG_BG3PD:
-    ppu->lcd.bgpd[1].bytes[0] = data;
-    break;
-  case REG_BG3PD + 1:
-    ppu->lcd.bgpd[1].bytes[1] = data;
-    break;
-  case REG_BG3X:
-    internalPX[1].bytes[0] = ppu->lcd.bgx[1].bytes[0] = data;
-    break; // gba->ppu.reload_internal_affine_regs = true; break;
-  case REG_BG3X + 1:
-    internalPX[1].bytes[1] = ppu->lcd.bgx[1].bytes[1] = data;
-    break; // gba->ppu.reload_internal_affine_regs = true; break;
-  case REG_BG3X + 2:
-    internalPX[1].bytes[2] = ppu->lcd.bgx[1].bytes[2] = data;
-    break; // gba->ppu.reload_internal_affine_regs = true; break;
-  case REG_BG3X + 3:
-    internalPX[1].bytes[3] = ppu->lcd.bgx[1].bytes[3] = data;
-    break; // gba->ppu.reload_internal_affine_regs = true; break;
-  case REG_BG3Y:
-    internalPY[1].bytes[0] = ppu->lcd.bgy[1].bytes[0] = data;
-    break; // gba->ppu.reload_internal_affine_regs = true; break;
-  case REG_BG3Y + 1:
-    internalPY[1].bytes[1] = ppu->lcd.bgy[1].bytes[1] = data;
-    break; // gba->ppu.reload_internal_affine_regs = true; break;
-  case REG_BG3Y + 2:
-    internalPY[1].bytes[2] = ppu->lcd.bgy[1].bytes[2] = data;
-    break; // gba->ppu.reload_internal_affine_regs = true; break;
-  case REG_BG3Y + 3:
-    internalPY[1].bytes[3] = ppu->lcd.bgy[1].bytes[3] = data;
-    break; // gba->ppu.reload_internal_affine_regs = true; break;
-  case REG_WIN0H:
-    ppu->lcd.winh[0].bytes[0] = data;
-    break;
-  case REG_WIN0H + 1:
-    ppu->lcd.winh[0].bytes[1] = data;
-    break;
-  case REG_WIN1H:
-    ppu->lcd.winh[1].bytes[0] = data;
-    break;
-  case REG_WIN1H + 1:
-    ppu->lcd.winh[1].bytes[1] = data;
-    break;
-  case REG_WIN0V:
-    ppu->lcd.winv[0].bytes[0] = data;
-    break;
-  case REG_WIN0V + 1:
-    ppu->lcd.winv[0].bytes[1] = data;
-    break;
-  case REG_WIN1V:
-    ppu->lcd.winv[1].bytes[0] = data;
-    break;
-  case REG_WIN1V + 1:
-    ppu->lcd.winv[1].bytes[1] = data;
-    break;
-  case REG_WININ:
-    ppu->lcd.winin.bytes[0] = data & 0x3F;
-    break;
-  case REG_WININ + 1:
-    ppu->lcd.winin.bytes[1] = data & 0x3F;
-    break;
-  case REG_WINOUT:
-    ppu->lcd.winout.bytes[0] = data & 0x3F;
-    break;
-  case REG_WINOUT + 1:
-    ppu->lcd.winout.bytes[1] = data & 0x3F;
-    break;
-  case REG_MOSAIC:
-    ppu->lcd.mosaic.bytes[0] = data;
-    break;
-  case REG_MOSAIC + 1:
-    ppu->lcd.mosaic.bytes[1] = data;
-    break;
-  case REG_BLDCNT:
-    ppu->lcd.bldcnt.bytes[0] = data;
-    break;
-  case REG_BLDCNT + 1:
-    ppu->lcd.bldcnt.bytes[1] = data & 0x3F;
-    break;
-  case REG_BLDALPHA:
-    ppu->lcd.bldalpha.bytes[0] = data & 0x1F;
-    break;
-  case REG_BLDALPHA + 1:
-    ppu->lcd.bldalpha.bytes[1] = data & 0x1F;
-    break;
-  case REG_BLDY:
-    ppu->lcd.bldy.bytes[0] = data;
-    break;
-  case REG_BLDY + 1:
-    ppu->lcd.bldy.bytes[1] = data;
-    break;
-  default:
-    break;
+  /* DMA Transfer Channels */
+  for (int i = 0; i < 4; i++) {
+    uint32_t base = REG_DMA0SAD + i * 12;
+    map_io(base + 0x0, &dma.dma[i].sad.halfwords[0], 0x0000, 0xffff);
+    map_io(base + 0x2, &dma.dma[i].sad.halfwords[1], 0x0000, 0xffff);
+    map_io(base + 0x4, &dma.dma[i].dad.halfwords[0], 0x0000, 0xffff);
+    map_io(base + 0x6, &dma.dma[i].dad.halfwords[1], 0x0000, 0xffff);
+    map_io(base + 0x8, &dma.dma[i].cnt_l.full, 0x0000, 0xffff);
+    map_io(base + 0xA, &dma.dma[i].cnt_h.full, 0xffff, 0x0000,
+           &Bus::write_dma_control);
   }
+
+  /* Timer Registers */
+  for (int i = 0; i < 4; i++) {
+    map_io(REG_TM0CNT_L + i * 4, &timer.tm[i].reload.full, 0xffff, 0xffff,
+           nullptr, &Bus::read_timer_counter);
+    map_io(REG_TM0CNT_H + i * 4, &timer.tm[i].cnt_h.full, 0x00ff, 0x0000,
+           &Bus::write_timer_control);
+  }
+
+  /* Keypad Input */
+  map_io(REG_KEYINPUT, &keypad.keyinput.full, 0xffff, 0x0000);
+  map_io(REG_KEYCNT, &keypad.keycnt.full, 0xffff, 0xc3ff,
+         &Bus::write_keycnt);
+
+  /* Interrupt, Waitstate, and Power-Down Control */
+  map_io(REG_IE, &iwpdc.ie.full, 0xffff, 0x3fff, &Bus::write_irq);
+  map_io(REG_IF, &iwpdc.i_f.full, 0xffff, 0x0000, &Bus::write_if);
+  // The Game Pak type flag is read only
+  map_io(REG_WAITCNT, &iwpdc.waitcnt.halfwords[0], 0xffff, 0x5fff,
+         &Bus::write_waitcnt);
+  map_io(REG_IME, &iwpdc.ime.halfwords[0], 0x00ff, 0x0001, &Bus::write_irq);
+  // POSTFLG and HALTCNT are separate bytes
+  map_io(REG_POSTFLG, nullptr, 0xffff, 0x0000, &Bus::write_postflg,
+         &Bus::read_postflg);
 }
 
-uint8_t Bus::read_mmio(uint32_t addr) {
-  if (addr >= REG_DISPCNT && addr <= REG_BLDY + 1) {
-    return read_lcd(addr);
-  } else if (addr >= REG_KEYINPUT && addr <= REG_KEYCNT + 1) {
-    return read_keypad(addr);
-  } else {
-    return 0;
+void Bus::write_io(uint32_t addr, uint16_t data, uint16_t lanes) {
+  if ((addr & ~0x3ff) != MMIO_START) {
+    return;
+  }
+
+  IoReg &reg = io[(addr & 0x3ff) >> 1];
+  uint16_t mask = reg.wmask & lanes;
+  if (mask) {
+    *reg.data = (*reg.data & ~mask) | (data & mask);
+  }
+  if (reg.write) {
+    (this->*reg.write)(addr, data, lanes);
   }
 }
 
-uint8_t Bus::read_keypad(uint32_t addr) {
-  switch (addr) {
-  case REG_KEYINPUT:
-    return (keypad.keyinput.bytes[0]);
-  case REG_KEYINPUT + 1:
-    return (keypad.keyinput.bytes[1]);
-  case REG_KEYCNT:
-    return (keypad.keycnt.bytes[0]);
-  case REG_KEYCNT + 1:
-    return (keypad.keycnt.bytes[1]);
-  default:
+uint16_t Bus::read_io(uint32_t addr) {
+  if ((addr & ~0x3ff) != MMIO_START) {
     return 0;
   }
+
+  IoReg &reg = io[(addr & 0x3ff) >> 1];
+  if (reg.read) {
+    return (this->*reg.read)(addr) & reg.rmask;
+  }
+  return reg.data ? *reg.data & reg.rmask : 0;
 }
 
-uint8_t Bus::read_lcd(uint32_t addr) {
-  switch (addr) {
-  case REG_DISPCNT:
-    return (ppu->lcd.dispcnt.bytes[0]);
-  case REG_DISPCNT + 1:
-    return (ppu->lcd.dispcnt.bytes[1]);
-  case REG_GREENSWP:
-    return (ppu->lcd.greenswp.bytes[0]);
-  case REG_GREENSWP + 1:
-    return (ppu->lcd.greenswp.bytes[1]);
-  case REG_DISPSTAT:
-    return (ppu->lcd.dispstat.bytes[0]);
-  case REG_DISPSTAT + 1:
-    return (ppu->lcd.dispstat.bytes[1]);
-  case REG_VCOUNT:
-    return (ppu->lcd.vcount.bytes[0]);
-  case REG_VCOUNT + 1:
-    return (ppu->lcd.vcount.bytes[1]);
-  case REG_BG0CNT:
-    return (ppu->lcd.bgcnt[0].bytes[0]);
-  case REG_BG0CNT + 1:
-    return (ppu->lcd.bgcnt[0].bytes[1]);
-  case REG_BG1CNT:
-    return (ppu->lcd.bgcnt[1].bytes[0]);
-  case REG_BG1CNT + 1:
-    return (ppu->lcd.bgcnt[1].bytes[1]);
-  case REG_BG2CNT:
-    return (ppu->lcd.bgcnt[2].bytes[0]);
-  case REG_BG2CNT + 1:
-    return (ppu->lcd.bgcnt[2].bytes[1]);
-  case REG_BG3CNT:
-    return (ppu->lcd.bgcnt[3].bytes[0]);
-  case REG_BG3CNT + 1:
-    return (ppu->lcd.bgcnt[3].bytes[1]);
-  case REG_WININ:
-    return (ppu->lcd.winin.bytes[0]);
-  case REG_WININ + 1:
-    return (ppu->lcd.winin.bytes[1]);
-  case REG_WINOUT:
-    return (ppu->lcd.winout.bytes[0]);
-  case REG_WINOUT + 1:
-    return (ppu->lcd.winout.bytes[1]);
-  case REG_BLDCNT:
-    return (ppu->lcd.bldcnt.bytes[0]);
-  case REG_BLDCNT + 1:
-    return (ppu->lcd.bldcnt.bytes[1]);
-  case REG_BLDALPHA:
-    return (ppu->lcd.bldalpha.bytes[0]);
-  case REG_BLDALPHA + 1:
-    return (ppu->lcd.bldalpha.bytes[1]);
-  default:
-    return 0;
+void Bus::write_dispcnt(uint32_t addr, uint16_t data, uint16_t lanes) {
+  if ((lanes & 0xff) && cpu.get_reg(15) >= 0x4000) {
+    // The CGB mode enable bit 3 can only be set by the bios
+    ppu->lcd.dispcnt.full &= ~0x8;
+  }
+}
+
+void Bus::write_affine_ref(uint32_t addr, uint16_t data, uint16_t lanes) {
+  // gba->ppu.reload_internal_affine_regs = true;
+  uint8_t id = addr >= REG_BG3X;
+  if (addr & 0x4) {
+    internalPY[id].full = ppu->lcd.bgy[id].full;
+  } else {
+    internalPX[id].full = ppu->lcd.bgx[id].full;
+  }
+}
+
+void Bus::write_soundcnt_h(uint32_t addr, uint16_t data, uint16_t lanes) {
+  if (sound.soundcnt_h.bits.dmaAReset) {
+    fifo_len[0] = 0;
+    sound.soundcnt_h.bits.dmaAReset = 0;
+  }
+  if (sound.soundcnt_h.bits.dmaBReset) {
+    fifo_len[1] = 0;
+    sound.soundcnt_h.bits.dmaBReset = 0;
+  }
+}
+
+void Bus::write_fifo(uint32_t addr, uint16_t data, uint16_t lanes) {
+  uint8_t fifo = addr >= REG_FIFO_B_L;
+  uint8_t bytes = ((lanes & 0x00ff) != 0) + ((lanes & 0xff00) != 0);
+  fifo_len[fifo] = (fifo_len[fifo] + bytes > 32) ? 32 : fifo_len[fifo] + bytes;
+}
+
+void Bus::write_dma_control(uint32_t addr, uint16_t data, uint16_t lanes) {
+  uint8_t id = (addr - REG_DMA0SAD) / 12;
+  if (lanes & 0x00ff) {
+    dma.set_control(id, 0, data & 0xff);
+  }
+  if (lanes & 0xff00) {
+    dma.set_control(id, 1, data >> 8);
+  }
+}
+
+void Bus::write_timer_control(uint32_t addr, uint16_t data, uint16_t lanes) {
+  if (lanes & 0x00ff) {
+    timer.set_control((addr - REG_TM0CNT_H) >> 2, data & 0xff);
   }
 }
+
+uint16_t Bus::read_timer_counter(uint32_t addr) {
+  return timer.get_counter((addr - REG_TM0CNT_L) >> 2);
+}
+
+void Bus::write_keycnt(uint32_t addr, uint16_t data, uint16_t lanes) {
+  check_keypad_irq();
+}
+
+void Bus::write_irq(uint32_t addr, uint16_t data, uint16_t lanes) {
+  update_irq();
+}
+
+void Bus::write_if(uint32_t addr, uint16_t data, uint16_t lanes) {
+  // Writing 1 acknowledges the request
+  iwpdc.i_f.full &= ~(data & lanes);
+  update_irq();
+}
+
+void Bus::write_waitcnt(uint32_t addr, uint16_t data, uint16_t lanes) {
+  update_wait();
+}
+
+void Bus::write_postflg(uint32_t addr, uint16_t data, uint16_t lanes) {
+  if (lanes & 0x00ff) {
+    iwpdc.postflag.full = data & 0x1;
+  }
+  if (lanes & 0xff00) {
+    // STOP isn't emulated separately, both modes wait for an interrupt
+    iwpdc.haltcnt.full = data >> 8;
+    cpu.halt();
+    update_irq(); // Doesn't halt at all if a request is already pending
+  }
+}
+
+uint16_t Bus::read_postflg(uint32_t addr) { return iwpdc.postflag.full; }
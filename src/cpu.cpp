@@ -1,222 +1,363 @@
 #include "cpu.h"
 #include "bus.h"
+#include "profiler.h"
 #include <chrono>
 #include <thread>
 #include <vector>
 
 #include <fstream>
 
-CPU::CPU() {};
+CPU::CPU()
+    : tracing(false), profiler(nullptr), hle_bios(true), bus(nullptr) {};
 
-CPU::~CPU() { delete bus; };
+CPU::~CPU() {
+  delete profiler;
+  delete bus;
+};
 
 void CPU::set_bus(Bus *bus) { this->bus = bus; }
 
 void CPU::start(const char *rom_file, const char *bios_file) {
+  load(rom_file, bios_file);
+
+  run();
+}
+
+void CPU::load(const char *rom_file, const char *bios_file) {
   bus->load_bios(bios_file);
   bus->load_rom(rom_file);
 
   bus->update_wait();
 
   reset();
+}
 
-  running = true;
+// Keyboard layout of the SDL frontend, bit in KEYINPUT
+static const struct {
+  SDL_Keycode sym;
+  uint16_t bit;
+} keymap[] = {
+    {SDLK_z, 1 << 0},         {SDLK_x, 1 << 1},     // A, B
+    {SDLK_BACKSPACE, 1 << 2}, {SDLK_RETURN, 1 << 3}, // Select, Start
+    {SDLK_RIGHT, 1 << 4},     {SDLK_LEFT, 1 << 5},
+    {SDLK_UP, 1 << 6},        {SDLK_DOWN, 1 << 7},
+    {SDLK_s, 1 << 8},         {SDLK_a, 1 << 9}, // R, L
+};
+
+void CPU::poll_events() {
+  auto poll_start = std::chrono::steady_clock::now();
+  uint16_t held = keys;
+  SDL_Event event;
+  while (SDL_PollEvent(&event)) {
+    if (event.type == SDL_QUIT) {
+      running = false;
+    } else if (event.type == SDL_KEYDOWN &&
+               event.key.keysym.sym == SDLK_F1) {
+      bus->get_ppu()->toggle_overlay();
+    } else if (event.type == SDL_KEYDOWN || event.type == SDL_KEYUP) {
+      for (const auto &key : keymap) {
+        if (event.key.keysym.sym == key.sym) {
+          keys = (event.type == SDL_KEYDOWN) ? keys & ~key.bit : keys | key.bit;
+        }
+      }
+    }
+  }
 
-  run();
+  // A movie being recorded holds them back until the next frame
+  if (keys != held) {
+    if (Movie *movie = bus->get_movie()) {
+      movie->set_keys(keys);
+    } else {
+      bus->set_keyinput(keys);
+    }
+  }
+
+  bus->perf.add_frontend_ns(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - poll_start)
+          .count());
 }
 
-void CPU::run() {
+void CPU::run(const char *trace_file) {
+  tracing = trace_file && trace_log.open(trace_file);
+  if (trace_file && !tracing) {
+    fprintf(stderr, "Can't open %s, not tracing\n", trace_file);
+  }
+  keys = bus->get_keyinput();
 
-  std::ofstream instrFile;
-  instrFile.open("instr.bin", std::ios::binary);
-  std::ofstream logFile;
-  logFile.open("regs.bin", std::ios::binary);
   while (running) {
-    // std::this_thread::sleep_for(std::chrono::nanoseconds(10));
-    SDL_Event event;
-    while (SDL_PollEvent(&event)) {
-      if (event.type == SDL_QUIT) {
-        running = false;
-      }
-    }
-
     auto start_time = std::chrono::steady_clock::now();
     cycles = 0;
 
+    uint64_t frame = bus->perf.frame_count();
     while (cycles < (2 << 24) && running) {
       // std::this_thread::sleep_for(std::chrono::nanoseconds(1));
-      if (cpsr & CONTROL::T) {
-        uint16_t instr = thumb_fetch_next();
-        // std::cout << std::hex << regs[15] - 4 << ": " << instr << std::endl;
-        uint32_t temp = instr;
-        instrFile.write(reinterpret_cast<const char *>(&temp),
-                        sizeof(uint32_t));
-        std::vector<uint32_t> logData;
-
-        // Add general-purpose registers (r0 - r15)
-        for (int i = 0; i < 16; i++) {
-          logData.push_back(get_reg(i));
-        }
-
-        // Add CPSR and SPSR
-        logData.push_back(cpsr);
-        logData.push_back(get_psr());
-
-        // Write to file as raw binary (little-endian)
-        logFile.write(reinterpret_cast<const char *>(logData.data()),
-                      logData.size() * sizeof(uint32_t));
-
-        static constexpr struct {
-          uint16_t mask;                  // Bitmask for matching
-          uint16_t format;                // Expected pattern
-          void (CPU::*handler)(uint16_t); // Function pointer to handler
-        } thumb_handlers[] = {
-            {0xF000, 0xF000, &CPU::thumb_lbl},    // lbl
-            {0xF800, 0xE000, &CPU::thumb_ub},     // ub
-            {0xFF00, 0xDF00, &CPU::thumb_swi},    // swi
-            {0xF000, 0xD000, &CPU::thumb_cb},     // cb
-            {0xF000, 0xC000, &CPU::thumb_mls},    // mls
-            {0xFF00, 0xB000, &CPU::thumb_aosp},   // aosp
-            {0xF000, 0xB000, &CPU::thumb_ppr},    // ppr
-            {0xF000, 0xA000, &CPU::thumb_la},     // la
-            {0xF800, 0x9000, &CPU::thumb_sprls},  // sprls
-            {0xF800, 0x8000, &CPU::thumb_lsh},    // lsh
-            {0xE000, 0x6000, &CPU::thumb_lsio},   // lsio
-            {0xF200, 0x5000, &CPU::thumb_lsro},   // lsro
-            {0xF200, 0x5200, &CPU::thumb_lssebh}, // lssebh
-            {0xF800, 0x4800, &CPU::thumb_pcrl},   // pcrl
-            {0xFC00, 0x4400, &CPU::thumb_hrobx},  // hrobx
-            {0xFC00, 0x4000, &CPU::thumb_alu},    // alu
-            {0xE000, 0x2000, &CPU::thumb_mcasi},  // mcasi
-            {0xF800, 0x1800, &CPU::thumb_as},     // as
-            {0xE000, 0x0000, &CPU::thumb_msr},    // msr
-        };
-
-        // Search for a matching instruction handler
-        for (const auto &entry : thumb_handlers) {
-          if ((instr & entry.mask) == entry.format) {
-            (this->*entry.handler)(instr);
-            break;
-          }
-        }
-      } else {
-        uint32_t instr = arm_fetch_next();
-
-        instrFile.write(reinterpret_cast<const char *>(&instr),
-                        sizeof(uint32_t));
-
-        std::vector<uint32_t> logData;
-
-        // Add general-purpose registers (r0 - r15)
-        for (int i = 0; i < 16; i++) {
-          logData.push_back(get_reg(i));
-        }
-
-        // Add CPSR and SPSR
-        logData.push_back(cpsr);
-        logData.push_back(get_psr());
-
-        // Write to file as raw binary (little-endian)
-        logFile.write(reinterpret_cast<const char *>(logData.data()),
-                      logData.size() * sizeof(uint32_t));
-
-        // std::cout << std::hex << regs[15] - 8 << ": " << std::hex << instr
-        // << std::endl;
-        //           << ": ";
-        COND cond = static_cast<COND>((instr >> 28) & 0xf);
-        if (!eval_cond(cond)) {
-          continue;
-        }
-
-        if (arm_is_bx(instr)) {
-          // std::cout << "bx" << std::endl;
-          arm_bx(instr); // NOTE: DONE
-        } else if (arm_is_bdt(instr)) {
-          // std::cout << "bdt" << std::endl;
-          arm_bdt(instr);
-        } else if (arm_is_bl(instr)) {
-          // std::cout << "bl" << std::endl;
-          arm_bl(instr); // NOTE: DONE
-        } else if (arm_is_swi(instr)) {
-          arm_swi(instr);
-        } else if (arm_is_und(instr)) {
-          arm_und(instr);
-        } else if (arm_is_sdt(instr)) {
-          arm_sdt(instr); // NOTE: DONE
-        } else if (arm_is_sds(instr)) {
-          NYI("sds");
-          // sds(instr);
-        } else if (arm_is_mul(instr)) {
-          arm_mul(instr);
-        } else if (arm_is_hdtri(instr)) {
-          arm_hdtri(instr);
-        } else if (arm_is_psrt(instr)) {
-          arm_psrt(instr); // NOTE: DONE
-        } else if (arm_is_dproc(instr)) {
-          arm_dproc(instr); // NOTE: DONE
-        } else {
-          std::cout << "unknown" << std::endl;
-          running = false;
-        }
+      step();
+      if (bus->perf.frame_count() != frame) {
+        frame = bus->perf.frame_count();
+        poll_events();
       }
     }
 
+    uint64_t frames, host_ns;
+    Perf::Frame sum = bus->perf.take_interval(frames, host_ns);
+    Perf::print(stdout, sum, frames, host_ns);
+
     auto now = std::chrono::steady_clock::now();
     auto elapsed_time =
         std::chrono::duration_cast<std::chrono::microseconds>(now - start_time)
             .count();
-    std::cout << "Elapsed time: " << elapsed_time << std::endl;
     auto sleep_time = std::chrono::microseconds(1000000) -
                       std::chrono::microseconds(elapsed_time);
 
     if (sleep_time.count() > 0) {
       std::this_thread::sleep_for(sleep_time);
+      bus->perf.add_sleep_ns(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now() - now)
+              .count());
+    }
+  }
+
+  if (tracing && !trace_log.close()) {
+    fprintf(stderr, "Failed to write %s\n", trace_file);
+  }
+  tracing = false;
+
+  dump_idle_loops();
+}
+
+uint64_t CPU::run_cycles(uint64_t count) {
+  uint64_t end = bus->scheduler.now() + count;
+  uint64_t executed = 0;
+  while (bus->scheduler.now() < end && running) {
+    executed += step();
+  }
+  return executed;
+}
+
+uint64_t CPU::run_frame() {
+  uint64_t frame = bus->perf.frame_count();
+  uint64_t executed = 0;
+  while (bus->perf.frame_count() == frame && running) {
+    executed += step();
+  }
+  return executed;
+}
+
+// Only called while profiling, kept inline so it adds no call per instruction
+inline void CPU::profile(uint32_t addr) {
+  profiler->step(addr);
+  if (profiler->sample_due()) {
+    profiler->sample(addr, get_reg(14), get_cpsr(), false);
+  }
+}
+
+uint32_t CPU::step() {
+  if (halted) {
+    // Nothing can change until the next event, skip straight to it
+    cycle(bus->scheduler.next() - bus->scheduler.now());
+    if (profiler && profiler->sample_due()) {
+      profiler->sample(0, get_reg(14), get_cpsr(), true);
+    }
+    return 0;
+  }
+
+  if (irq_line && !(cpsr & CONTROL::I)) {
+    irq();
+  }
+
+  // Fused pairs hide the boundary between their instructions, so they only
+  // run when nothing needs to see every instruction
+  bool fuse = !tracing && !profiler;
+
+  if (cpsr & CONTROL::T) {
+    uint16_t instr = thumb_fetch_next();
+    // std::cout << std::hex << regs[15] - 4 << ": " << instr << std::endl;
+    if (tracing) {
+      trace(instr);
+    }
+    if (profiler) {
+      profile(regs[15] - 4);
+    }
+    bus->perf.count_thumb();
+    if (fuse && thumb_fuse(instr)) {
+      return 2;
+    }
+    thumb_execute(instr);
+  } else {
+    uint32_t instr = arm_fetch_next();
+    // std::cout << std::hex << regs[15] - 8 << ": " << std::hex << instr
+    // << std::endl;
+    if (tracing) {
+      trace(instr);
+    }
+    if (profiler) {
+      profile(regs[15] - 8);
+    }
+    bus->perf.count_arm();
+    if (fuse && arm_fuse(instr)) {
+      return 2;
+    }
+    arm_execute(instr);
+  }
+  return 1;
+}
+
+Profiler *CPU::enable_profiler(uint32_t interval, size_t capacity) {
+  if (!profiler) {
+    profiler = new Profiler(bus->scheduler, interval, capacity);
+  }
+  return profiler;
+}
+
+void CPU::trace(uint32_t instr) {
+  TraceRecord record;
+  for (int i = 0; i < 16; i++) {
+    record.regs[i] = get_reg(i);
+  }
+  record.regs[16] = get_cpsr();
+  record.regs[17] = get_psr();
+  record.instr = instr;
+  trace_log.write(record);
+}
+
+void CPU::arm_execute(uint32_t instr) {
+  COND cond = static_cast<COND>((instr >> 28) & 0xf);
+  if (!eval_cond(cond)) {
+    return;
+  }
+
+  if (arm_is_bx(instr)) {
+    // std::cout << "bx" << std::endl;
+    arm_bx(instr); // NOTE: DONE
+  } else if (arm_is_bdt(instr)) {
+    // std::cout << "bdt" << std::endl;
+    arm_bdt(instr);
+  } else if (arm_is_bl(instr)) {
+    // std::cout << "bl" << std::endl;
+    arm_bl(instr); // NOTE: DONE
+  } else if (arm_is_swi(instr)) {
+    arm_swi(instr);
+  } else if (arm_is_und(instr)) {
+    arm_und(instr);
+  } else if (arm_is_sdt(instr)) {
+    arm_sdt(instr); // NOTE: DONE
+  } else if (arm_is_sds(instr)) {
+    NYI("sds");
+    // sds(instr);
+  } else if (arm_is_mul(instr)) {
+    arm_mul(instr);
+  } else if (arm_is_hdtri(instr)) {
+    arm_hdtri(instr);
+  } else if (arm_is_psrt(instr)) {
+    arm_psrt(instr); // NOTE: DONE
+  } else if (arm_is_dproc(instr)) {
+    arm_dproc(instr); // NOTE: DONE
+  } else {
+    std::cout << "unknown" << std::endl;
+    running = false;
+  }
+}
+
+void CPU::thumb_execute(uint16_t instr) {
+  static constexpr struct {
+    uint16_t mask;                  // Bitmask for matching
+    uint16_t format;                // Expected pattern
+    void (CPU::*handler)(uint16_t); // Function pointer to handler
+  } thumb_handlers[] = {
+      {0xF000, 0xF000, &CPU::thumb_lbl},    // lbl
+      {0xF800, 0xE000, &CPU::thumb_ub},     // ub
+      {0xFF00, 0xDF00, &CPU::thumb_swi},    // swi
+      {0xF000, 0xD000, &CPU::thumb_cb},     // cb
+      {0xF000, 0xC000, &CPU::thumb_mls},    // mls
+      {0xFF00, 0xB000, &CPU::thumb_aosp},   // aosp
+      {0xF000, 0xB000, &CPU::thumb_ppr},    // ppr
+      {0xF000, 0xA000, &CPU::thumb_la},     // la
+      {0xF800, 0x9000, &CPU::thumb_sprls},  // sprls
+      {0xF800, 0x8000, &CPU::thumb_lsh},    // lsh
+      {0xE000, 0x6000, &CPU::thumb_lsio},   // lsio
+      {0xF200, 0x5000, &CPU::thumb_lsro},   // lsro
+      {0xF200, 0x5200, &CPU::thumb_lssebh}, // lssebh
+      {0xF800, 0x4800, &CPU::thumb_pcrl},   // pcrl
+      {0xFC00, 0x4400, &CPU::thumb_hrobx},  // hrobx
+      {0xFC00, 0x4000, &CPU::thumb_alu},    // alu
+      {0xE000, 0x2000, &CPU::thumb_mcasi},  // mcasi
+      {0xF800, 0x1800, &CPU::thumb_as},     // as
+      {0xE000, 0x0000, &CPU::thumb_msr},    // msr
+  };
+
+  // Search for a matching instruction handler
+  for (const auto &entry : thumb_handlers) {
+    if ((instr & entry.mask) == entry.format) {
+      (this->*entry.handler)(instr);
+      break;
     }
   }
 }
 
 void CPU::reset() {
-  regs[0] = regs[1] = regs[2] = regs[3] = regs[4] = regs[5] = regs[6] =
-      regs[7] = regs[8] = regs[9] = regs[10] = regs[11] = regs[12] = regs[14] =
-          0;
+  for (int i = 0; i < 16; i++) {
+    regs[i] = 0;
+  }
+  for (int i = 0; i < 7; i++) {
+    regs_usr[i] = regs_fiq[i] = 0;
+  }
 
-  cpsr = 0;
+  // Banks are filled in while in user mode, set_mode() below loads the
+  // starting mode's r13/r14
+  cpsr = MODE::USR;
+  cpsr |= CONTROL::I;
+  cpsr |= CONTROL::F;
+  flags.op = FLAGS_CLEAN;
+  fetch_mem = nullptr;
+  fetch_base = fetch_size = 0; // The first fetch looks its page up
+  running = true;
+  halted = false;
+  irq_line = false;
+  hle_waiting = false;
+  for (uint32_t i = 0; i < IDLE_CACHE_SIZE; i++) {
+    idle_cache[i] = nullptr;
+  }
   bool use_bios = false;
   if (!use_bios) {
     regs[13] = regs_fiq[5] = regs_abt[0] = regs_und[0] = 0x03007F00;
     regs_svc[0] = 0x03007FE0;
     regs_irq[0] = 0x03007FA0;
 
+    // Where the BIOS hands over to the cartridge, in system mode with
+    // interrupts enabled
     regs[15] = 0x08000000;
-
-    cpsr |= MODE::SYS;
-    cpsr |= CONTROL::I;
-    cpsr |= CONTROL::F;
+    cpsr &= ~CONTROL::I;
+    cpsr &= ~CONTROL::F;
   } else {
     regs[13] = regs_fiq[5] = regs_abt[0] = regs_und[0] = 0;
     regs_svc[0] = 0;
     regs_irq[0] = 0;
     regs[15] = 0;
-
-    cpsr |= MODE::SVC;
-    cpsr |= CONTROL::I;
-    cpsr |= CONTROL::F;
   }
 
-  regs_fiq[0] = regs_fiq[1] = regs_fiq[2] = regs_fiq[3] = regs_fiq[4] =
-      regs_fiq[6] = spsr_fiq = 0;
   regs_svc[1] = spsr_svc = 0;
   regs_abt[1] = spsr_abt = 0;
   regs_irq[1] = spsr_irq = 0;
   regs_und[1] = spsr_und = 0;
+  spsr_fiq = 0;
+
+  set_mode(use_bios ? MODE::SVC : MODE::SYS);
 
   arm_fetch();
 }
 
-uint32_t CPU::get_cpsr() { return cpsr; }
-void CPU::set_cpsr(uint32_t val) { cpsr = val; }
+uint32_t CPU::get_cpsr() {
+  flush_flags();
+  return cpsr;
+}
 
-uint32_t dots = 0;
+void CPU::set_cpsr(uint32_t val) {
+  set_mode(static_cast<MODE>(val & CONTROL::M));
+  cpsr = val;
+  flags.op = FLAGS_CLEAN;
+}
 
 void CPU::cycle(uint32_t count) {
   // for (uint32_t i = 0; i < count; i++) {
@@ -225,107 +366,122 @@ void CPU::cycle(uint32_t count) {
   //   // }
   // }
   cycles += count;
-  dots += count;
-  if (dots >= 1232) {
-    bus->tick_ppu(cycles);
-    dots -= 1232;
+  bus->scheduler.tick(count);
+}
+
+void CPU::irq() {
+  // LR points one instruction past the one we return to, the handler leaves
+  // with subs pc, lr, #4
+  uint32_t lr = (cpsr & CONTROL::T) ? regs[15] + 2 : regs[15];
+  spsr_irq = get_cpsr();
+  set_mode(MODE::IRQ);
+  regs[14] = lr;
+  cpsr &= ~CONTROL::T;
+  cpsr |= CONTROL::I;
+  set_reg(15, 0x00000018);
+  arm_fetch();
+
+  if (profiler) {
+    profiler->call(0x00000018, lr - 4);
+  }
+}
+
+bool CPU::refresh_fetch(uint32_t addr) {
+  fetch_mem = bus->get_fetch_page(addr, fetch_base, fetch_size);
+  return fetch_mem != nullptr;
+}
+
+inline uint32_t CPU::fetch32(uint32_t addr, CYCLE_TYPE type) {
+  addr &= ~0x3;
+  if (addr - fetch_base >= fetch_size && !refresh_fetch(addr)) {
+    return bus->read32(addr, type);
   }
+  uint32_t data =
+      *reinterpret_cast<const uint32_t *>(fetch_mem + (addr - fetch_base));
+  bus->fetch_cycles(addr, 4, type);
+  return data;
+}
+
+inline uint16_t CPU::fetch16(uint32_t addr, CYCLE_TYPE type) {
+  addr &= ~0x1;
+  if (addr - fetch_base >= fetch_size && !refresh_fetch(addr)) {
+    return bus->read16(addr, type);
+  }
+  uint16_t data =
+      *reinterpret_cast<const uint16_t *>(fetch_mem + (addr - fetch_base));
+  bus->fetch_cycles(addr, 2, type);
+  return data;
 }
 
 void CPU::arm_fetch() {
-  pipeline[0] = bus->read32(regs[15], CYCLE_TYPE::NON_SEQ);
-  pipeline[1] = bus->read32(regs[15] + 4, CYCLE_TYPE::SEQ);
+  pipeline[0] = fetch32(regs[15], CYCLE_TYPE::NON_SEQ);
+  pipeline[1] = fetch32(regs[15] + 4, CYCLE_TYPE::SEQ);
   regs[15] += 4;
 }
 
 uint32_t CPU::arm_fetch_next() {
   uint32_t instr = pipeline[0];
   pipeline[0] = pipeline[1];
-  pipeline[1] = bus->read32(regs[15] + 4, CYCLE_TYPE::SEQ);
+  pipeline[1] = fetch32(regs[15] + 4, CYCLE_TYPE::SEQ);
   regs[15] += 4;
   return instr;
 }
 
 void CPU::thumb_fetch() {
-  pipeline[0] = bus->read16(regs[15], CYCLE_TYPE::NON_SEQ);
-  pipeline[1] = bus->read16(regs[15] + 2, CYCLE_TYPE::SEQ);
+  pipeline[0] = fetch16(regs[15], CYCLE_TYPE::NON_SEQ);
+  pipeline[1] = fetch16(regs[15] + 2, CYCLE_TYPE::SEQ);
   regs[15] += 2;
 }
 
 uint16_t CPU::thumb_fetch_next() {
   uint16_t instr = pipeline[0];
   pipeline[0] = pipeline[1];
-  pipeline[1] = bus->read16(regs[15] + 2, CYCLE_TYPE::SEQ);
+  pipeline[1] = fetch16(regs[15] + 2, CYCLE_TYPE::SEQ);
   regs[15] += 2;
   return instr;
 }
 
-uint32_t CPU::get_reg(uint8_t reg) {
-  if (reg <= 0x7 || reg == 0xF) {
-    return regs[reg];
+uint32_t *CPU::banked_sp_lr(MODE mode) {
+  switch (mode) {
+  case FIQ:
+    return &regs_fiq[5];
+  case IRQ:
+    return regs_irq;
+  case SVC:
+    return regs_svc;
+  case ABT:
+    return regs_abt;
+  case UND:
+    return regs_und;
+  default:
+    return &regs_usr[5];
   }
-
-  MODE mode = get_mode();
-
-  if (reg >= 0x8 && reg <= 0xC) {
-    return (mode == FIQ) ? regs_fiq[reg - 8] : regs[reg];
-  }
-
-  if (reg == 0xD || reg == 0xE) {
-    if (mode == USR || mode == SYS) {
-      return regs[reg];
-    } else if (mode == FIQ) {
-      return regs_fiq[reg - 8];
-    } else if (mode == IRQ) {
-      return regs_irq[reg - 0xD];
-    } else if (mode == SVC) {
-      return regs_svc[reg - 0xD];
-    } else if (mode == ABT) {
-      return regs_abt[reg - 0xD];
-    } else if (mode == UND) {
-      return regs_und[reg - 0xD];
-    }
-  }
-
-  return 0;
 }
 
-void CPU::set_reg(uint8_t reg, uint32_t val) {
-  if (reg <= 0x7) {
-    regs[reg] = val;
+void CPU::set_mode(MODE mode) {
+  MODE old = get_mode();
+  cpsr = (cpsr & ~CONTROL::M) | mode;
+  if (old == mode) {
     return;
   }
 
-  if (reg == 0xF) {
-    regs[15] = (cpsr & CONTROL::T) ? (val & ~0x1) : (val & ~0x3);
-    return;
-  }
-
-  MODE mode = get_mode();
-
-  if (reg >= 0x8 && reg <= 0xC) {
-    if (mode == FIQ) {
-      regs_fiq[reg - 8] = val;
-    } else {
-      regs[reg] = val;
+  // r8-r12 are only banked for FIQ
+  if ((old == FIQ) != (mode == FIQ)) {
+    uint32_t *out = (old == FIQ) ? regs_fiq : regs_usr;
+    uint32_t *in = (mode == FIQ) ? regs_fiq : regs_usr;
+    for (int i = 0; i < 5; i++) {
+      out[i] = regs[8 + i];
+      regs[8 + i] = in[i];
     }
-    return;
   }
 
-  if (reg == 0xD || reg == 0xE) {
-    if (mode == USR || mode == SYS) {
-      regs[reg] = val;
-    } else if (mode == FIQ) {
-      regs_fiq[reg - 8] = val;
-    } else if (mode == IRQ) {
-      regs_irq[reg - 0xD] = val;
-    } else if (mode == SVC) {
-      regs_svc[reg - 0xD] = val;
-    } else if (mode == ABT) {
-      regs_abt[reg - 0xD] = val;
-    } else if (mode == UND) {
-      regs_und[reg - 0xD] = val;
-    }
+  uint32_t *out = banked_sp_lr(old);
+  uint32_t *in = banked_sp_lr(mode);
+  if (out != in) {
+    out[0] = regs[13];
+    out[1] = regs[14];
+    regs[13] = in[0];
+    regs[14] = in[1];
   }
 }
 
@@ -385,32 +541,3 @@ void CPU::set_reg(uint8_t reg, uint32_t val) {
 //   }
 //   set_psr(psr);
 // }
-
-bool CPU::eval_cond(COND cond) {
-  bool n = get_cc(N);
-  bool z = get_cc(Z);
-  bool c = get_cc(C);
-  bool v = get_cc(V);
-
-  using CondFunc = bool (*)(bool, bool, bool, bool);
-
-  static const CondFunc cond_eval[] = {
-      [](bool, bool z, bool, bool) -> bool { return z; },                  // EQ
-      [](bool, bool z, bool, bool) -> bool { return !z; },                 // NE
-      [](bool, bool, bool c, bool) -> bool { return c; },                  // CS
-      [](bool, bool, bool c, bool) -> bool { return !c; },                 // CC
-      [](bool n, bool, bool, bool) -> bool { return n; },                  // MI
-      [](bool n, bool, bool, bool) -> bool { return !n; },                 // PL
-      [](bool, bool, bool, bool v) -> bool { return v; },                  // VS
-      [](bool, bool, bool, bool v) -> bool { return !v; },                 // VC
-      [](bool, bool z, bool c, bool) -> bool { return c && !z; },          // HI
-      [](bool, bool z, bool c, bool) -> bool { return !c || z; },          // LS
-      [](bool n, bool, bool, bool v) -> bool { return n == v; },           // GE
-      [](bool n, bool, bool, bool v) -> bool { return n != v; },           // LT
-      [](bool n, bool z, bool, bool v) -> bool { return !z && (n == v); }, // GT
-      [](bool n, bool z, bool, bool v) -> bool { return z || (n != v); },  // LE
-      [](bool, bool, bool, bool) -> bool { return true; }                  // AL
-  };
-
-  return (cond <= AL) ? cond_eval[cond](n, z, c, v) : false;
-}
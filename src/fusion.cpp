@@ -0,0 +1,139 @@
+#include "bus.h"
+#include "cpu.h"
+
+// Common instruction pairs run as one handler. The second instruction is
+// already in pipeline[0], so a pair is recognised from two words without
+// touching memory.
+//
+// Both instructions still advance the pipeline with their usual bus
+// accesses, so a fused pair takes exactly as many cycles as the two
+// instructions would. The saving is in what happens between them: one
+// trip through step() instead of two, no decoder search for the second
+// instruction, and for CMP + B<cond>, no flag materialization. Interrupts
+// are taken after the pair.
+
+// NZCV of op1 - op2, the nibble eval_cond indexes cond_table with
+static inline uint32_t sub_nzcv(uint32_t op1, uint32_t op2, uint32_t res) {
+  return (res >> 31) << 3 | (res == 0) << 2 | (op1 >= op2) << 1 |
+         (((op1 ^ op2) & (op1 ^ res)) >> 31);
+}
+
+bool CPU::arm_fuse(uint32_t instr) {
+  uint32_t next = pipeline[0];
+
+  // CMP Rn, #imm or CMP Rn, Rm followed by B<cond>, both outside r15
+  if ((instr & 0xfdf00000) == 0xe1500000 &&
+      (next & 0x0f000000) == 0x0a000000 && (next >> 28) != 0xf) {
+    bool i = (instr >> 25) & 0x1;
+    uint8_t rn = (instr >> 16) & 0xf;
+    uint8_t rm = instr & 0xf;
+    if (rn == 15 || (!i && ((instr & 0xff0) || rm == 15))) {
+      return false;
+    }
+
+    uint32_t op1 = regs[rn];
+    uint32_t op2;
+    if (i) {
+      uint32_t imm = instr & 0xff;
+      uint32_t rotate = (instr >> 7) & 0x1e;
+      op2 = (imm >> rotate) | (imm << ((32 - rotate) & 0x1f));
+    } else {
+      op2 = regs[rm];
+    }
+    uint32_t res = op1 - op2;
+    set_sub(op1, op2, true, res);
+
+    arm_fetch_next();
+    bus->perf.count_arm();
+    bus->perf.count_fused(Perf::FUSE_CMP_B);
+    if ((cond_table[next >> 28] >> sub_nzcv(op1, op2, res)) & 0x1) {
+      arm_bl(next);
+    }
+    return true;
+  }
+
+  // LDR Rd, [Rn, #+/-imm] followed by ADD Rn, Rn, #imm
+  if ((instr & 0xff700000) == 0xe5100000 &&
+      (next & 0xfff00000) == 0xe2800000) {
+    uint8_t rn = (instr >> 16) & 0xf;
+    uint8_t rd = (instr >> 12) & 0xf;
+    if (rn == 15 || rd == 15 || rd == rn || ((next >> 16) & 0xf) != rn ||
+        ((next >> 12) & 0xf) != rn) {
+      return false;
+    }
+
+    arm_sdt(instr);
+    arm_fetch_next();
+    bus->perf.count_arm();
+    bus->perf.count_fused(Perf::FUSE_LDR_ADD);
+    arm_dproc(next);
+    return true;
+  }
+
+  return false;
+}
+
+bool CPU::thumb_fuse(uint16_t instr) {
+  uint16_t next = pipeline[0];
+
+  // BL prefix + suffix, LR and PC are both known after the pair
+  if ((instr & 0xf800) == 0xf000 && (next & 0xf800) == 0xf800) {
+    uint32_t offset = instr & 0x7ff;
+    if (offset & 0x400) {
+      offset |= 0xfffff800;
+    }
+    uint32_t ret = regs[15]; // Address of the instruction after the suffix
+    uint32_t target = ret + (offset << 12) + ((next & 0x7ff) << 1);
+
+    thumb_fetch_next();
+    bus->perf.count_thumb();
+    bus->perf.count_fused(Perf::FUSE_BL);
+    regs[14] = ret | 0x1;
+    set_reg(15, target);
+    thumb_fetch();
+    return true;
+  }
+
+  // CMP Rd, #imm or CMP Rd, Rs followed by B<cond>
+  if ((next & 0xf000) == 0xd000 && ((next >> 8) & 0xf) < AL) {
+    uint32_t op1;
+    uint32_t op2;
+    if ((instr & 0xf800) == 0x2800) {
+      op1 = regs[(instr >> 8) & 0x7];
+      op2 = instr & 0xff;
+    } else if ((instr & 0xffc0) == 0x4280) {
+      op1 = regs[instr & 0x7];
+      op2 = regs[(instr >> 3) & 0x7];
+    } else {
+      return false;
+    }
+    uint32_t res = op1 - op2;
+    set_sub(op1, op2, true, res);
+
+    thumb_fetch_next();
+    bus->perf.count_thumb();
+    bus->perf.count_fused(Perf::FUSE_CMP_B);
+    if ((cond_table[(next >> 8) & 0xf] >> sub_nzcv(op1, op2, res)) & 0x1) {
+      thumb_cb_taken(next);
+    }
+    return true;
+  }
+
+  // LDR/LDRB Rd, [Rb, #imm] followed by ADD Rb, #imm
+  if ((instr & 0xe800) == 0x6800 && (next & 0xf800) == 0x3000) {
+    uint8_t rb = (instr >> 3) & 0x7;
+    uint8_t rd = instr & 0x7;
+    if (rd == rb || ((next >> 8) & 0x7) != rb) {
+      return false;
+    }
+
+    thumb_lsio(instr);
+    thumb_fetch_next();
+    bus->perf.count_thumb();
+    bus->perf.count_fused(Perf::FUSE_LDR_ADD);
+    thumb_mcasi(next);
+    return true;
+  }
+
+  return false;
+}
@@ -0,0 +1,139 @@
+#include "gba.h"
+#include "bus.h"
+#include <cstdio>
+#include <new>
+#include <string>
+#include <vector>
+
+struct gba {
+  CPU *cpu; // Owns the bus, which owns the PPU
+  Bus *bus;
+  PPU *ppu;
+
+  // Kept so a reset can rebuild the machine from scratch
+  std::string bios_file;
+  bool hle_bios;
+  std::vector<uint8_t> rom;
+};
+
+// A fresh machine from the stored images. The old one is only replaced once
+// the new one is complete, so a failure leaves the instance as it was.
+static bool rebuild(gba_t *gba) {
+  CPU *cpu = new (std::nothrow) CPU();
+  if (!cpu) {
+    return false;
+  }
+  Bus *bus = new (std::nothrow) Bus(*cpu);
+  if (!bus) {
+    delete cpu;
+    return false;
+  }
+  cpu->set_bus(bus);
+  PPU *ppu = new (std::nothrow) PPU(*bus, true);
+  if (!ppu) {
+    delete cpu;
+    return false;
+  }
+  bus->attach_ppu(ppu);
+
+  cpu->set_hle_bios(gba->hle_bios);
+  if (!gba->bios_file.empty() && !bus->load_bios(gba->bios_file.c_str())) {
+    delete cpu;
+    return false;
+  }
+  bus->load_rom(gba->rom.data(), gba->rom.size());
+  bus->update_wait();
+  cpu->reset();
+
+  delete gba->cpu;
+  gba->cpu = cpu;
+  gba->bus = bus;
+  gba->ppu = ppu;
+  return true;
+}
+
+gba_t *gba_create(void) {
+  gba_t *gba = new (std::nothrow) gba_t{nullptr, nullptr, nullptr, "", true, {}};
+  if (gba && !rebuild(gba)) {
+    delete gba;
+    return nullptr;
+  }
+  return gba;
+}
+
+void gba_destroy(gba_t *gba) {
+  if (gba) {
+    delete gba->cpu;
+    delete gba;
+  }
+}
+
+int gba_load_bios(gba_t *gba, const char *path) {
+  std::string previous = gba->bios_file;
+  gba->bios_file = path;
+  if (!rebuild(gba)) {
+    gba->bios_file = previous;
+    return -1;
+  }
+  return 0;
+}
+
+void gba_set_hle_bios(gba_t *gba, int enable) {
+  gba->hle_bios = enable;
+  gba->cpu->set_hle_bios(enable);
+}
+
+int gba_load_rom(gba_t *gba, const char *path) {
+  FILE *fp = fopen(path, "rb");
+  if (!fp) {
+    return -1;
+  }
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  if (size < 0 || size > CART_0_END - CART_0_START + 1) {
+    fclose(fp);
+    return -1;
+  }
+  std::vector<uint8_t> data(size);
+  bool ok = fread(data.data(), 1, size, fp) == size_t(size);
+  fclose(fp);
+  return ok ? gba_load_rom_memory(gba, data.data(), data.size()) : -1;
+}
+
+int gba_load_rom_memory(gba_t *gba, const void *data, size_t size) {
+  if (size > CART_0_END - CART_0_START + 1) {
+    return -1;
+  }
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  std::vector<uint8_t> rom(bytes, bytes + size);
+  gba->rom.swap(rom);
+  if (!rebuild(gba)) {
+    gba->rom.swap(rom);
+    return -1;
+  }
+  return 0;
+}
+
+int gba_reset(gba_t *gba) { return rebuild(gba) ? 0 : -1; }
+
+int gba_run_frame(gba_t *gba) {
+  gba->cpu->run_frame();
+  return gba->cpu->is_running() ? 0 : -1;
+}
+
+uint64_t gba_run_cycles(gba_t *gba, uint64_t cycles) {
+  return gba->cpu->run_cycles(cycles);
+}
+
+void gba_set_keys(gba_t *gba, uint16_t pressed) {
+  gba->bus->set_keyinput(~pressed & 0x3ff);
+}
+
+const uint32_t *gba_get_framebuffer(gba_t *gba) {
+  return gba->ppu->get_frame();
+}
+
+uint64_t gba_get_frame_count(gba_t *gba) { return gba->bus->perf.frame_count(); }
+
+uint64_t gba_get_cycles(gba_t *gba) { return gba->bus->scheduler.now(); }
@@ -0,0 +1,329 @@
+#include "bus.h"
+#include "cpu.h"
+#include <cstdio>
+#include <string>
+
+/*
+ * A short backward branch whose body only reads memory and recomputes its
+ * registers from scratch every iteration can't exit until memory changes,
+ * and memory only changes at a scheduled event (IRQ handler, DMA, PPU state).
+ * Such loops fast-forward straight to the next event.
+ */
+
+// Pseudo register index for the NZCV flags in the read/write masks
+#define FLAGS (1u << 16)
+
+void CPU::check_idle_loop(uint32_t branch, uint32_t target, bool thumb) {
+  IdleLoop *&cached = idle_cache[(branch >> 1) & (IDLE_CACHE_SIZE - 1)];
+  if (!cached || cached->branch != branch) {
+    auto it = idle_loops.find(branch);
+    if (it == idle_loops.end()) {
+      IdleLoop loop = {branch, target, thumb, false, false, 0, 0};
+      std::string game_code = bus->get_game_code();
+      for (auto &[code, addr] : idle_overrides) {
+        loop.override |= (code == game_code && addr == branch);
+      }
+      loop.idle = loop.override || analyse_idle_loop(branch, target, thumb);
+      it = idle_loops.emplace(branch, loop).first;
+    }
+    cached = &it->second;
+  }
+
+  if (!cached->idle) {
+    return;
+  }
+  // The loads were only checked against the registers at first sight; a
+  // shared polling helper may be called with a timer address next time, and
+  // code in RAM may have been replaced since. Loops are at most
+  // IDLE_LOOP_MAX instructions, so checking again is cheap next to the skip.
+  if (!cached->override && !analyse_idle_loop(branch, target, thumb)) {
+    return;
+  }
+
+  uint64_t skip = bus->scheduler.next() - bus->scheduler.now();
+  cached->hits++;
+  cached->skipped += skip;
+  cycle(skip);
+}
+
+bool CPU::analyse_idle_loop(uint32_t branch, uint32_t target, bool thumb) {
+  uint32_t size = thumb ? 2 : 4;
+  uint32_t count = (branch - target) / size;
+  if (target > branch || count >= IDLE_LOOP_MAX) {
+    return false;
+  }
+
+  uint32_t reads[IDLE_LOOP_MAX];
+  uint32_t writes[IDLE_LOOP_MAX];
+  uint32_t written = 0;
+
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t addr = target + i * size;
+    reads[i] = writes[i] = 0;
+    bool ok = thumb ? thumb_idle_access(
+                          addr, bus->read16(addr, CYCLE_TYPE::FAST), reads[i],
+                          writes[i])
+                    : arm_idle_access(addr, bus->read32(addr, CYCLE_TYPE::FAST),
+                                      reads[i], writes[i]);
+    if (!ok) {
+      return false;
+    }
+    written |= writes[i];
+  }
+
+  // Anything read before this iteration wrote it carries state from the
+  // previous iteration (a counter, a timeout), so the loop makes progress
+  uint32_t defined = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    if (reads[i] & written & ~defined) {
+      return false;
+    }
+    defined |= writes[i];
+  }
+
+  // The closing branch only reads the flags
+  uint32_t branch_reads = 0;
+  if (!thumb) {
+    if ((bus->read32(branch, CYCLE_TYPE::FAST) >> 28) != AL) {
+      branch_reads = FLAGS;
+    }
+  } else if ((bus->read16(branch, CYCLE_TYPE::FAST) & 0xF000) == 0xD000) {
+    branch_reads = FLAGS;
+  }
+  return !(branch_reads & written & ~defined);
+}
+
+bool CPU::idle_load_safe(uint32_t addr) {
+  // Timer counters and serial registers change without an event
+  if (addr >= 0x04000100 && addr < 0x04000110) {
+    return false;
+  }
+  if (addr >= 0x04000120 && addr < 0x04000160) {
+    return false;
+  }
+  return addr < 0x10000000;
+}
+
+bool CPU::arm_idle_access(uint32_t addr, uint32_t instr, uint32_t &reads,
+                          uint32_t &writes) {
+  uint8_t rn = (instr >> 16) & 0xf;
+  uint8_t rd = (instr >> 12) & 0xf;
+  uint8_t rm = instr & 0xf;
+
+  if ((instr >> 28) != AL) {
+    // Conditional writes may leave the old value in place
+    reads |= FLAGS | (1 << rd);
+  }
+
+  if (arm_is_bx(instr) || arm_is_bdt(instr) || arm_is_bl(instr) ||
+      arm_is_swi(instr) || arm_is_und(instr)) {
+    return false;
+  }
+
+  if (arm_is_sdt(instr)) {
+    bool i = (instr >> 25) & 0x1;
+    bool p = (instr >> 24) & 0x1;
+    bool u = (instr >> 23) & 0x1;
+    bool w = (instr >> 21) & 0x1;
+    bool l = (instr >> 20) & 0x1;
+    if (!l || !p || w || rd == 15 || (i && rm == 15)) {
+      return false;
+    }
+    uint32_t offset = i ? get_reg(rm) : (instr & 0xfff);
+    if (i) {
+      barrel_shift(offset, static_cast<SHIFT>((instr >> 5) & 0x3),
+                   (instr >> 7) & 0x1f, false);
+      reads |= 1 << rm;
+    }
+    // PC relative loads are literal pool reads, r15 itself isn't tracked
+    uint32_t base = (rn == 15) ? addr + 8 : get_reg(rn);
+    if (!idle_load_safe(u ? base + offset : base - offset)) {
+      return false;
+    }
+    if (rn != 15) {
+      reads |= 1 << rn;
+    }
+    writes |= 1 << rd;
+    return true;
+  }
+
+  if (arm_is_sds(instr) || arm_is_mul(instr)) {
+    return false;
+  }
+
+  if (arm_is_hdtri(instr)) {
+    bool p = (instr >> 24) & 0x1;
+    bool u = (instr >> 23) & 0x1;
+    bool i = (instr >> 22) & 0x1;
+    bool w = (instr >> 21) & 0x1;
+    bool l = (instr >> 20) & 0x1;
+    if (!l || !p || w || rd == 15 || rn == 15) {
+      return false;
+    }
+    uint32_t offset = i ? (((instr >> 4) & 0xf0) | rm) : get_reg(rm);
+    if (!i) {
+      reads |= 1 << rm;
+    }
+    uint32_t base = get_reg(rn);
+    if (!idle_load_safe(u ? base + offset : base - offset)) {
+      return false;
+    }
+    reads |= 1 << rn;
+    writes |= 1 << rd;
+    return true;
+  }
+
+  if (arm_is_psrt(instr)) {
+    return false;
+  }
+
+  if (arm_is_dproc(instr)) {
+    bool i = (instr >> 25) & 0x1;
+    uint8_t opcode = (instr >> 21) & 0xf;
+    bool s = (instr >> 20) & 0x1;
+    bool test = opcode >= TST && opcode <= CMN;
+    if (!test && rd == 15) {
+      return false;
+    }
+    if (opcode != MOV && opcode != MVN) {
+      reads |= 1 << rn;
+    }
+    if (!i) {
+      reads |= 1 << rm;
+      if ((instr >> 4) & 0x1) {
+        reads |= 1 << ((instr >> 8) & 0xf);
+      } else if (((instr >> 5) & 0x3) == ROR && ((instr >> 7) & 0x1f) == 0) {
+        reads |= FLAGS; // RRX
+      }
+    }
+    if (opcode == ADC || opcode == SBC || opcode == RSC) {
+      reads |= FLAGS;
+    }
+    if (!test) {
+      writes |= 1 << rd;
+    }
+    if (s || test) {
+      writes |= FLAGS;
+    }
+    return (reads & (1 << 15)) == 0;
+  }
+
+  return false;
+}
+
+bool CPU::thumb_idle_access(uint32_t addr, uint16_t instr, uint32_t &reads,
+                            uint32_t &writes) {
+  if ((instr & 0xF800) == 0x1800) { // as
+    uint8_t opcode = (instr >> 9) & 0x3;
+    reads |= 1 << ((instr >> 3) & 0x7);
+    if (opcode < 2) {
+      reads |= 1 << ((instr >> 6) & 0x7);
+    }
+    writes |= (1 << (instr & 0x7)) | FLAGS;
+    return true;
+  }
+
+  if ((instr & 0xE000) == 0x0000) { // msr
+    reads |= 1 << ((instr >> 3) & 0x7);
+    writes |= (1 << (instr & 0x7)) | FLAGS;
+    return true;
+  }
+
+  if ((instr & 0xE000) == 0x2000) { // mcasi
+    uint8_t opcode = (instr >> 11) & 0x3;
+    uint8_t rd = (instr >> 8) & 0x7;
+    if (opcode != 0) {
+      reads |= 1 << rd;
+    }
+    if (opcode != 1) {
+      writes |= 1 << rd;
+    }
+    writes |= FLAGS;
+    return true;
+  }
+
+  if ((instr & 0xFC00) == 0x4000) { // alu
+    uint8_t opcode = (instr >> 6) & 0xf;
+    uint8_t rd = instr & 0x7;
+    reads |= (1 << rd) | (1 << ((instr >> 3) & 0x7));
+    if (opcode == 0x5 || opcode == 0x6) { // ADC, SBC
+      reads |= FLAGS;
+    }
+    if (opcode != 0x8 && opcode != 0xA && opcode != 0xB) { // TST, CMP, CMN
+      writes |= 1 << rd;
+    }
+    writes |= FLAGS;
+    return true;
+  }
+
+  if ((instr & 0xFC00) == 0x4400) { // hrobx
+    uint8_t opcode = (instr >> 8) & 0x3;
+    uint8_t rs = (instr >> 3) & 0xf;
+    uint8_t rd = ((instr >> 4) & 0x8) | (instr & 0x7);
+    if (opcode == 0x3 || rd == 15 || rs == 15) {
+      return false;
+    }
+    reads |= 1 << rs;
+    if (opcode != 0x2) {
+      reads |= 1 << rd;
+    }
+    if (opcode == 0x1) {
+      writes |= FLAGS;
+    } else {
+      writes |= 1 << rd;
+    }
+    return true;
+  }
+
+  if ((instr & 0xF800) == 0x4800) { // pcrl, literal pool in ROM/RAM
+    writes |= 1 << ((instr >> 8) & 0x7);
+    return idle_load_safe(((addr + 4) & ~2) + ((instr & 0xff) << 2));
+  }
+
+  if ((instr & 0xE000) == 0x6000) { // lsio
+    uint8_t opcode = (instr >> 11) & 0x3;
+    uint8_t offset = (instr >> 6) & 0x1f;
+    uint8_t rb = (instr >> 3) & 0x7;
+    if (opcode != 1 && opcode != 3) {
+      return false;
+    }
+    reads |= 1 << rb;
+    writes |= 1 << (instr & 0x7);
+    return idle_load_safe(get_reg(rb) + (opcode == 1 ? offset << 2 : offset));
+  }
+
+  return false;
+}
+
+bool CPU::load_idle_overrides(const char *path) {
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    return false;
+  }
+
+  char line[128];
+  while (fgets(line, sizeof(line), fp)) {
+    char code[5];
+    uint32_t addr;
+    if (line[0] == '#' || sscanf(line, "%4s %x", code, &addr) != 2) {
+      continue;
+    }
+    idle_overrides.emplace_back(code, addr);
+  }
+
+  fclose(fp);
+  return true;
+}
+
+void CPU::dump_idle_loops() {
+  for (auto &[branch, loop] : idle_loops) {
+    if (!loop.idle) {
+      continue;
+    }
+    printf("idle loop %08x -> %08x (%s%s): %llu hits, %llu cycles skipped\n",
+           loop.branch, loop.target, loop.thumb ? "thumb" : "arm",
+           loop.override ? ", override" : "",
+           static_cast<unsigned long long>(loop.hits),
+           static_cast<unsigned long long>(loop.skipped));
+  }
+}
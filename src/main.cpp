@@ -1,13 +1,58 @@
 #include "bus.h"
+#include "profiler.h"
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 
 #define SCREEN_HEIGHT 160
 #define SCREEN_WIDTH 240
 
 int main(int argc, char *argv[]) {
 
-  if (argc <= 1) {
-    fprintf(stderr, "Usage: %s <rom_file>\n", argv[0]);
+  const char *rom_file = nullptr;
+  const char *bios_file = "../bios.bin"; // Optional, see Bus::load_hle_bios()
+  bool hle_bios = true;
+  bool overlay = false;
+  const char *profile_file = nullptr;
+  const char *symbols_file = nullptr;
+  uint32_t profile_interval = 16384; // ~1 kHz of emulated time
+  const char *record_file = nullptr;
+  const char *replay_file = nullptr;
+  const char *trace_file = nullptr;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--overlay")) {
+      overlay = true;
+    } else if (!strcmp(argv[i], "--bios") && i + 1 < argc) {
+      bios_file = argv[++i];
+    } else if (!strcmp(argv[i], "--no-hle")) {
+      hle_bios = false;
+    } else if (!strcmp(argv[i], "--profile") && i + 1 < argc) {
+      profile_file = argv[++i];
+    } else if (!strcmp(argv[i], "--profile-interval") && i + 1 < argc) {
+      profile_interval = std::max(1, atoi(argv[++i]));
+    } else if (!strcmp(argv[i], "--symbols") && i + 1 < argc) {
+      symbols_file = argv[++i];
+    } else if (!strcmp(argv[i], "--record") && i + 1 < argc) {
+      record_file = argv[++i];
+    } else if (!strcmp(argv[i], "--replay") && i + 1 < argc) {
+      replay_file = argv[++i];
+    } else if (!strcmp(argv[i], "--trace") && i + 1 < argc) {
+      trace_file = argv[++i];
+    } else {
+      rom_file = argv[i];
+    }
+  }
+
+  if (!rom_file) {
+    fprintf(stderr,
+            "Usage: %s [--overlay] [--bios <file>] [--no-hle] "
+            "[--profile <out.folded>] [--profile-interval <cycles>] "
+            "[--symbols <elf|map>] [--record <movie> | --replay <movie>] "
+            "[--trace <out.gbt>] <rom_file>\n",
+            argv[0]);
     return 1;
   }
 
@@ -15,15 +60,81 @@ int main(int argc, char *argv[]) {
 
   Bus *bus = new Bus(*cpu);
 
-  PPU *ppu = new PPU(*bus);
+  // Replays run headless and uncapped
+  PPU *ppu = new PPU(*bus, replay_file != nullptr);
 
   bus->attach_ppu(ppu);
 
+  // Toggled with F1 at run time
+  ppu->set_overlay(overlay);
+
   cpu->set_bus(bus);
+  cpu->set_hle_bios(hle_bios);
 
   // ppu->sdl_init();
 
-  cpu->start(argv[1], "../bios.bin");
+  cpu->load_idle_overrides("../idle_loops.txt");
+
+  Profiler *profiler = nullptr;
+  if (profile_file) {
+    profiler = cpu->enable_profiler(profile_interval, 1 << 20);
+    if (symbols_file && !profiler->load_symbols(symbols_file)) {
+      fprintf(stderr, "No symbols loaded from %s\n", symbols_file);
+    }
+  }
+
+  cpu->load(rom_file, bios_file);
+
+  int status = 0;
+  Movie movie(*cpu, *bus);
+  if (replay_file) {
+    if (!movie.load(replay_file)) {
+      delete cpu;
+      return 1;
+    }
+    // The start state comes from the movie
+    cpu->set_hle_bios(movie.get_hle_bios());
+    bus->attach_movie(&movie);
+    movie.replay();
+
+    auto start_time = std::chrono::steady_clock::now();
+    uint64_t executed = 0;
+    while (cpu->is_running()) {
+      executed += cpu->run_cycles(1 << 24);
+    }
+    double elapsed = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start_time)
+                         .count();
+
+    printf("%u/%u frames, %llu instructions in %.3f s (%.1f frames/s, "
+           "%.2f MIPS)\n",
+           movie.get_frame(), movie.get_frames(),
+           static_cast<unsigned long long>(executed), elapsed,
+           movie.get_frame() / elapsed, executed / elapsed / 1e6);
+    // Stopped early by an unimplemented instruction
+    if (movie.get_frame() != movie.get_frames()) {
+      status = 1;
+    }
+  } else {
+    if (record_file) {
+      movie.record(hle_bios);
+      bus->attach_movie(&movie);
+    }
+    cpu->run(trace_file);
+    if (record_file && !movie.save(record_file)) {
+      fprintf(stderr, "Failed to write %s\n", record_file);
+    }
+  }
+  bus->attach_movie(nullptr);
+
+  if (profiler) {
+    if (!profiler->write_collapsed(profile_file)) {
+      fprintf(stderr, "Failed to write %s\n", profile_file);
+    }
+    fprintf(stderr, "%zu samples, %llu dropped\n",
+            profiler->get_samples().size(),
+            static_cast<unsigned long long>(profiler->get_dropped()));
+  }
 
   // while (running) {
   //   SDL_Event event;
@@ -39,5 +150,5 @@ int main(int argc, char *argv[]) {
   // ppu->sdl_quit();
   delete cpu;
 
-  return 0;
+  return status;
 }
@@ -0,0 +1,164 @@
+#include "movie.h"
+#include "bus.h"
+#include "hash.h"
+#include <cstdio>
+#include <cstring>
+
+Movie::Movie(CPU &cpu, Bus &bus)
+    : cpu(cpu), bus(bus), recording(false), flags(0), rom_crc(0),
+      rom_size(0), bios_crc(0), game_code{}, frames(0), start_keys(0x3ff),
+      next(0), frame(0), pending(0x3ff) {}
+
+void Movie::read_start_state() {
+  rom_size = bus.get_rom_size();
+  rom_crc = crc32(bus.get_rom(), rom_size);
+  bios_crc = crc32(bus.get_bios(), BIOS_END - BIOS_START + 1);
+  memcpy(game_code, bus.get_game_code().data(), 4);
+}
+
+void Movie::record(bool hle_bios) {
+  recording = true;
+  flags = hle_bios ? MOVIE_HLE_BIOS : 0;
+  read_start_state();
+  start_keys = pending = bus.get_keyinput();
+  changes.clear();
+  frames = frame = 0;
+}
+
+static void put16(std::vector<uint8_t> &out, uint16_t value) {
+  out.push_back(value);
+  out.push_back(value >> 8);
+}
+
+static void put32(std::vector<uint8_t> &out, uint32_t value) {
+  put16(out, value);
+  put16(out, value >> 16);
+}
+
+static uint16_t get16(const uint8_t *p) { return p[0] | p[1] << 8; }
+
+static uint32_t get32(const uint8_t *p) { return get16(p) | get16(p + 2) << 16; }
+
+bool Movie::save(const char *path) {
+  std::vector<uint8_t> out(MOVIE_MAGIC, MOVIE_MAGIC + 4);
+  put16(out, MOVIE_VERSION);
+  put16(out, flags);
+  put32(out, rom_crc);
+  put32(out, rom_size);
+  put32(out, bios_crc);
+  out.insert(out.end(), game_code, game_code + 4);
+  put32(out, frame);
+  put16(out, start_keys);
+  put16(out, 0);
+
+  uint32_t last = 0;
+  for (const Change &change : changes) {
+    uint32_t delta = change.frame - last;
+    last = change.frame;
+    do {
+      out.push_back((delta & 0x7f) | (delta > 0x7f ? 0x80 : 0));
+      delta >>= 7;
+    } while (delta);
+    put16(out, change.keys);
+  }
+
+  FILE *fp = fopen(path, "wb");
+  if (!fp) {
+    return false;
+  }
+  bool ok = fwrite(out.data(), 1, out.size(), fp) == out.size();
+  return !fclose(fp) && ok;
+}
+
+bool Movie::load(const char *path) {
+  FILE *fp = fopen(path, "rb");
+  if (!fp) {
+    fprintf(stderr, "%s: can't open\n", path);
+    return false;
+  }
+  std::vector<uint8_t> in;
+  uint8_t buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), fp))) {
+    in.insert(in.end(), buf, buf + n);
+  }
+  fclose(fp);
+
+  if (in.size() < MOVIE_HEADER_SIZE || memcmp(in.data(), MOVIE_MAGIC, 4)) {
+    fprintf(stderr, "%s: not a movie\n", path);
+    return false;
+  }
+  if (get16(&in[4]) != MOVIE_VERSION) {
+    fprintf(stderr, "%s: version %u, expected %u\n", path, get16(&in[4]),
+            MOVIE_VERSION);
+    return false;
+  }
+
+  recording = false;
+  read_start_state();
+  if (get32(&in[8]) != rom_crc || get32(&in[12]) != rom_size) {
+    fprintf(stderr, "%s: recorded with another ROM (%.4s, CRC %08x)\n", path,
+            reinterpret_cast<const char *>(&in[20]), get32(&in[8]));
+    return false;
+  }
+  if (get32(&in[16]) != bios_crc) {
+    fprintf(stderr, "%s: recorded with another BIOS image (CRC %08x)\n", path,
+            get32(&in[16]));
+    return false;
+  }
+  flags = get16(&in[6]);
+  frames = get32(&in[24]);
+  start_keys = get16(&in[28]);
+
+  changes.clear();
+  uint32_t last = 0;
+  for (size_t i = MOVIE_HEADER_SIZE; i < in.size();) {
+    uint32_t delta = 0;
+    for (int shift = 0;; shift += 7) {
+      if (i == in.size() || shift > 28) {
+        fprintf(stderr, "%s: truncated\n", path);
+        return false;
+      }
+      uint8_t byte = in[i++];
+      delta |= (byte & 0x7f) << shift;
+      if (!(byte & 0x80)) {
+        break;
+      }
+    }
+    if (in.size() - i < 2) {
+      fprintf(stderr, "%s: truncated\n", path);
+      return false;
+    }
+    last += delta;
+    changes.push_back({last, get16(&in[i])});
+    i += 2;
+  }
+  return true;
+}
+
+void Movie::replay() {
+  next = 0;
+  frame = 0;
+  bus.set_keyinput(start_keys);
+  if (!frames) {
+    cpu.stop();
+  }
+}
+
+void Movie::next_frame() {
+  frame++;
+  if (recording) {
+    if (pending != bus.get_keyinput()) {
+      changes.push_back({frame, pending});
+      bus.set_keyinput(pending);
+    }
+    return;
+  }
+
+  while (next < changes.size() && changes[next].frame == frame) {
+    bus.set_keyinput(changes[next++].keys);
+  }
+  if (frame == frames) {
+    cpu.stop();
+  }
+}
@@ -0,0 +1,111 @@
+#include "perf.h"
+#include <chrono>
+#include <cstring>
+
+static const char *region_names[16] = {
+    "bios", nullptr, "ewram", "iwram", "mmio", "palram", "vram", "oam",
+    "rom0", "rom0",  "rom1",  "rom1",  "rom2", "rom2",   "sram", "sram",
+};
+
+Perf::Perf() {
+  memset(&current, 0, sizeof(current));
+  memset(&last, 0, sizeof(last));
+  memset(&interval, 0, sizeof(interval));
+  frames = interval_frames = 0;
+  frame_cycles = 0;
+  frame_ns = interval_ns = host_now();
+}
+
+uint64_t Perf::host_now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void Perf::end_frame(uint64_t now) {
+  uint64_t ns = host_now();
+
+  current.cycles = now - frame_cycles;
+  uint64_t other = current.ppu_ns + current.frontend_ns + current.sleep_ns;
+  uint64_t elapsed = ns - frame_ns;
+  current.cpu_ns = (elapsed > other) ? elapsed - other : 0;
+
+  last = current;
+
+  // Every field is a counter, so the interval is a plain element-wise sum
+  uint64_t *dst = reinterpret_cast<uint64_t *>(&interval);
+  const uint64_t *src = reinterpret_cast<const uint64_t *>(&current);
+  for (size_t i = 0; i < sizeof(Frame) / sizeof(uint64_t); i++) {
+    dst[i] += src[i];
+  }
+
+  memset(&current, 0, sizeof(current));
+  frames++;
+  interval_frames++;
+  frame_cycles = now;
+  frame_ns = ns;
+}
+
+Perf::Frame Perf::take_interval(uint64_t &frames, uint64_t &host_ns) {
+  uint64_t ns = host_now();
+  Frame sum = interval;
+  frames = interval_frames;
+  host_ns = ns - interval_ns;
+
+  memset(&interval, 0, sizeof(interval));
+  interval_frames = 0;
+  interval_ns = ns;
+  return sum;
+}
+
+void Perf::print(FILE *fp, const Frame &sum, uint64_t frames,
+                 uint64_t host_ns) {
+  if (!frames || !host_ns) {
+    fprintf(fp, "perf: no complete frame\n");
+    return;
+  }
+
+  double seconds = host_ns / 1e9;
+  uint64_t instrs = sum.arm_instrs + sum.thumb_instrs;
+  double thumb = instrs ? 100.0 * sum.thumb_instrs / instrs : 0;
+
+  fprintf(fp,
+          "perf: %llu frames, %.1f fps, %.2f MIPS (%.0f%% Thumb), "
+          "%llu cycles/frame\n",
+          static_cast<unsigned long long>(frames), frames / seconds,
+          instrs / seconds / 1e6, thumb,
+          static_cast<unsigned long long>(sum.cycles / frames));
+  fprintf(fp, "  ms/frame: cpu %.2f, ppu %.2f, frontend %.2f, sleep %.2f\n",
+          sum.cpu_ns / 1e6 / frames, sum.ppu_ns / 1e6 / frames,
+          sum.frontend_ns / 1e6 / frames, sum.sleep_ns / 1e6 / frames);
+
+  uint64_t fused = 0;
+  for (int f = 0; f < FUSION_COUNT; f++) {
+    fused += sum.fused[f];
+  }
+  if (fused) {
+    fprintf(fp, "  fused/frame: bl %llu, cmp+b %llu, ldr+add %llu\n",
+            static_cast<unsigned long long>(sum.fused[FUSE_BL] / frames),
+            static_cast<unsigned long long>(sum.fused[FUSE_CMP_B] / frames),
+            static_cast<unsigned long long>(sum.fused[FUSE_LDR_ADD] / frames));
+  }
+
+  // Accesses per frame, 8/16/32-bit
+  for (int r = 0; r < 16; r++) {
+    uint64_t total = 0;
+    for (int w = BYTE; w <= WORD; w++) {
+      total += sum.reads[r][w] + sum.writes[r][w];
+    }
+    if (!total) {
+      continue;
+    }
+    fprintf(fp, "  %-6s read %llu/%llu/%llu, write %llu/%llu/%llu\n",
+            region_names[r] ? region_names[r] : "-",
+            static_cast<unsigned long long>(sum.reads[r][BYTE] / frames),
+            static_cast<unsigned long long>(sum.reads[r][HALF] / frames),
+            static_cast<unsigned long long>(sum.reads[r][WORD] / frames),
+            static_cast<unsigned long long>(sum.writes[r][BYTE] / frames),
+            static_cast<unsigned long long>(sum.writes[r][HALF] / frames),
+            static_cast<unsigned long long>(sum.writes[r][WORD] / frames));
+  }
+}
@@ -1,16 +1,41 @@
 #include "ppu.h"
 #include "bus.h"
+#include "hash.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
 
-PPU::PPU(Bus &bus) : bus(bus) {
-  frame = new uint32_t[SCREEN_WIDTH * SCREEN_HEIGHT];
+static inline uint64_t host_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+PPU::PPU(Bus &bus, bool headless)
+    : bus(bus), headless(headless), overlay(false) {
+  frame = new uint32_t[SCREEN_WIDTH * SCREEN_HEIGHT]();
+  screen = headless ? nullptr : new uint32_t[SCREEN_WIDTH * SCREEN_HEIGHT];
   pitch = 240 * sizeof(uint32_t);
   dots = 0;
-  sdl_init();
+  window = nullptr;
+  renderer = nullptr;
+  texture = nullptr;
+  if (!headless) {
+    sdl_init();
+  }
+
+  bus.scheduler.set_handler(Scheduler::PPU_HBLANK, &PPU::on_hblank, this);
+  bus.scheduler.set_handler(Scheduler::PPU_HDRAW, &PPU::on_hdraw, this);
+  bus.scheduler.schedule(Scheduler::PPU_HBLANK, HDRAW_CYCLES);
 }
 
 PPU::~PPU() {
   delete[] frame;
-  sdl_quit();
+  delete[] screen;
+  if (!headless) {
+    sdl_quit();
+  }
 }
 
 bool PPU::sdl_init() {
@@ -55,28 +80,197 @@ void PPU::sdl_quit() {
   SDL_Quit();
 }
 
-void PPU::tick(uint32_t cycles) {
-  // dots += cycles;
-  // if (dots >= 1232) {
-  //   dots -= 1232;
-  if (lcd.vcount.bits.scanline < SCREEN_HEIGHT) {
-    render_scanline(lcd.vcount.bits.scanline);
+void PPU::hblank(uint64_t late) {
+  uint8_t y = lcd.vcount.bits.scanline;
+
+  lcd.dispstat.bits.hblank = 1;
+  if (lcd.dispstat.bits.hblankIRQ) {
+    bus.request_irq(Bus::IRQ_HBLANK);
   }
 
+  if (y < SCREEN_HEIGHT) {
+    uint64_t start = host_ns();
+    render_scanline(y);
+    bus.perf.add_ppu_ns(host_ns() - start);
+    bus.trigger_dma(DMA::HBLANK);
+  }
+
+  bus.scheduler.schedule(Scheduler::PPU_HDRAW, HBLANK_CYCLES - late);
+}
+
+void PPU::hdraw(uint64_t late) {
+  lcd.dispstat.bits.hblank = 0;
   lcd.vcount.bits.scanline++;
 
-  if (lcd.vcount.bits.scanline == SCREEN_HEIGHT) {
+  uint8_t y = lcd.vcount.bits.scanline;
+
+  if (y == SCREEN_HEIGHT) {
+    // New keys are visible to the VBlank handler
+    if (Movie *movie = bus.get_movie()) {
+      movie->next_frame();
+    }
     lcd.dispstat.bits.vblank = 1;
-    SDL_UpdateTexture(texture, NULL, frame, pitch);
-    SDL_RenderCopy(renderer, texture, NULL, NULL);
-    SDL_RenderPresent(renderer);
+    if (lcd.dispstat.bits.vblankIRQ) {
+      bus.request_irq(Bus::IRQ_VBLANK);
+    }
+    bus.trigger_dma(DMA::VBLANK);
+    uint64_t start = host_ns();
+    present();
+    bus.perf.add_frontend_ns(host_ns() - start);
+    bus.perf.end_frame(bus.scheduler.now());
+  } else if (y == 227) {
+    // The flag is already cleared in the last line
+    lcd.dispstat.bits.vblank = 0;
+  } else if (y == 228) {
+    lcd.vcount.bits.scanline = y = 0;
   }
 
-  if (lcd.vcount.bits.scanline == 228) {
-    lcd.dispstat.bits.vblank = 0;
-    lcd.vcount.bits.scanline = 0;
+  lcd.dispstat.bits.vcounter = (y == lcd.dispstat.bits.vcountSetting);
+  if (lcd.dispstat.bits.vcounter && lcd.dispstat.bits.vcounterIRQ) {
+    bus.request_irq(Bus::IRQ_VCOUNTER);
+  }
+
+  bus.scheduler.schedule(Scheduler::PPU_HBLANK, HDRAW_CYCLES - late);
+}
+
+void PPU::present() {
+  if (headless) {
+    return;
+  }
+  const uint32_t *pixels = frame;
+  if (overlay) {
+    // Drawn over a copy, `frame` stays emulator output for hashes and PNGs
+    std::copy(frame, frame + SCREEN_WIDTH * SCREEN_HEIGHT, screen);
+    draw_overlay(screen);
+    pixels = screen;
+  }
+  SDL_UpdateTexture(texture, NULL, pixels, pitch);
+  SDL_RenderCopy(renderer, texture, NULL, NULL);
+  SDL_RenderPresent(renderer);
+}
+
+uint64_t PPU::hash_frame() {
+  return hash64(frame, SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(uint32_t));
+}
+
+static void put_be32(std::vector<uint8_t> &out, uint32_t value) {
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    out.push_back(value >> shift);
   }
-  // }
+}
+
+static void put_chunk(std::vector<uint8_t> &out, const char *type,
+                      const std::vector<uint8_t> &data) {
+  put_be32(out, data.size());
+  size_t start = out.size();
+  out.insert(out.end(), type, type + 4);
+  out.insert(out.end(), data.begin(), data.end());
+  put_be32(out, crc32(&out[start], out.size() - start));
+}
+
+bool PPU::save_png(const char *path) {
+  // Filter type 0, then RGB for every row
+  std::vector<uint8_t> raw;
+  raw.reserve(SCREEN_HEIGHT * (1 + SCREEN_WIDTH * 3));
+  for (uint32_t y = 0; y < SCREEN_HEIGHT; y++) {
+    raw.push_back(0);
+    for (uint32_t x = 0; x < SCREEN_WIDTH; x++) {
+      uint32_t pixel = frame[y * SCREEN_WIDTH + x];
+      raw.push_back(pixel >> 16);
+      raw.push_back(pixel >> 8);
+      raw.push_back(pixel);
+    }
+  }
+
+  // zlib stream of stored deflate blocks, at most 65535 bytes each
+  std::vector<uint8_t> idat = {0x78, 0x01};
+  for (size_t pos = 0; pos < raw.size();) {
+    size_t len = std::min<size_t>(raw.size() - pos, 0xffff);
+    idat.push_back(pos + len == raw.size()); // BFINAL, BTYPE 00
+    idat.push_back(len);
+    idat.push_back(len >> 8);
+    idat.push_back(~len);
+    idat.push_back(~len >> 8);
+    idat.insert(idat.end(), raw.begin() + pos, raw.begin() + pos + len);
+    pos += len;
+  }
+  uint32_t a = 1, b = 0;
+  for (uint8_t byte : raw) {
+    a = (a + byte) % 65521;
+    b = (b + a) % 65521;
+  }
+  put_be32(idat, b << 16 | a);
+
+  std::vector<uint8_t> ihdr;
+  put_be32(ihdr, SCREEN_WIDTH);
+  put_be32(ihdr, SCREEN_HEIGHT);
+  ihdr.insert(ihdr.end(), {8, 2, 0, 0, 0}); // 8-bit RGB, no interlace
+
+  std::vector<uint8_t> png = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+  put_chunk(png, "IHDR", ihdr);
+  put_chunk(png, "IDAT", idat);
+  put_chunk(png, "IEND", {});
+
+  FILE *fp = fopen(path, "wb");
+  if (!fp) {
+    return false;
+  }
+  bool ok = fwrite(png.data(), 1, png.size(), fp) == png.size();
+  return !fclose(fp) && ok;
+}
+
+// 3x5 glyphs, three bits per row from the top, MSB is the leftmost pixel
+static const struct {
+  char c;
+  uint16_t rows;
+} font[] = {
+    {'0', 0b111'101'101'101'111}, {'1', 0b010'110'010'010'111},
+    {'2', 0b111'001'111'100'111}, {'3', 0b111'001'111'001'111},
+    {'4', 0b101'101'111'001'001}, {'5', 0b111'100'111'001'111},
+    {'6', 0b111'100'111'101'111}, {'7', 0b111'001'001'001'001},
+    {'8', 0b111'101'111'101'111}, {'9', 0b111'101'111'001'111},
+    {'.', 0b000'000'000'000'010}, {'%', 0b101'001'010'100'101},
+    {'F', 0b111'100'110'100'100}, {'I', 0b111'010'010'010'111},
+    {'M', 0b101'111'111'101'101}, {'P', 0b110'101'110'100'100},
+    {'S', 0b011'100'010'001'110}, {'T', 0b111'010'010'010'010},
+};
+
+void PPU::draw_text(uint32_t *out, uint32_t x, uint32_t y,
+                    const char *text) {
+  for (; *text && x + 4 <= SCREEN_WIDTH; text++, x += 4) {
+    uint16_t rows = 0;
+    for (const auto &glyph : font) {
+      if (glyph.c == *text) {
+        rows = glyph.rows;
+        break;
+      }
+    }
+    // Black cell with a one pixel margin so the text stays readable
+    for (uint32_t dy = 0; dy < 7; dy++) {
+      for (uint32_t dx = 0; dx < 4; dx++) {
+        bool on = dy >= 1 && dy <= 5 && dx < 3 &&
+                  (rows >> ((5 - dy) * 3 + (2 - dx)) & 1);
+        out[(y + dy) * SCREEN_WIDTH + x + dx] = on ? 0xffffffff : 0xff000000;
+      }
+    }
+  }
+}
+
+void PPU::draw_overlay(uint32_t *out) {
+  const Perf::Frame &last = bus.perf.last_frame();
+  uint64_t ns = last.cpu_ns + last.ppu_ns + last.frontend_ns;
+  if (!ns) {
+    return;
+  }
+
+  // Unthrottled speed, so it also shows the headroom when running at 60 fps
+  uint64_t instrs = last.arm_instrs + last.thumb_instrs;
+  char text[48];
+  snprintf(text, sizeof(text), "%.1f FPS %.2f MIPS %llu%% T", 1e9 / ns,
+           instrs * 1e3 / ns,
+           static_cast<unsigned long long>(
+               instrs ? last.thumb_instrs * 100 / instrs : 0));
+  draw_text(out, 1, 1, text);
 }
 
 void PPU::render_scanline(uint32_t y) {
@@ -0,0 +1,233 @@
+#include "profiler.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+
+Profiler::Profiler(Scheduler &scheduler, uint32_t interval, size_t capacity)
+    : scheduler(scheduler), interval(interval), due(false), depth(0),
+      dropped(0) {
+  samples.reserve(capacity);
+
+  scheduler.set_handler(Scheduler::PROFILER_SAMPLE, &Profiler::on_sample,
+                        this);
+  scheduler.schedule(Scheduler::PROFILER_SAMPLE, interval);
+}
+
+Profiler::~Profiler() { scheduler.cancel(Scheduler::PROFILER_SAMPLE); }
+
+void Profiler::tick(uint64_t late) {
+  due = true;
+  scheduler.schedule(Scheduler::PROFILER_SAMPLE,
+                     (late < interval) ? interval - late : 1);
+}
+
+void Profiler::call(uint32_t target, uint32_t ret) {
+  if (depth == MAX_DEPTH) {
+    memmove(frames, frames + 1, (MAX_DEPTH - 1) * sizeof(Frame));
+    depth--;
+  }
+  frames[depth++] = {target & ~1u, ret & ~1u};
+}
+
+void Profiler::sample(uint32_t pc, uint32_t lr, uint32_t cpsr, bool halted) {
+  due = false;
+  if (samples.size() == samples.capacity()) {
+    dropped++;
+    return;
+  }
+
+  Sample s;
+  s.pc = pc;
+  s.lr = lr;
+  s.cpsr = cpsr;
+  s.halted = halted;
+  s.depth = depth;
+  for (uint8_t i = 0; i < depth; i++) {
+    s.stack[i] = frames[i].target;
+  }
+  samples.push_back(s);
+}
+
+bool Profiler::load_symbols(const char *path) {
+  FILE *fp = fopen(path, "rb");
+  if (!fp) {
+    return false;
+  }
+  std::vector<uint8_t> file;
+  uint8_t buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+    file.insert(file.end(), buf, buf + n);
+  }
+  fclose(fp);
+
+  symbols.clear();
+  bool elf = file.size() >= 4 && !memcmp(file.data(), "\177ELF", 4);
+  bool ok = elf ? load_elf(file) : load_map(file);
+
+  std::sort(symbols.begin(), symbols.end(),
+            [](const Symbol &a, const Symbol &b) { return a.addr < b.addr; });
+  return ok && !symbols.empty();
+}
+
+static inline uint32_t le32(const std::vector<uint8_t> &f, size_t off) {
+  return f[off] | f[off + 1] << 8 | f[off + 2] << 16 |
+         static_cast<uint32_t>(f[off + 3]) << 24;
+}
+
+static inline uint16_t le16(const std::vector<uint8_t> &f, size_t off) {
+  return f[off] | f[off + 1] << 8;
+}
+
+// 32-bit little endian ELF, function and untyped symbols from .symtab
+bool Profiler::load_elf(const std::vector<uint8_t> &file) {
+  if (file.size() < 0x34 || file[4] != 1 || file[5] != 1) {
+    return false;
+  }
+
+  uint32_t shoff = le32(file, 0x20);
+  uint16_t shentsize = le16(file, 0x2e);
+  uint16_t shnum = le16(file, 0x30);
+  if (shentsize < 40 || shoff + shnum * shentsize > file.size()) {
+    return false;
+  }
+
+  for (uint16_t i = 0; i < shnum; i++) {
+    size_t sh = shoff + i * shentsize;
+    if (le32(file, sh + 4) != 2) { // SHT_SYMTAB
+      continue;
+    }
+    uint32_t offset = le32(file, sh + 16);
+    uint32_t size = le32(file, sh + 20);
+    uint32_t link = le32(file, sh + 24);
+    if (link >= shnum || offset + size > file.size()) {
+      return false;
+    }
+    size_t strtab_sh = shoff + link * shentsize;
+    uint32_t strtab = le32(file, strtab_sh + 16);
+    uint32_t strtab_size = le32(file, strtab_sh + 20);
+    if (strtab + strtab_size > file.size()) {
+      return false;
+    }
+
+    for (uint32_t sym = offset; sym + 16 <= offset + size; sym += 16) {
+      uint32_t name = le32(file, sym);
+      uint8_t type = file[sym + 12] & 0xf;
+      uint16_t shndx = le16(file, sym + 14);
+      // STT_NOTYPE covers hand written assembly labels
+      if ((type != 2 && type != 0) || !shndx || name >= strtab_size) {
+        continue;
+      }
+      const char *str = reinterpret_cast<const char *>(&file[strtab + name]);
+      size_t len = strnlen(str, strtab_size - name);
+      // Skip the ARM $a/$t/$d mapping symbols
+      if (!len || str[0] == '$') {
+        continue;
+      }
+      symbols.push_back({le32(file, sym + 4) & ~1u, le32(file, sym + 8),
+                         std::string(str, len)});
+    }
+  }
+  return true;
+}
+
+bool Profiler::load_map(const std::vector<uint8_t> &file) {
+  std::string text(file.begin(), file.end());
+  size_t pos = 0;
+  while (pos < text.size()) {
+    size_t end = text.find('\n', pos);
+    if (end == std::string::npos) {
+      end = text.size();
+    }
+    std::string line = text.substr(pos, end - pos);
+    pos = end + 1;
+
+    char *rest;
+    uint32_t addr = strtoul(line.c_str(), &rest, 16);
+    if (rest == line.c_str() || (*rest != ' ' && *rest != '\t')) {
+      continue;
+    }
+
+    // The name is the last token on the line
+    size_t last = line.find_last_not_of(" \t\r");
+    if (last == std::string::npos) {
+      continue;
+    }
+    size_t first = line.find_last_of(" \t", last);
+    std::string name = line.substr(first + 1, last - first);
+    if (rest >= line.c_str() + first + 1) {
+      continue;
+    }
+    symbols.push_back({addr & ~1u, 0, name});
+  }
+  return true;
+}
+
+std::string Profiler::symbolize(uint32_t addr) {
+  auto it = std::upper_bound(
+      symbols.begin(), symbols.end(), addr,
+      [](uint32_t a, const Symbol &s) { return a < s.addr; });
+  if (it != symbols.begin()) {
+    --it;
+    if (!it->size || addr < it->addr + it->size) {
+      return it->name;
+    }
+  }
+
+  char hex[11];
+  snprintf(hex, sizeof(hex), "0x%08x", addr);
+  return hex;
+}
+
+// Root frame, so handler time is split from the main program
+static const char *mode_name(uint32_t cpsr) {
+  switch (cpsr & 0x1f) {
+  case 0x10:
+    return "usr";
+  case 0x11:
+    return "fiq";
+  case 0x12:
+    return "irq";
+  case 0x13:
+    return "svc";
+  case 0x17:
+    return "abt";
+  case 0x1b:
+    return "und";
+  case 0x1f:
+    return "sys";
+  default:
+    return "unknown";
+  }
+}
+
+bool Profiler::write_collapsed(const char *path) {
+  std::map<std::string, uint64_t> stacks;
+  for (const Sample &s : samples) {
+    std::string stack = mode_name(s.cpsr);
+    std::string frame;
+    for (uint8_t i = 0; i < s.depth; i++) {
+      frame = symbolize(s.stack[i]);
+      stack += ";" + frame;
+    }
+    std::string leaf = s.halted ? "[halt]" : symbolize(s.pc);
+    // Already attributed to the function the last call entered
+    if (leaf != frame) {
+      stack += ";" + leaf;
+    }
+    stacks[stack]++;
+  }
+
+  FILE *fp = fopen(path, "w");
+  if (!fp) {
+    return false;
+  }
+  for (const auto &[stack, count] : stacks) {
+    fprintf(fp, "%s %llu\n", stack.c_str(),
+            static_cast<unsigned long long>(count));
+  }
+  fclose(fp);
+  return true;
+}
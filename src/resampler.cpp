@@ -0,0 +1,273 @@
+#include "resampler.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RESAMPLER_X86
+#endif
+
+// Keep at most this many consumed input samples around before compacting
+#define HISTORY_SLACK 4096
+
+static void dot_scalar(const float *h0, const float *h1, float t,
+                       const float *l, const float *r, uint32_t taps,
+                       float &out_l, float &out_r) {
+  float sl = 0, sr = 0;
+  for (uint32_t k = 0; k < taps; k++) {
+    float c = h0[k] + t * (h1[k] - h0[k]);
+    sl += c * l[k];
+    sr += c * r[k];
+  }
+  out_l = sl;
+  out_r = sr;
+}
+
+#ifdef RESAMPLER_X86
+__attribute__((target("sse"))) static void
+dot_sse(const float *h0, const float *h1, float t, const float *l,
+        const float *r, uint32_t taps, float &out_l, float &out_r) {
+  __m128 vt = _mm_set1_ps(t);
+  __m128 sl = _mm_setzero_ps();
+  __m128 sr = _mm_setzero_ps();
+  for (uint32_t k = 0; k < taps; k += 4) {
+    __m128 a = _mm_loadu_ps(h0 + k);
+    __m128 b = _mm_loadu_ps(h1 + k);
+    __m128 c = _mm_add_ps(a, _mm_mul_ps(vt, _mm_sub_ps(b, a)));
+    sl = _mm_add_ps(sl, _mm_mul_ps(c, _mm_loadu_ps(l + k)));
+    sr = _mm_add_ps(sr, _mm_mul_ps(c, _mm_loadu_ps(r + k)));
+  }
+  // Horizontal sums of both accumulators at once
+  __m128 lo = _mm_unpacklo_ps(sl, sr); // l0 r0 l1 r1
+  __m128 hi = _mm_unpackhi_ps(sl, sr); // l2 r2 l3 r3
+  __m128 sum = _mm_add_ps(lo, hi);
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  float res[4];
+  _mm_storeu_ps(res, sum);
+  out_l = res[0];
+  out_r = res[1];
+}
+
+__attribute__((target("avx"))) static void
+dot_avx(const float *h0, const float *h1, float t, const float *l,
+        const float *r, uint32_t taps, float &out_l, float &out_r) {
+  __m256 vt = _mm256_set1_ps(t);
+  __m256 sl = _mm256_setzero_ps();
+  __m256 sr = _mm256_setzero_ps();
+  for (uint32_t k = 0; k < taps; k += 8) {
+    __m256 a = _mm256_loadu_ps(h0 + k);
+    __m256 b = _mm256_loadu_ps(h1 + k);
+    __m256 c = _mm256_add_ps(a, _mm256_mul_ps(vt, _mm256_sub_ps(b, a)));
+    sl = _mm256_add_ps(sl, _mm256_mul_ps(c, _mm256_loadu_ps(l + k)));
+    sr = _mm256_add_ps(sr, _mm256_mul_ps(c, _mm256_loadu_ps(r + k)));
+  }
+  __m128 l4 = _mm_add_ps(_mm256_castps256_ps128(sl),
+                         _mm256_extractf128_ps(sl, 1));
+  __m128 r4 = _mm_add_ps(_mm256_castps256_ps128(sr),
+                         _mm256_extractf128_ps(sr, 1));
+  __m128 lo = _mm_unpacklo_ps(l4, r4);
+  __m128 hi = _mm_unpackhi_ps(l4, r4);
+  __m128 sum = _mm_add_ps(lo, hi);
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  float res[4];
+  _mm_storeu_ps(res, sum);
+  out_l = res[0];
+  out_r = res[1];
+}
+#endif
+
+// Zeroth order modified Bessel function of the first kind, for the Kaiser
+// window
+static double bessel_i0(double x) {
+  double sum = 1.0;
+  double term = 1.0;
+  for (int k = 1; k < 32; k++) {
+    term *= (x / (2 * k)) * (x / (2 * k));
+    sum += term;
+    if (term < sum * 1e-12) {
+      break;
+    }
+  }
+  return sum;
+}
+
+Resampler::Resampler(double in_rate, double out_rate, QUALITY quality)
+    : in_rate(in_rate), out_rate(out_rate), adjust(1.0), quality(quality),
+      kernel(SCALAR), dot(dot_scalar) {
+  if (!set_kernel(AVX)) {
+    set_kernel(SSE);
+  }
+  update_step();
+  build_filter();
+  reset();
+}
+
+void Resampler::set_rates(double in_rate, double out_rate) {
+  this->in_rate = in_rate;
+  this->out_rate = out_rate;
+  update_step();
+  build_filter();
+}
+
+void Resampler::set_quality(QUALITY quality) {
+  this->quality = quality;
+  build_filter();
+  reset();
+}
+
+void Resampler::set_ratio_adjust(double adjust) {
+  this->adjust = adjust;
+  update_step();
+}
+
+bool Resampler::set_kernel(KERNEL kernel) {
+  switch (kernel) {
+  case SCALAR:
+    dot = dot_scalar;
+    break;
+#ifdef RESAMPLER_X86
+  case SSE:
+    if (!__builtin_cpu_supports("sse")) {
+      return false;
+    }
+    dot = dot_sse;
+    break;
+  case AVX:
+    if (!__builtin_cpu_supports("avx")) {
+      return false;
+    }
+    dot = dot_avx;
+    break;
+#endif
+  default:
+    return false;
+  }
+  this->kernel = kernel;
+  return true;
+}
+
+void Resampler::update_step() { step = in_rate / out_rate * adjust; }
+
+void Resampler::build_filter() {
+  static constexpr uint32_t taps_for[3] = {8, 16, 32};
+  static constexpr double beta_for[3] = {5.0, 7.0, 9.0};
+
+  taps = taps_for[quality];
+  double beta = beta_for[quality];
+
+  // Cut off below the lower of the two Nyquist frequencies, with a little
+  // headroom for the transition band
+  double cutoff = std::min(1.0, out_rate / in_rate) * 0.95;
+  double half = taps / 2;
+
+  coeffs.resize((PHASES + 1) * taps);
+
+  for (uint32_t p = 0; p <= PHASES; p++) {
+    float *row = coeffs.data() + p * taps;
+    double frac = static_cast<double>(p) / PHASES;
+    double sum = 0;
+    for (uint32_t k = 0; k < taps; k++) {
+      double d = (static_cast<double>(k) - (half - 1)) - frac;
+      double x = d * cutoff * M_PI;
+      double sinc = (x == 0) ? 1.0 : std::sin(x) / x;
+      double w = d / half;
+      double window =
+          (std::fabs(w) >= 1.0)
+              ? 0.0
+              : bessel_i0(beta * std::sqrt(1.0 - w * w)) / bessel_i0(beta);
+      row[k] = static_cast<float>(sinc * window);
+      sum += row[k];
+    }
+    // Unity gain at DC for every phase
+    for (uint32_t k = 0; k < taps; k++) {
+      row[k] = static_cast<float>(row[k] / sum);
+    }
+  }
+}
+
+void Resampler::reset() {
+  // Prime with silence so the first input sample sits at the filter centre
+  hist_l.assign(taps / 2 - 1, 0.0f);
+  hist_r.assign(taps / 2 - 1, 0.0f);
+  pos = taps / 2 - 1;
+}
+
+void Resampler::push(const float *samples, size_t frames) {
+  for (size_t i = 0; i < frames; i++) {
+    hist_l.push_back(samples[2 * i + 0]);
+    hist_r.push_back(samples[2 * i + 1]);
+  }
+}
+
+void Resampler::push(const int16_t *samples, size_t frames) {
+  for (size_t i = 0; i < frames; i++) {
+    hist_l.push_back(samples[2 * i + 0] * (1.0f / 32768.0f));
+    hist_r.push_back(samples[2 * i + 1] * (1.0f / 32768.0f));
+  }
+}
+
+size_t Resampler::available() {
+  // The newest input sample an output at `pos` needs is floor(pos) + taps / 2,
+  // so every output before `end` can be produced
+  double end = static_cast<double>(hist_l.size()) - taps / 2;
+  if (pos >= end) {
+    return 0;
+  }
+  return static_cast<size_t>(std::ceil((end - pos) / step));
+}
+
+size_t Resampler::pull(float *out, size_t frames) {
+  uint32_t half = taps / 2;
+  size_t size = hist_l.size();
+  size_t n = 0;
+
+  while (n < frames) {
+    size_t i0 = static_cast<size_t>(pos);
+    if (i0 + half >= size) {
+      break;
+    }
+    double phase = (pos - i0) * PHASES;
+    uint32_t p = static_cast<uint32_t>(phase);
+    float t = static_cast<float>(phase - p);
+
+    const float *h0 = coeffs.data() + p * taps;
+    size_t first = i0 + 1 - half;
+    dot(h0, h0 + taps, t, hist_l.data() + first, hist_r.data() + first, taps,
+        out[2 * n + 0], out[2 * n + 1]);
+
+    pos += step;
+    n++;
+  }
+
+  compact();
+  return n;
+}
+
+size_t Resampler::pull(int16_t *out, size_t frames) {
+  float buf[512];
+  size_t n = 0;
+  while (n < frames) {
+    size_t chunk = std::min<size_t>(frames - n, 256);
+    size_t got = pull(buf, chunk);
+    for (size_t i = 0; i < got * 2; i++) {
+      float s = std::clamp(buf[i], -1.0f, 1.0f) * 32767.0f;
+      out[2 * n + i] = static_cast<int16_t>(std::lrintf(s));
+    }
+    n += got;
+    if (got < chunk) {
+      break;
+    }
+  }
+  return n;
+}
+
+void Resampler::compact() {
+  size_t i0 = static_cast<size_t>(pos);
+  size_t keep_from = i0 + 1 - taps / 2;
+  if (keep_from < HISTORY_SLACK) {
+    return;
+  }
+  hist_l.erase(hist_l.begin(), hist_l.begin() + keep_from);
+  hist_r.erase(hist_r.begin(), hist_r.begin() + keep_from);
+  pos -= keep_from;
+}
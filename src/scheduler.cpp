@@ -0,0 +1,72 @@
+#include "scheduler.h"
+
+#define NEVER (~0ull)
+
+Scheduler::Scheduler() {
+  for (int i = 0; i < EVENT_COUNT; i++) {
+    slots[i].when = NEVER;
+    slots[i].active = false;
+    slots[i].handler = nullptr;
+    slots[i].ctx = nullptr;
+  }
+  timestamp = 0;
+  next_event = NEVER;
+  dispatching = false;
+}
+
+void Scheduler::set_handler(EVENT event, Handler handler, void *ctx) {
+  slots[event].handler = handler;
+  slots[event].ctx = ctx;
+}
+
+void Scheduler::schedule(EVENT event, uint64_t delay) {
+  schedule_at(event, timestamp + delay);
+}
+
+void Scheduler::schedule_at(EVENT event, uint64_t when) {
+  slots[event].when = when;
+  slots[event].active = true;
+  if (when < next_event) {
+    next_event = when;
+  }
+}
+
+void Scheduler::cancel(EVENT event) {
+  if (!slots[event].active) {
+    return;
+  }
+  slots[event].active = false;
+  if (slots[event].when == next_event) {
+    update_next();
+  }
+}
+
+void Scheduler::run_events() {
+  // Handlers may schedule new events (possibly already due), so keep going
+  // until nothing is left at or before the current timestamp
+  dispatching = true;
+  while (next_event <= timestamp) {
+    int due = 0;
+    for (int i = 1; i < EVENT_COUNT; i++) {
+      if (slots[i].active &&
+          (!slots[due].active || slots[i].when < slots[due].when)) {
+        due = i;
+      }
+    }
+
+    Slot &slot = slots[due];
+    slot.active = false;
+    update_next();
+    slot.handler(slot.ctx, timestamp - slot.when);
+  }
+  dispatching = false;
+}
+
+void Scheduler::update_next() {
+  next_event = NEVER;
+  for (int i = 0; i < EVENT_COUNT; i++) {
+    if (slots[i].active && slots[i].when < next_event) {
+      next_event = slots[i].when;
+    }
+  }
+}
@@ -1,49 +1,18 @@
 #include "bus.h"
 #include "cpu.h"
+#include "profiler.h"
 
 void CPU::thumb_msr(uint16_t instr) {
-  uint8_t opcode = (instr >> 11) & 0x3;
+  SHIFT shift_type = static_cast<SHIFT>((instr >> 11) & 0x3);
   uint8_t offset = (instr >> 6) & 0x1f;
   uint8_t rs = (instr >> 3) & 0x7;
   uint8_t rd = instr & 0x7;
-  bool carry = get_cc(FLAG::C);
   uint32_t val = get_reg(rs);
 
-  switch (opcode) {
-  case 0:
-    if (offset != 0) {
-      val <<= offset - 1;
-      carry = val >> 31;
-      val <<= 1;
-    }
-    break;
-  case 1:
-    if (offset == 0) {
-      offset = 31;
-    }
-    val >>= offset - 1;
-    carry = val & 0x1;
-    val >>= 1;
-    break;
-  case 2:
-    if (offset == 0) {
-      offset = 31;
-    }
-    val >>= offset - 1;
-    carry = val & 0x1;
-    val >>= 1;
-    if (val & (1 << (31 - offset))) {
-      val |= 0xffffffff << (32 - offset);
-    }
-    break;
-  case 3:
-  default:
-    break;
-  }
+  // Same immediate encoding as ARM, LSR/ASR #0 shift by 32
+  bool carry = barrel_shift(val, shift_type, offset, false);
   set_reg(rd, val);
-  set_cc(FLAG::N, val >> 31);
-  set_cc(FLAG::Z, val == 0);
-  set_cc(FLAG::C, carry);
+  set_logic(val, carry);
 };
 void CPU::thumb_as(uint16_t instr) {
   uint8_t opcode = (instr >> 9) & 0x3;
@@ -59,39 +28,25 @@ void CPU::thumb_as(uint16_t instr) {
     // ADD reg
     res = op1 + op2;
     set_reg(rd, res);
-    set_cc(FLAG::N, res >> 31);
-    set_cc(FLAG::Z, res == 0);
-    set_cc(FLAG::C, (op1 >> 31) + (op2 >> 31) > (res >> 31));
-    set_cc(FLAG::V, ((op1 >> 31) == (op2 >> 31)) && (op1 >> 31 != (res >> 31)));
+    set_add(op1, op2, false, res);
     break;
   case 1:
     // SUB reg
     res = op1 - op2;
     set_reg(rd, res);
-    set_cc(FLAG::N, res >> 31);
-    set_cc(FLAG::Z, res == 0);
-    set_cc(FLAG::C, op1 >= op2);
-    set_cc(FLAG::V,
-           ((op1 >> 31) != (op2 >> 31)) && ((op1 >> 31) != (res >> 31)));
+    set_sub(op1, op2, true, res);
     break;
   case 2:
     // ADD imm
     res = op1 + rn;
     set_reg(rd, res);
-    set_cc(FLAG::N, res >> 31);
-    set_cc(FLAG::Z, res == 0);
-    set_cc(FLAG::C, (op1 >> 31) + (rn >> 31) > (res >> 31));
-    set_cc(FLAG::V, ((op1 >> 31) == (rn >> 31)) && (op1 >> 31 != (res >> 31)));
+    set_add(op1, rn, false, res);
     break;
   case 3:
     // SUB imm
     res = op1 - rn;
     set_reg(rd, res);
-    set_cc(FLAG::N, res >> 31);
-    set_cc(FLAG::Z, res == 0);
-    set_cc(FLAG::C, op1 >= rn);
-    set_cc(FLAG::V,
-           ((op1 >> 31) != (rn >> 31)) && ((op1 >> 31) != (res >> 31)));
+    set_sub(op1, rn, true, res);
     break;
   default:
     break;
@@ -109,36 +64,24 @@ void CPU::thumb_mcasi(uint16_t instr) {
     // MOV
     res = op2;
     set_reg(rd, res);
-    set_cc(FLAG::N, res >> 31);
-    set_cc(FLAG::Z, res == 0);
+    set_nz(res);
     break;
   case 1:
     // CMP
     res = op1 - op2;
-    set_cc(FLAG::N, res >> 31);
-    set_cc(FLAG::Z, res == 0);
-    set_cc(FLAG::C, op1 >= op2);
-    set_cc(FLAG::V,
-           ((op1 >> 31) != (op2 >> 31)) && ((op1 >> 31) != (res >> 31)));
+    set_sub(op1, op2, true, res);
     break;
   case 2:
     // ADD
     res = op1 + op2;
     set_reg(rd, res);
-    set_cc(FLAG::N, res >> 31);
-    set_cc(FLAG::Z, res == 0);
-    set_cc(FLAG::C, (op1 >> 31) + (op2 >> 31) > (res >> 31));
-    set_cc(FLAG::V, ((op1 >> 31) == (op2 >> 31)) && (op1 >> 31 != (res >> 31)));
+    set_add(op1, op2, false, res);
     break;
   case 3:
     // SUB
     res = op1 - op2;
     set_reg(rd, res);
-    set_cc(FLAG::N, res >> 31);
-    set_cc(FLAG::Z, res == 0);
-    set_cc(FLAG::C, op1 >= op2);
-    set_cc(FLAG::V,
-           ((op1 >> 31) != (op2 >> 31)) && ((op1 >> 31) != (res >> 31)));
+    set_sub(op1, op2, true, res);
     break;
   }
 };
@@ -152,24 +95,104 @@ void CPU::thumb_alu(uint16_t instr) {
   uint32_t res;
 
   switch (opcode) {
+  case 0x0:
+    // AND
+    res = op1 & op2;
+    set_reg(rd, res);
+    set_nz(res);
+    break;
+  case 0x1:
+    // EOR
+    res = op1 ^ op2;
+    set_reg(rd, res);
+    set_nz(res);
+    break;
+  case 0x2:
+  case 0x3:
+  case 0x4:
+  case 0x7: {
+    // LSL, LSR, ASR, ROR by register
+    res = op1;
+    bool carry = barrel_shift(res,
+                              (opcode == 0x7)
+                                  ? SHIFT::ROR
+                                  : static_cast<SHIFT>(opcode - 0x2),
+                              op2 & 0xff, true);
+    set_reg(rd, res);
+    set_logic(res, carry);
+    cycle(1);
+    break;
+  }
+  case 0x5: {
+    // ADC
+    bool carry = get_cc(FLAG::C);
+    res = op1 + op2 + carry;
+    set_reg(rd, res);
+    set_add(op1, op2, carry, res);
+    break;
+  }
+  case 0x6: {
+    // SBC
+    bool carry = get_cc(FLAG::C);
+    res = op1 - op2 - !carry;
+    set_reg(rd, res);
+    set_sub(op1, op2, carry, res);
+    break;
+  }
+  case 0x8:
+    // TST
+    res = op1 & op2;
+    set_nz(res);
+    break;
+  case 0x9:
+    // NEG
+    res = 0 - op2;
+    set_reg(rd, res);
+    set_sub(0, op2, true, res);
+    break;
   case 0xA:
     // CMP
     res = op1 - op2;
-    set_cc(FLAG::N, res >> 31);
-    set_cc(FLAG::Z, res == 0);
-    set_cc(FLAG::C, op1 >= op2);
-    set_cc(FLAG::V,
-           ((op1 >> 31) != (op2 >> 31)) && ((op1 >> 31) != (res >> 31)));
+    set_sub(op1, op2, true, res);
+    break;
+  case 0xB:
+    // CMN
+    res = op1 + op2;
+    set_add(op1, op2, false, res);
+    break;
+  case 0xC:
+    // ORR
+    res = op1 | op2;
+    set_reg(rd, res);
+    set_nz(res);
+    break;
+  case 0xD:
+    // MUL, 1 internal cycle per significant byte of the multiplier
+    res = op1 * op2;
+    set_reg(rd, res);
+    set_nz(res);
+    if ((op1 & 0xffffff00) == 0 || (op1 & 0xffffff00) == 0xffffff00) {
+      cycle(1);
+    } else if ((op1 & 0xffff0000) == 0 || (op1 & 0xffff0000) == 0xffff0000) {
+      cycle(2);
+    } else if ((op1 & 0xff000000) == 0 || (op1 & 0xff000000) == 0xff000000) {
+      cycle(3);
+    } else {
+      cycle(4);
+    }
     break;
   case 0xE:
     // BIC
     res = op1 & ~op2;
     set_reg(rd, res);
-    set_cc(FLAG::N, res >> 31);
-    set_cc(FLAG::Z, res == 0);
+    set_nz(res);
     break;
+  case 0xF:
   default:
-    NYI("alu");
+    // MVN
+    res = ~op2;
+    set_reg(rd, res);
+    set_nz(res);
     break;
   }
 };
@@ -196,11 +219,7 @@ void CPU::thumb_hrobx(uint16_t instr) {
     break;
   case 0x1:
     res = op1 - op2;
-    set_cc(FLAG::N, res >> 31);
-    set_cc(FLAG::Z, res == 0);
-    set_cc(FLAG::C, op1 >= op2);
-    set_cc(FLAG::V,
-           ((op1 >> 31) != (op2 >> 31)) && ((op1 >> 31) != (res >> 31)));
+    set_sub(op1, op2, true, res);
     break;
   case 0x2:
     set_reg(rd, op1);
@@ -286,29 +305,73 @@ void CPU::thumb_ppr(uint16_t instr) {
   bool pc_lr = (instr >> 8) & 0x1;
   uint8_t reg_list = (instr & 0xff);
 
+  // Whole stack frame in plain memory, copied without going through the bus
+  uint32_t count = __builtin_popcount(reg_list) + pc_lr;
+  uint32_t start = (opcode ? get_reg(13) : get_reg(13) - count * 4) & ~0x3;
+  uint32_t *mem = nullptr;
+  if (count) {
+    mem = reinterpret_cast<uint32_t *>(
+        bus->get_host_ptr(start, count * 4, !opcode));
+  }
+
   bus->set_last_cycle_type(CYCLE_TYPE::NON_SEQ);
   if (opcode) {
+    if (mem) {
+      uint32_t *word = mem;
+      for (int i = 0; i < 8; i++) {
+        if ((reg_list >> i) & 0x1) {
+          regs[i] = *word++;
+        }
+      }
+      if (pc_lr) {
+        set_reg(15, *word & ~0x1);
+      }
+      set_reg(13, get_reg(13) + count * 4);
+      bus->burst32(start, count, false);
+      if (pc_lr) {
+        thumb_fetch();
+      }
+      cycle(1);
+      return;
+    }
+
     for (int i = 0; i < 8; i++) {
       if ((reg_list >> i) & 0x1) {
-        set_reg(i, bus->read32(get_reg(13), CYCLE_TYPE::NON_SEQ));
+        set_reg(i, bus->read32(get_reg(13), CYCLE_TYPE::SEQ));
         set_reg(13, get_reg(13) + 4);
       }
     }
     if (pc_lr) {
-      set_reg(15, bus->read32(get_reg(13), CYCLE_TYPE::NON_SEQ) & ~0x1);
+      set_reg(15, bus->read32(get_reg(13), CYCLE_TYPE::SEQ) & ~0x1);
       set_reg(13, get_reg(13) + 4);
       thumb_fetch();
     }
     cycle(1);
   } else {
+    if (mem) {
+      uint32_t *word = mem;
+      for (int i = 0; i < 8; i++) {
+        if ((reg_list >> i) & 0x1) {
+          *word++ = regs[i];
+        }
+      }
+      if (pc_lr) {
+        *word = regs[14];
+      }
+      set_reg(13, get_reg(13) - count * 4);
+      bus->burst32(start, count, true);
+      bus->set_last_cycle_type(CYCLE_TYPE::NON_SEQ);
+      return;
+    }
+
     if (pc_lr) {
       set_reg(13, get_reg(13) - 4);
-      bus->write32(get_reg(13), get_reg(14), CYCLE_TYPE::NON_SEQ);
+      bus->write32(get_reg(13), get_reg(14), CYCLE_TYPE::SEQ);
     }
     for (int i = 7; i >= 0; i--) {
       if ((reg_list >> i) & 0x1) {
         set_reg(13, get_reg(13) - 4);
-        bus->write32(get_reg(13), get_reg(i), CYCLE_TYPE::NON_SEQ);
+        bus->write32(get_reg(13), get_reg(i), CYCLE_TYPE::SEQ);
       }
     }
     bus->set_last_cycle_type(CYCLE_TYPE::NON_SEQ);
@@ -342,9 +405,30 @@ void CPU::thumb_mls(uint16_t instr) {
     }
   }
 
+  uint32_t *mem = reinterpret_cast<uint32_t *>(
+      bus->get_host_ptr(addr & ~0x3, count, !l));
+
   bus->set_last_cycle_type(CYCLE_TYPE::NON_SEQ);
   set_reg(rb, addr + count);
   cycle(1);
+  if (mem) {
+    uint32_t *word = mem;
+    for (int i = 0; i < 8; i++) {
+      if ((reg_list >> i) & 0x1) {
+        if (l) {
+          regs[i] = *word++;
+        } else {
+          *word++ = regs[i];
+        }
+      }
+    }
+    bus->burst32(addr & ~0x3, count / 4, !l);
+    if (!l) {
+      bus->set_last_cycle_type(CYCLE_TYPE::NON_SEQ);
+    }
+    return;
+  }
+
   if (l) {
     for (int i = 0; i < 8; i++) {
       if ((reg_list >> i) & 0x1) {
@@ -365,24 +449,53 @@ void CPU::thumb_mls(uint16_t instr) {
 
 void CPU::thumb_cb(uint16_t instr) {
   COND cond = static_cast<COND>((instr >> 8) & 0xf);
-  uint32_t offset = instr & 0xff;
   if (eval_cond(cond)) {
-    if (offset & 0x80) {
-      offset |= 0xffffff00;
-    }
-    offset <<= 1;
-    set_reg(15, get_reg(15) + offset);
-    thumb_fetch();
+    thumb_cb_taken(instr);
+  }
+};
+void CPU::thumb_cb_taken(uint16_t instr) {
+  uint32_t offset = instr & 0xff;
+  if (offset & 0x80) {
+    offset |= 0xffffff00;
+  }
+  offset <<= 1;
+  uint32_t pc = get_reg(15);
+  set_reg(15, pc + offset);
+  thumb_fetch();
+
+  if (offset & 0x80000000) {
+    check_idle_loop(pc - 4, pc + offset, true);
   }
 };
 void CPU::thumb_swi(uint16_t instr) {
-  regs_svc[1] = get_reg(15) - 2;
-  spsr_svc = cpsr;
-  cpsr = (cpsr & 0xffffff00) + 0x93;
+  if (hle_bios && hle_swi(instr & 0xff)) {
+    return;
+  }
+  uint32_t lr = get_reg(15) - 2;
+  spsr_svc = get_cpsr();
+  set_mode(MODE::SVC);
+  regs[14] = lr;
+  cpsr = (cpsr & ~CONTROL::T) | CONTROL::I;
   set_reg(15, 0x00000008);
   arm_fetch();
+  if (profiler) {
+    profiler->call(0x00000008, lr);
+  }
+};
+void CPU::thumb_ub(uint16_t instr) {
+  uint32_t offset = instr & 0x7ff;
+  if (offset & 0x400) {
+    offset |= 0xfffff800;
+  }
+  offset <<= 1;
+  uint32_t pc = get_reg(15);
+  set_reg(15, pc + offset);
+  thumb_fetch();
+
+  if (offset & 0x80000000) {
+    check_idle_loop(pc - 4, pc + offset, true);
+  }
 };
-void CPU::thumb_ub(uint16_t instr) { NYI("ub"); };
 void CPU::thumb_lbl(uint16_t instr) {
   bool h = (instr >> 11) & 0x1;
   uint32_t offset = instr & 0x7ff;
@@ -396,5 +509,8 @@ void CPU::thumb_lbl(uint16_t instr) {
     set_reg(14, (get_reg(15) - 2) | 0x1);
     set_reg(15, lr);
     thumb_fetch();
+    if (profiler) {
+      profiler->call(lr, get_reg(14));
+    }
   }
 };
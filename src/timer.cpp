@@ -0,0 +1,111 @@
+#include "timer.h"
+#include "bus.h"
+
+// F/1, F/64, F/256, F/1024
+static constexpr uint8_t prescaler_shift[4] = {0, 6, 8, 10};
+
+Timer::Timer(Bus &bus, Scheduler &scheduler) : bus(bus), scheduler(scheduler) {
+  for (int i = 0; i < 4; i++) {
+    tm[i].reload.full = 0;
+    tm[i].cnt_h.full = 0;
+    counter[i] = 0;
+    start[i] = 0;
+  }
+
+  scheduler.set_handler(Scheduler::TIMER0_OVERFLOW, &Timer::on_overflow<0>,
+                        this);
+  scheduler.set_handler(Scheduler::TIMER1_OVERFLOW, &Timer::on_overflow<1>,
+                        this);
+  scheduler.set_handler(Scheduler::TIMER2_OVERFLOW, &Timer::on_overflow<2>,
+                        this);
+  scheduler.set_handler(Scheduler::TIMER3_OVERFLOW, &Timer::on_overflow<3>,
+                        this);
+}
+
+Timer::~Timer() {}
+
+uint16_t Timer::get_counter(uint8_t id) {
+  if (!is_ticking(id)) {
+    return counter[id];
+  }
+  uint8_t shift = prescaler_shift[tm[id].cnt_h.bits.prescaler];
+  return counter[id] + ((scheduler.now() - start[id]) >> shift);
+}
+
+void Timer::set_control(uint8_t id, uint8_t data) {
+  bool was_enabled = tm[id].cnt_h.bits.enable;
+  bool was_ticking = is_ticking(id);
+
+  latch(id);
+  tm[id].cnt_h.bytes[0] = data;
+
+  if (!was_enabled && tm[id].cnt_h.bits.enable) {
+    counter[id] = tm[id].reload.full;
+  }
+
+  Scheduler::EVENT event =
+      static_cast<Scheduler::EVENT>(Scheduler::TIMER0_OVERFLOW + id);
+  if (is_ticking(id)) {
+    // A running timer keeps its partial tick, see latch()
+    if (!was_ticking) {
+      start[id] = scheduler.now();
+    }
+    schedule_overflow(id);
+  } else {
+    scheduler.cancel(event);
+  }
+}
+
+void Timer::latch(uint8_t id) {
+  if (!is_ticking(id)) {
+    return;
+  }
+  // Only whole ticks move into the counter, the partial one keeps counting.
+  // Restarting from now would delay the next tick on every TMxCNT_H write.
+  uint8_t shift = prescaler_shift[tm[id].cnt_h.bits.prescaler];
+  uint64_t ticks = (scheduler.now() - start[id]) >> shift;
+  counter[id] += ticks;
+  start[id] += ticks << shift;
+}
+
+void Timer::schedule_overflow(uint8_t id) {
+  uint8_t shift = prescaler_shift[tm[id].cnt_h.bits.prescaler];
+  uint64_t ticks = 0x10000 - counter[id];
+  scheduler.schedule_at(
+      static_cast<Scheduler::EVENT>(Scheduler::TIMER0_OVERFLOW + id),
+      start[id] + (ticks << shift));
+}
+
+void Timer::overflow(uint8_t id, uint64_t late) {
+  // Restart from the exact overflow time so lateness doesn't accumulate
+  counter[id] = tm[id].reload.full;
+  start[id] = scheduler.now() - late;
+  schedule_overflow(id);
+
+  overflowed(id);
+}
+
+void Timer::count_up(uint8_t id) {
+  if (++counter[id] != 0) {
+    return;
+  }
+
+  counter[id] = tm[id].reload.full;
+  overflowed(id);
+}
+
+void Timer::overflowed(uint8_t id) {
+  if (tm[id].cnt_h.bits.irq) {
+    bus.request_irq(static_cast<Bus::IRQ>(Bus::IRQ_TIMER0 + id));
+  }
+
+  // Timers 0 and 1 clock the Direct Sound FIFOs
+  if (id < 2) {
+    bus.fifo_tick(id);
+  }
+
+  if (id < 3 && tm[id + 1].cnt_h.bits.enable &&
+      tm[id + 1].cnt_h.bits.countUp) {
+    count_up(id + 1);
+  }
+}
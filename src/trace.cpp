@@ -0,0 +1,403 @@
+#include "trace.h"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Flushed once less than a worst case record (~100 bytes) is left
+#define TRACE_BUFFER_SIZE (1 << 20)
+#define TRACE_BUFFER_SLACK 128
+
+#define CPSR 16
+#define SPSR 17
+
+void TraceState::clear() {
+  memset(&last, 0, sizeof(last));
+  for (auto &slot : opcodes) {
+    slot.pc = 1; // Never a valid PC
+    slot.instr = 0;
+  }
+}
+
+static inline uint32_t opcode_slot(uint32_t pc) {
+  return (pc >> 1) & (TRACE_OPCODE_CACHE - 1);
+}
+
+// The flags end up in the low bits, where ULEB128 encodes them in one byte
+static inline uint32_t rotl4(uint32_t value) {
+  return (value << 4) | (value >> 28);
+}
+
+static inline uint32_t rotr4(uint32_t value) {
+  return (value >> 4) | (value << 28);
+}
+
+static inline uint32_t zigzag(uint32_t delta) {
+  return (delta << 1) ^ static_cast<uint32_t>(static_cast<int32_t>(delta) >> 31);
+}
+
+static inline uint32_t unzigzag(uint32_t value) {
+  return (value >> 1) ^ (0 - (value & 1));
+}
+
+static inline uint8_t *put_uleb(uint8_t *p, uint32_t value) {
+  while (value > 0x7f) {
+    *p++ = (value & 0x7f) | 0x80;
+    value >>= 7;
+  }
+  *p++ = value;
+  return p;
+}
+
+static inline uint8_t *put32(uint8_t *p, uint32_t value) {
+  p[0] = value;
+  p[1] = value >> 8;
+  p[2] = value >> 16;
+  p[3] = value >> 24;
+  return p + 4;
+}
+
+static inline uint8_t *put64(uint8_t *p, uint64_t value) {
+  return put32(put32(p, value), value >> 32);
+}
+
+static inline uint32_t get32(const uint8_t *p) {
+  return p[0] | p[1] << 8 | p[2] << 16 | static_cast<uint32_t>(p[3]) << 24;
+}
+
+static inline uint64_t get64(const uint8_t *p) {
+  return get32(p) | static_cast<uint64_t>(get32(p + 4)) << 32;
+}
+
+TraceWriter::TraceWriter()
+    : fp(nullptr), failed(false), interval(TRACE_DEFAULT_INTERVAL),
+      records(0), offset(0), used(0) {}
+
+TraceWriter::~TraceWriter() { close(); }
+
+bool TraceWriter::open(const char *path, uint32_t interval) {
+  close();
+  fp = fopen(path, "wb");
+  if (!fp) {
+    return false;
+  }
+  this->interval = std::max(interval, 1u);
+  failed = false;
+  records = 0;
+  index.clear();
+  buffer.resize(TRACE_BUFFER_SIZE);
+
+  uint8_t *p = buffer.data();
+  memcpy(p, TRACE_MAGIC, 4);
+  p = put32(p + 4, TRACE_VERSION);
+  p = put32(p, this->interval);
+  used = p - buffer.data();
+  offset = 0;
+  return true;
+}
+
+void TraceWriter::flush() {
+  if (used && fwrite(buffer.data(), 1, used, fp) != used) {
+    failed = true;
+  }
+  offset += used;
+  used = 0;
+}
+
+void TraceWriter::write(const TraceRecord &record) {
+  if (TRACE_BUFFER_SIZE - used < TRACE_BUFFER_SLACK) {
+    flush();
+  }
+  uint8_t *p = buffer.data() + used;
+  TraceRecord &last = state.last;
+  uint32_t pc = record.regs[15];
+  auto &slot = state.opcodes[opcode_slot(pc)];
+
+  if (records % interval == 0) {
+    index.push_back(records);
+    index.push_back(offset + used);
+    state.clear();
+    *p++ = TRACE_KEYFRAME;
+    for (int r = 0; r < TRACE_REGS; r++) {
+      p = put32(p, record.regs[r]);
+    }
+    p = put32(p, record.instr);
+  } else {
+    bool thumb = record.regs[CPSR] & (1 << 5);
+    uint32_t head = (pc == last.regs[15] + (thumb ? 2 : 4)) ? TRACE_PC_NEXT
+                                                             : TRACE_PC_DELTA;
+    bool literal = slot.pc != pc || slot.instr != record.instr;
+    head |= literal << 2;
+    head |= (record.regs[CPSR] != last.regs[CPSR]) << 3;
+    for (int r = 0; r < 15; r++) {
+      head |= (record.regs[r] != last.regs[r]) << (4 + r);
+    }
+    head |= (record.regs[SPSR] != last.regs[SPSR]) << 19;
+    p = put_uleb(p, head);
+
+    if (head & (1 << 3)) {
+      p = put_uleb(p, rotl4(record.regs[CPSR] ^ last.regs[CPSR]));
+    }
+    if ((head & 3) == TRACE_PC_DELTA) {
+      p = put_uleb(p, zigzag(pc - last.regs[15]));
+    }
+    if (literal) {
+      *p++ = record.instr;
+      *p++ = record.instr >> 8;
+      if (!thumb) {
+        *p++ = record.instr >> 16;
+        *p++ = record.instr >> 24;
+      }
+    }
+    for (int r = 0; r < 15; r++) {
+      if (head & (1 << (4 + r))) {
+        p = put_uleb(p, zigzag(record.regs[r] - last.regs[r]));
+      }
+    }
+    if (head & (1 << 19)) {
+      p = put_uleb(p, rotl4(record.regs[SPSR] ^ record.regs[CPSR]));
+    }
+  }
+
+  slot.pc = pc;
+  slot.instr = record.instr;
+  last = record;
+  records++;
+  used = p - buffer.data();
+}
+
+bool TraceWriter::close() {
+  if (!fp) {
+    return true;
+  }
+  flush();
+
+  uint64_t index_offset = offset;
+  for (uint64_t value : index) {
+    uint8_t bytes[8];
+    put64(bytes, value);
+    if (fwrite(bytes, 1, 8, fp) != 8) {
+      failed = true;
+    }
+  }
+  uint8_t footer[TRACE_FOOTER_SIZE];
+  put64(put64(footer, index_offset), records);
+  memcpy(footer + 16, TRACE_INDEX_MAGIC, 4);
+  if (fwrite(footer, 1, sizeof(footer), fp) != sizeof(footer)) {
+    failed = true;
+  }
+  if (fclose(fp)) {
+    failed = true;
+  }
+  fp = nullptr;
+  return !failed;
+}
+
+TraceReader::TraceReader()
+    : data(nullptr), size(0), end(0), pos(0), interval(0), records(0),
+      next(0) {}
+
+TraceReader::~TraceReader() { close(); }
+
+void TraceReader::close() {
+  if (data) {
+    munmap(const_cast<uint8_t *>(data), size);
+  }
+  data = nullptr;
+  size = end = pos = 0;
+  records = next = 0;
+  index.clear();
+}
+
+bool TraceReader::open(const char *path) {
+  close();
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) || st.st_size < TRACE_HEADER_SIZE) {
+    ::close(fd);
+    return false;
+  }
+  size = st.st_size;
+  void *p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED) {
+    size = 0;
+    return false;
+  }
+  data = static_cast<const uint8_t *>(p);
+
+  if (memcmp(data, TRACE_MAGIC, 4) || get32(data + 4) != TRACE_VERSION) {
+    close();
+    return false;
+  }
+  interval = get32(data + 8);
+
+  // Trust the index only if it is consistent with the file
+  bool indexed = false;
+  if (size >= TRACE_HEADER_SIZE + TRACE_FOOTER_SIZE &&
+      !memcmp(data + size - 4, TRACE_INDEX_MAGIC, 4)) {
+    const uint8_t *footer = data + size - TRACE_FOOTER_SIZE;
+    uint64_t index_offset = get64(footer);
+    uint64_t index_size = size - TRACE_FOOTER_SIZE - index_offset;
+    if (index_offset >= TRACE_HEADER_SIZE &&
+        index_offset <= size - TRACE_FOOTER_SIZE && index_size % 16 == 0) {
+      end = index_offset;
+      records = get64(footer + 8);
+      for (uint64_t i = 0; i < index_size; i += 8) {
+        index.push_back(get64(data + index_offset + i));
+      }
+      indexed = true;
+    }
+  }
+  if (!indexed && !rebuild_index()) {
+    close();
+    return false;
+  }
+  return seek(0);
+}
+
+bool TraceReader::rebuild_index() {
+  index.clear();
+  end = size;
+  pos = TRACE_HEADER_SIZE;
+  next = 0;
+  TraceRecord record;
+  size_t start = pos;
+  // A cut off last record just ends the trace
+  while (pos < end) {
+    if (data[pos] == TRACE_KEYFRAME) {
+      index.push_back(next);
+      index.push_back(pos);
+    }
+    if (!decode(record)) {
+      break;
+    }
+    start = pos;
+  }
+  end = start;
+  records = next;
+  return true;
+}
+
+bool TraceReader::seek(uint64_t record) {
+  if (record > records) {
+    return false;
+  }
+  // Last keyframe at or before `record`
+  size_t k = 0;
+  for (size_t lo = 0, hi = index.size() / 2; lo < hi;) {
+    size_t mid = (lo + hi) / 2;
+    if (index[2 * mid] <= record) {
+      k = mid;
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (index.empty()) {
+    pos = TRACE_HEADER_SIZE;
+    next = 0;
+  } else {
+    next = index[2 * k];
+    pos = index[2 * k + 1];
+  }
+  TraceRecord skipped;
+  while (next < record) {
+    if (!decode(skipped)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool TraceReader::read(TraceRecord &record) {
+  if (next >= records) {
+    return false;
+  }
+  return decode(record);
+}
+
+bool TraceReader::decode(TraceRecord &record) {
+  const uint8_t *p = data + pos;
+  const uint8_t *limit = data + end;
+  bool ok = true;
+
+  auto uleb = [&]() {
+    uint32_t value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+      if (p == limit) {
+        ok = false;
+        return value;
+      }
+      uint8_t byte = *p++;
+      value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) {
+        return value;
+      }
+    }
+    ok = false;
+    return value;
+  };
+
+  TraceRecord &last = state.last;
+  uint32_t head = uleb();
+  if (!ok) {
+    return false;
+  }
+
+  if ((head & 3) == TRACE_KEYFRAME) {
+    if (limit - p < 4 * (TRACE_REGS + 1)) {
+      return false;
+    }
+    state.clear();
+    for (int r = 0; r < TRACE_REGS; r++, p += 4) {
+      record.regs[r] = get32(p);
+    }
+    record.instr = get32(p);
+    p += 4;
+  } else {
+    record = last;
+    if (head & (1 << 3)) {
+      record.regs[CPSR] = last.regs[CPSR] ^ rotr4(uleb());
+    }
+    bool thumb = record.regs[CPSR] & (1 << 5);
+    if ((head & 3) == TRACE_PC_DELTA) {
+      record.regs[15] = last.regs[15] + unzigzag(uleb());
+    } else {
+      record.regs[15] = last.regs[15] + (thumb ? 2 : 4);
+    }
+    auto &slot = state.opcodes[opcode_slot(record.regs[15])];
+    if (head & (1 << 2)) {
+      if (limit - p < (thumb ? 2 : 4)) {
+        return false;
+      }
+      record.instr = thumb ? (p[0] | p[1] << 8) : get32(p);
+      p += thumb ? 2 : 4;
+    } else {
+      record.instr = slot.instr;
+    }
+    for (int r = 0; r < 15; r++) {
+      if (head & (1 << (4 + r))) {
+        record.regs[r] = last.regs[r] + unzigzag(uleb());
+      }
+    }
+    if (head & (1 << 19)) {
+      record.regs[SPSR] = record.regs[CPSR] ^ rotr4(uleb());
+    }
+    if (!ok) {
+      return false;
+    }
+  }
+
+  state.opcodes[opcode_slot(record.regs[15])] = {record.regs[15],
+                                                 record.instr};
+  last = record;
+  pos = p - data;
+  next++;
+  return true;
+}
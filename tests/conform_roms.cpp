@@ -0,0 +1,74 @@
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Writes the small ARM ROMs the conform tests run gba_conform on into the
+// directory given as the only argument:
+//
+//   parked.gba    r12 = 0, then b . at 0x08000004
+//   failed.gba    r12 = 3, then b . at 0x08000004
+//   vblank.gba    r12 = 0, b . with a VBlank IRQ that only acks IF and stays
+//                 enabled, so handler returns keep landing on the branch
+//   verdict.gba   r12 = 1, b . with a VBlank IRQ whose handler writes the
+//                 verdict (r12 = 0 in the registers the BIOS saved) and turns
+//                 IME off; judging at the first b . would see r12 = 1
+
+typedef std::vector<uint32_t> Code;
+
+#define NOP 0xE1A00000 // mov r0, r0
+
+static Code irq_rom(uint32_t r12, bool verdict) {
+  return {
+      0xE3A0C000 | r12, // mov r12, #r12
+      0xE59F0044,       // ldr r0, =0x04000000
+      0xE3A01008,       // mov r1, #8
+      0xE1C010B4,       // strh r1, [r0, #4]     DISPSTAT: VBlank IRQ
+      0xE59F103C,       // ldr r1, =handler
+      0xE59F203C,       // ldr r2, =0x03FFFFFC
+      0xE5821000,       // str r1, [r2]
+      0xE3A01001,       // mov r1, #1
+      0xE2803C02,       // add r3, r0, #0x200
+      0xE1C310B0,       // strh r1, [r3]         IE = VBlank
+      0xE1C310B8,       // strh r1, [r3, #8]     IME = 1
+      0xEAFFFFFE,       // b .
+      // handler:
+      0xE3A00000,                 // mov r0, #0
+      verdict ? 0xE58D0010 : NOP, // str r0, [sp, #16]     saved r12
+      0xE59F3010,                 // ldr r3, =0x04000000
+      0xE2833C02,                 // add r3, r3, #0x200
+      verdict ? 0xE1C300B8 : NOP, // strh r0, [r3, #8]     IME = 0
+      0xE3A01001,                 // mov r1, #1
+      0xE1C310B2,                 // strh r1, [r3, #2]     ack IF
+      0xE12FFF1E,                 // bx lr
+      0x04000000,
+      0x08000030, // handler
+      0x03FFFFFC,
+  };
+}
+
+static bool write(const std::string &path, const Code &code) {
+  FILE *fp = fopen(path.c_str(), "wb");
+  if (!fp) {
+    fprintf(stderr, "Can't write %s\n", path.c_str());
+    return false;
+  }
+  // Padded to 1 KiB, room for a cartridge header
+  std::vector<uint32_t> rom(code);
+  rom.resize(0x100);
+  bool ok = fwrite(rom.data(), 4, rom.size(), fp) == rom.size();
+  return fclose(fp) == 0 && ok;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s <dir>\n", argv[0]);
+    return 2;
+  }
+  std::string dir = std::string(argv[1]) + "/";
+  bool ok = write(dir + "parked.gba", {0xE3A0C000, 0xEAFFFFFE}) &&
+            write(dir + "failed.gba", {0xE3A0C003, 0xEAFFFFFE}) &&
+            write(dir + "vblank.gba", irq_rom(0, false)) &&
+            write(dir + "verdict.gba", irq_rom(1, true));
+  return ok ? 0 : 1;
+}
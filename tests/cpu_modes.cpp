@@ -0,0 +1,359 @@
+#include "bus.h"
+#include "test.h"
+#include <initializer_list>
+#include <random>
+
+// Mode transitions of the banked register file. set_mode() and everything
+// that calls it are checked against a reference model with one slot per
+// architectural register, then the instructions and exceptions that change
+// mode are run from IWRAM through the standard BIOS stand-in.
+
+#define CODE 0x03000100   // ARM test code
+#define THUMB 0x03000200  // Thumb test code
+#define DATA 0x03000400   // Scratch words
+#define HANDLER 0x03000600 // Game IRQ handler, called by the BIOS
+
+#define SP_SYS 0x03007F00
+#define SP_IRQ 0x03007FA0
+#define SP_SVC 0x03007FE0
+
+// Reference register file, r8-r14 and the SPSR by mode
+struct Reference {
+  uint32_t regs[16];
+  uint32_t fiq[7], svc[2], abt[2], irq[2], und[2];
+  uint32_t spsr[32];
+
+  uint32_t *slot(uint32_t mode, int n) {
+    if (n < 8 || n == 15) {
+      return &regs[n];
+    }
+    if (mode == 0x11) {
+      return &fiq[n - 8];
+    }
+    if (n < 13) {
+      return &regs[n];
+    }
+    switch (mode) {
+    case 0x12:
+      return &irq[n - 13];
+    case 0x13:
+      return &svc[n - 13];
+    case 0x17:
+      return &abt[n - 13];
+    case 0x1b:
+      return &und[n - 13];
+    default:
+      return &regs[n];
+    }
+  }
+};
+
+// Friend of CPU
+struct Test {
+  CPU *cpu;
+  Bus *bus;
+
+  Test() {
+    cpu = new CPU();
+    bus = new Bus(*cpu);
+    bus->attach_ppu(new PPU(*bus, true));
+    cpu->set_bus(bus);
+    // Every SWI goes through the exception vector
+    cpu->set_hle_bios(false);
+    cpu->reset();
+  }
+
+  ~Test() { delete cpu; }
+
+  void arm(uint32_t addr, std::initializer_list<uint32_t> code) {
+    for (uint32_t instr : code) {
+      bus->write32(addr, instr, CPU::SEQ);
+      addr += 4;
+    }
+  }
+
+  void thumb(uint32_t addr, std::initializer_list<uint16_t> code) {
+    for (uint16_t instr : code) {
+      bus->write16(addr, instr, CPU::SEQ);
+      addr += 2;
+    }
+  }
+
+  // Continues at `addr` as if branched to
+  void jump(uint32_t addr, bool thumb) {
+    cpu->cpsr = thumb ? cpu->cpsr | CPU::T : cpu->cpsr & ~CPU::T;
+    cpu->regs[15] = addr;
+    if (thumb) {
+      cpu->thumb_fetch();
+    } else {
+      cpu->arm_fetch();
+    }
+  }
+
+  // Address of the next instruction to execute
+  uint32_t pc() { return cpu->regs[15] - (cpu->in_thumb() ? 2 : 4); }
+
+  bool run_to(uint32_t addr) {
+    for (int i = 0; i < 100 && pc() != addr; i++) {
+      cpu->step();
+    }
+    return pc() == addr;
+  }
+
+  // System mode with known registers and flags `cpsr`
+  void enter_sys(uint32_t cpsr) {
+    cpu->set_cpsr(0x1f);
+    for (int i = 0; i < 13; i++) {
+      cpu->regs[i] = 0x100 + i;
+    }
+    cpu->regs[13] = SP_SYS;
+    cpu->regs[14] = 0x1414;
+    cpu->set_cpsr(cpsr);
+  }
+
+  void check_sys_bank() {
+    for (int i = 0; i < 13; i++) {
+      CHECK_EQ(cpu->regs[i], 0x100 + i);
+    }
+    CHECK_EQ(cpu->regs[13], SP_SYS);
+    CHECK_EQ(cpu->regs[14], 0x1414);
+  }
+
+  // Random mode changes through every path that switches banks, with
+  // random register writes in between
+  void bank_swaps() {
+    static const uint32_t modes[] = {0x10, 0x11, 0x12, 0x13, 0x17, 0x1b, 0x1f};
+    std::mt19937 rng(37);
+    Reference ref = {};
+
+    cpu->set_cpsr(0xdf);
+    for (int n = 0; n < 16; n++) {
+      *ref.slot(0x1f, n) = cpu->get_reg(n);
+    }
+    for (uint32_t mode : modes) {
+      cpu->set_cpsr(0xc0 | mode);
+      for (int n = 8; n < 15; n++) {
+        uint32_t val = rng();
+        cpu->set_reg(n, val);
+        *ref.slot(mode, n) = val;
+      }
+      if (mode != 0x10 && mode != 0x1f) {
+        ref.spsr[mode] = rng();
+        cpu->set_psr(ref.spsr[mode]);
+      }
+    }
+
+    uint32_t mode = 0x1f;
+    cpu->set_cpsr(0xc0 | mode);
+    for (int it = 0; it < 200000; it++) {
+      uint32_t next = modes[rng() % 7];
+      bool user = mode == 0x10 || mode == 0x1f;
+      switch (rng() % 7) {
+      case 0:
+        cpu->set_cpsr((rng() & 0xf0000000) | 0xc0 | next);
+        mode = next;
+        break;
+      case 1:
+        cpu->set_mode(static_cast<CPU::MODE>(next));
+        mode = next;
+        break;
+      case 2:
+        // msr cpsr_c, r0
+        cpu->regs[0] = *ref.slot(mode, 0) = 0xc0 | next;
+        cpu->arm_execute(0xE121F000);
+        mode = next;
+        break;
+      case 3:
+        // msr spsr_fsxc, r0
+        if (!user) {
+          cpu->regs[0] = *ref.slot(mode, 0) = ref.spsr[mode] = rng();
+          cpu->arm_execute(0xE16FF000);
+        }
+        break;
+      case 4:
+        // stmia r1, {r8-r14}^ then ldmia r1, {r8-r14}^ with new values,
+        // both transfer the user bank from any mode
+        if (user) {
+          break;
+        }
+        cpu->regs[1] = *ref.slot(mode, 1) = DATA;
+        cpu->arm_execute(0xE8C17F00);
+        for (int n = 8; n < 15; n++) {
+          CHECK_EQ(bus->read32(DATA + (n - 8) * 4, CPU::SEQ),
+                   *ref.slot(0x10, n));
+          uint32_t val = rng();
+          bus->write32(DATA + (n - 8) * 4, val, CPU::SEQ);
+          *ref.slot(0x10, n) = val;
+        }
+        cpu->arm_execute(0xE8D17F00);
+        break;
+      default: {
+        int n = rng() % 15;
+        uint32_t val = rng();
+        cpu->set_reg(n, val);
+        *ref.slot(mode, n) = val;
+        break;
+      }
+      }
+
+      CHECK_EQ(cpu->get_mode(), mode);
+      for (int n = 0; n < 15; n++) {
+        CHECK_EQ(cpu->get_reg(n), *ref.slot(mode, n));
+      }
+      if (mode != 0x10 && mode != 0x1f) {
+        CHECK_EQ(cpu->get_psr(), ref.spsr[mode]);
+      }
+    }
+  }
+
+  // movs pc, lr: SVC -> User, Thumb
+  void movs_pc_lr() {
+    enter_sys(0x1f);
+    cpu->set_cpsr(0xd3);
+    cpu->regs[14] = THUMB;
+    cpu->spsr_svc = 0x80000030;
+    arm(CODE, {0xE1B0F00E});
+    thumb(THUMB, {0x2042, 0xE7FE}); // mov r0, #0x42; b .
+    jump(CODE, false);
+
+    cpu->step();
+    CHECK_EQ(cpu->get_cpsr(), 0x80000030);
+    CHECK_EQ(pc(), THUMB);
+    check_sys_bank();
+    CHECK_EQ(cpu->regs_svc[1], THUMB);
+    cpu->step();
+    CHECK_EQ(cpu->regs[0], 0x42);
+  }
+
+  // subs pc, lr, #4: IRQ -> System, ARM, flags restored
+  void subs_pc_lr() {
+    enter_sys(0x1f);
+    cpu->set_cpsr(0x92);
+    cpu->regs[14] = CODE + 0x104;
+    cpu->spsr_irq = 0x6000001f;
+    arm(CODE, {0xE25EF004});
+    arm(CODE + 0x100, {0xE3A00007}); // mov r0, #7
+    jump(CODE, false);
+
+    cpu->step();
+    CHECK_EQ(cpu->get_cpsr(), 0x6000001f);
+    CHECK_EQ(pc(), CODE + 0x100);
+    check_sys_bank();
+    CHECK_EQ(cpu->regs_irq[1], CODE + 0x104);
+    cpu->step();
+    CHECK_EQ(cpu->regs[0], 7);
+  }
+
+  // ldmfd sp!, {r0, r1, pc}^: SVC -> System, Thumb. The loads and the
+  // writeback land in the SVC bank, CPSR = SPSR happens last.
+  void ldm_restore() {
+    enter_sys(0x1f);
+    cpu->set_cpsr(0xd3);
+    cpu->regs[13] = DATA;
+    cpu->spsr_svc = 0x3f;
+    bus->write32(DATA, 0xaaaa, CPU::SEQ);
+    bus->write32(DATA + 4, 0xbbbb, CPU::SEQ);
+    bus->write32(DATA + 8, THUMB + 2, CPU::SEQ);
+    arm(CODE, {0xE8FD8003});
+    thumb(THUMB, {0x2042, 0x2043, 0xE7FE}); // mov r0, #0x42; mov r0, #0x43
+    jump(CODE, false);
+
+    cpu->step();
+    CHECK_EQ(cpu->get_cpsr(), 0x3f);
+    CHECK_EQ(pc(), THUMB + 2);
+    CHECK_EQ(cpu->regs[0], 0xaaaa);
+    CHECK_EQ(cpu->regs[1], 0xbbbb);
+    CHECK_EQ(cpu->regs[13], SP_SYS);
+    CHECK_EQ(cpu->regs[14], 0x1414);
+    CHECK_EQ(cpu->regs_svc[0], DATA + 12);
+    cpu->step();
+    CHECK_EQ(cpu->regs[0], 0x43);
+  }
+
+  // SWI from ARM and Thumb into the BIOS vector, whose handler returns with
+  // movs pc, lr
+  void swi(bool thumb_state) {
+    uint32_t cpsr = thumb_state ? 0x2000007f : 0x2000005f; // C, F
+    uint32_t addr = thumb_state ? THUMB : CODE;
+    uint32_t next = addr + (thumb_state ? 2 : 4);
+    enter_sys(cpsr);
+    cpu->regs_svc[1] = 0;
+    arm(CODE, {0xEF050000, 0xE3A00001});   // swi #5; mov r0, #1
+    thumb(THUMB, {0xDF05, 0x2001, 0xE7FE}); // swi #5; mov r0, #1
+    jump(addr, thumb_state);
+
+    cpu->step();
+    CHECK_EQ(cpu->get_mode(), CPU::SVC);
+    CHECK(cpu->cpsr & CPU::I);
+    CHECK(!(cpu->cpsr & CPU::T));
+    CHECK_EQ(cpu->cpsr & CPU::F, CPU::F);
+    CHECK_EQ(cpu->spsr_svc, cpsr);
+    CHECK_EQ(cpu->regs[13], SP_SVC);
+    CHECK_EQ(cpu->regs[14], next);
+    CHECK_EQ(pc(), 0x08);
+    CHECK_EQ(cpu->regs_usr[5], SP_SYS);
+    CHECK_EQ(cpu->regs_usr[6], 0x1414);
+
+    cpu->step();
+    CHECK_EQ(cpu->get_cpsr(), cpsr);
+    CHECK_EQ(pc(), next);
+    check_sys_bank();
+    CHECK_EQ(cpu->regs_svc[0], SP_SVC);
+    CHECK_EQ(cpu->regs_svc[1], next);
+    cpu->step();
+    CHECK_EQ(cpu->regs[0], 1);
+  }
+
+  // IRQ from ARM and Thumb through the BIOS dispatcher to a game handler
+  // that clobbers r2 and returns with bx lr
+  void irq(bool thumb_state) {
+    uint32_t cpsr = thumb_state ? 0x4000003f : 0x8000001f;
+    uint32_t addr = thumb_state ? THUMB : CODE;
+    enter_sys(cpsr);
+    bus->write32(0x03007FFC, HANDLER, CPU::SEQ);
+    arm(HANDLER, {0xE3A02099, 0xE12FFF1E}); // mov r2, #0x99; bx lr
+    arm(CODE, {0xE3A04001, 0xEAFFFFFE});    // mov r4, #1; b .
+    thumb(THUMB, {0x2401, 0xE7FE});         // mov r4, #1; b .
+    jump(addr, thumb_state);
+
+    // Masked, nothing happens
+    cpu->set_cpsr(cpsr | CPU::I);
+    cpu->set_irq_line(true);
+    cpu->step();
+    CHECK_EQ(cpu->get_mode(), CPU::SYS);
+    CHECK_EQ(cpu->regs[4], 1);
+    cpu->regs[4] = 0x104;
+    jump(addr, thumb_state);
+    cpu->set_cpsr(cpsr);
+
+    cpu->step();
+    cpu->set_irq_line(false);
+    CHECK_EQ(cpu->get_mode(), CPU::IRQ);
+    CHECK(cpu->cpsr & CPU::I);
+    CHECK(!(cpu->cpsr & CPU::T));
+    CHECK_EQ(cpu->spsr_irq, cpsr);
+    CHECK_EQ(cpu->regs[14], addr + 4);
+    CHECK(pc() >= 0x18 && pc() < 0x40);
+    CHECK_EQ(cpu->regs_usr[5], SP_SYS);
+
+    CHECK(run_to(addr));
+    CHECK_EQ(cpu->get_cpsr(), cpsr);
+    check_sys_bank();
+    CHECK_EQ(cpu->regs_irq[0], SP_IRQ);
+    CHECK_EQ(cpu->regs_irq[1], addr + 4);
+    cpu->step();
+    CHECK_EQ(cpu->regs[4], 1);
+  }
+};
+
+int main() {
+  Test().bank_swaps();
+  Test().movs_pc_lr();
+  Test().subs_pc_lr();
+  Test().ldm_restore();
+  Test().swi(false);
+  Test().swi(true);
+  Test().irq(false);
+  Test().irq(true);
+  return test_result("cpu_modes");
+}
@@ -0,0 +1,349 @@
+#include "bus.h"
+#include "test.h"
+#include <algorithm>
+#include <cstring>
+#include <queue>
+#include <random>
+#include <vector>
+
+// Round trips through the BIOS decompressors: data is packed with the
+// reference encoders below, unpacked by SWI 0x11-0x18 and compared with the
+// original, including the byte past the end. Runs the HLE decompressors by
+// default, or the real BIOS with
+//
+//   gba_test_decompress --no-hle <bios.bin>
+//
+// which exits with 77 (skipped) when the image can't be loaded.
+
+#define CODE 0x03000000
+#define SRC 0x02020000
+#define DST_WRAM 0x02000000
+#define DST_VRAM 0x06000000
+#define MAX_CYCLES (1 << 26)
+
+typedef std::vector<uint8_t> Data;
+
+static void header(Data &out, uint8_t type, uint32_t size) {
+  out.push_back(type);
+  out.push_back(size);
+  out.push_back(size >> 8);
+  out.push_back(size >> 16);
+}
+
+static void align(Data &out) {
+  while (out.size() & 3) {
+    out.push_back(0);
+  }
+}
+
+// Greedy LZ77. The VRAM variant writes halfwords, so a reference can't
+// point at the byte just before it.
+static Data lz77(const Data &in, bool vram) {
+  Data out;
+  header(out, 0x10, in.size());
+  size_t pos = 0;
+  while (pos < in.size()) {
+    size_t flags = out.size();
+    out.push_back(0);
+    for (int b = 0; b < 8 && pos < in.size(); b++) {
+      size_t best = 0, best_disp = 0;
+      for (size_t disp = vram ? 2 : 1; disp <= 4096 && disp <= pos; disp++) {
+        size_t len = 0;
+        while (len < 18 && pos + len < in.size() &&
+               in[pos + len - disp] == in[pos + len]) {
+          len++;
+        }
+        if (len > best) {
+          best = len;
+          best_disp = disp;
+        }
+      }
+      if (best >= 3) {
+        out[flags] |= 0x80 >> b;
+        out.push_back((best - 3) << 4 | (best_disp - 1) >> 8);
+        out.push_back(best_disp - 1);
+        pos += best;
+      } else {
+        out.push_back(in[pos++]);
+      }
+    }
+  }
+  align(out);
+  return out;
+}
+
+static Data rl(const Data &in) {
+  Data out;
+  header(out, 0x30, in.size());
+  size_t pos = 0;
+  auto run = [&](size_t at) {
+    size_t len = 1;
+    while (at + len < in.size() && len < 130 && in[at + len] == in[at]) {
+      len++;
+    }
+    return len;
+  };
+  while (pos < in.size()) {
+    size_t len = run(pos);
+    if (len >= 3) {
+      out.push_back(0x80 | (len - 3));
+      out.push_back(in[pos]);
+      pos += len;
+      continue;
+    }
+    size_t start = pos;
+    while (pos < in.size() && pos - start < 128 && run(pos) < 3) {
+      pos++;
+    }
+    out.push_back(pos - start - 1);
+    out.insert(out.end(), in.begin() + start, in.begin() + pos);
+  }
+  align(out);
+  return out;
+}
+
+static Data diff(const Data &in, bool wide) {
+  Data out;
+  header(out, wide ? 0x82 : 0x81, in.size());
+  uint16_t prev = 0;
+  for (size_t i = 0; i < in.size(); i += wide ? 2 : 1) {
+    uint16_t val = wide ? in[i] | in[i + 1] << 8 : in[i];
+    uint16_t delta = val - prev;
+    prev = val;
+    out.push_back(delta);
+    if (wide) {
+      out.push_back(delta >> 8);
+    }
+  }
+  align(out);
+  return out;
+}
+
+// Huffman over 4 or 8 bit symbols. The tree is laid out breadth first, the
+// children of the i-th inner node in pair slot i, which keeps every node's
+// 6 bit offset in range for up to 64 symbols.
+static Data huffman(const Data &in, uint32_t bits) {
+  struct Node {
+    uint32_t freq;
+    int child[2]; // -1 for a leaf
+    uint8_t symbol;
+  };
+  std::vector<Node> nodes;
+  std::vector<uint32_t> freq(1 << bits);
+  for (uint8_t byte : in) {
+    if (bits == 4) {
+      freq[byte & 0xf]++;
+      freq[byte >> 4]++;
+    } else {
+      freq[byte]++;
+    }
+  }
+  for (uint32_t sym = 0; sym < freq.size(); sym++) {
+    // The root needs two children even for a single symbol
+    if (freq[sym] || nodes.size() + (freq.size() - sym) <= 2) {
+      nodes.push_back({freq[sym], {-1, -1}, static_cast<uint8_t>(sym)});
+    }
+  }
+
+  auto heavier = [&](int a, int b) { return nodes[a].freq > nodes[b].freq; };
+  std::priority_queue<int, std::vector<int>, decltype(heavier)> queue(heavier);
+  for (size_t i = 0; i < nodes.size(); i++) {
+    queue.push(i);
+  }
+  while (queue.size() > 1) {
+    int a = queue.top();
+    queue.pop();
+    int b = queue.top();
+    queue.pop();
+    nodes.push_back({nodes[a].freq + nodes[b].freq, {a, b}, 0});
+    queue.push(nodes.size() - 1);
+  }
+  int root = queue.top();
+
+  // Breadth first: inner[i] is the node whose children fill slot i, stored
+  // itself at table[where[i]]. The root byte sits alone before slot 0.
+  std::vector<int> inner = {root};
+  std::vector<size_t> where = {0};
+  std::vector<uint8_t> table = {0};
+  std::vector<std::vector<bool>> codes(1 << bits);
+  std::vector<std::vector<bool>> path(nodes.size());
+  for (size_t i = 0; i < inner.size(); i++) {
+    const Node &node = nodes[inner[i]];
+    for (int side = 0; side < 2; side++) {
+      int child = node.child[side];
+      path[child] = path[inner[i]];
+      path[child].push_back(side);
+      if (nodes[child].child[0] < 0) {
+        // Leaf flags: bit 7 for child 0, bit 6 for child 1
+        table[where[i]] |= side ? 0x40 : 0x80;
+        table.push_back(nodes[child].symbol);
+        codes[nodes[child].symbol] = path[child];
+      } else {
+        int offset = inner.size() - i - 1;
+        if (offset > 63) {
+          return {};
+        }
+        where.push_back(table.size());
+        table.push_back(offset);
+        inner.push_back(child);
+      }
+    }
+  }
+
+  Data out;
+  header(out, 0x20 | bits, in.size());
+  // Size byte and table, padded so the bit stream is word aligned
+  while ((1 + table.size()) % 4) {
+    table.push_back(0);
+  }
+  out.push_back((1 + table.size()) / 2 - 1);
+  out.insert(out.end(), table.begin(), table.end());
+
+  uint32_t word = 0, filled = 0;
+  auto put = [&](uint32_t sym) {
+    for (bool bit : codes[sym]) {
+      word |= bit << (31 - filled);
+      if (++filled == 32) {
+        for (int b = 0; b < 4; b++) {
+          out.push_back(word >> (b * 8));
+        }
+        word = 0;
+        filled = 0;
+      }
+    }
+  };
+  for (uint8_t byte : in) {
+    if (bits == 4) {
+      put(byte & 0xf);
+      put(byte >> 4);
+    } else {
+      put(byte);
+    }
+  }
+  if (filled) {
+    for (int b = 0; b < 4; b++) {
+      out.push_back(word >> (b * 8));
+    }
+  }
+  return out;
+}
+
+// Friend of CPU
+struct Test {
+  CPU *cpu;
+  Bus *bus;
+  bool loaded;
+
+  Test(const char *bios) {
+    cpu = new CPU();
+    bus = new Bus(*cpu);
+    bus->attach_ppu(new PPU(*bus, true));
+    cpu->set_bus(bus);
+    cpu->set_hle_bios(!bios);
+    loaded = !bios || bus->load_bios(bios);
+    bus->update_wait();
+    cpu->reset();
+  }
+
+  ~Test() { delete cpu; }
+
+  // ldr r0, =SRC; ldr r1, =dst; swi; b . from IWRAM, returns what landed
+  // at `dst`
+  Data unpack(const Data &packed, uint8_t swi, uint32_t dst, size_t size) {
+    memset(bus->get_host_ptr(DST_WRAM, SRC - DST_WRAM, true), 0xee,
+           SRC - DST_WRAM);
+    memset(bus->get_host_ptr(DST_VRAM, 0x10000, true), 0xee, 0x10000);
+    memcpy(bus->get_host_ptr(SRC, packed.size(), true), packed.data(),
+           packed.size());
+    uint32_t code[] = {0xE59F0008, 0xE59F1008, 0xEF000000u | swi << 16,
+                       0xEAFFFFFE, SRC,        dst};
+    memcpy(bus->get_host_ptr(CODE, sizeof(code), true), code, sizeof(code));
+
+    cpu->set_cpsr(0x1f);
+    cpu->regs[15] = CODE;
+    cpu->arm_fetch();
+    uint64_t end = bus->scheduler.now() + MAX_CYCLES;
+    while (cpu->regs[15] - 4 != CODE + 12 && bus->scheduler.now() < end &&
+           cpu->is_running()) {
+      cpu->step();
+    }
+    CHECK_EQ(cpu->regs[15] - 4, CODE + 12);
+
+    const uint8_t *out = bus->get_host_ptr(dst, size + 1, false);
+    return Data(out, out + size + 1);
+  }
+
+  void round_trips() {
+    std::mt19937 rng(44);
+    for (int it = 0; it < 40; it++) {
+      // Multiples of 4 so every variant ends on a whole unit
+      size_t size = 4 + (rng() % 3000 & ~3u);
+      Data in(size);
+      for (size_t i = 0; i < size; i++) {
+        switch (it % 3) {
+        case 0: // Noise, mostly literals
+          in[i] = rng();
+          break;
+        case 1: // Small alphabet, skewed
+          in[i] = rng() % 4 ? rng() % 3 : rng() % 40;
+          break;
+        default: // Runs and repeats
+          in[i] = (i / 17) * 3 + (i % 5 == 0);
+          break;
+        }
+      }
+      // A breadth first tree only fits 64 symbols
+      Data in64 = in;
+      for (uint8_t &byte : in64) {
+        byte &= 0x3f;
+      }
+
+      const struct {
+        const char *name;
+        Data packed;
+        const Data &in;
+        uint8_t swi;
+        uint32_t dst;
+      } cases[] = {
+          {"LZ77UnCompWram", lz77(in, false), in, 0x11, DST_WRAM},
+          {"LZ77UnCompVram", lz77(in, true), in, 0x12, DST_VRAM},
+          {"HuffUnComp 4", huffman(in, 4), in, 0x13, DST_WRAM},
+          {"HuffUnComp 8", huffman(in64, 8), in64, 0x13, DST_WRAM},
+          {"RLUnCompWram", rl(in), in, 0x14, DST_WRAM},
+          {"RLUnCompVram", rl(in), in, 0x15, DST_VRAM},
+          {"Diff8bitUnFilterWram", diff(in, false), in, 0x16, DST_WRAM},
+          {"Diff8bitUnFilterVram", diff(in, false), in, 0x17, DST_VRAM},
+          {"Diff16bitUnFilter", diff(in, true), in, 0x18, DST_WRAM},
+      };
+      for (const auto &c : cases) {
+        CHECK(!c.packed.empty());
+        Data out = unpack(c.packed, c.swi, c.dst, size);
+        Data expected = c.in;
+        expected.push_back(0xee); // Nothing written past the end
+        if (out != expected && test_report()) {
+          size_t at = std::mismatch(out.begin(), out.end(), expected.begin())
+                          .first -
+                      out.begin();
+          printf("%s, %zu bytes (pattern %d): byte %zu is %02x, expected "
+                 "%02x\n",
+                 c.name, size, it % 3, at, out[at], expected[at]);
+        }
+      }
+    }
+  }
+};
+
+int main(int argc, char *argv[]) {
+  const char *bios = nullptr;
+  if (argc == 3 && !strcmp(argv[1], "--no-hle")) {
+    bios = argv[2];
+  }
+
+  Test test(bios);
+  if (!test.loaded) {
+    printf("decompress: skipped, no BIOS image at %s\n", bios);
+    return 77;
+  }
+  test.round_trips();
+  return test_result(bios ? "decompress (BIOS)" : "decompress (HLE)");
+}
@@ -0,0 +1,191 @@
+#include "bus.h"
+#include "test.h"
+#include <random>
+#include <vector>
+
+// The specialised barrel shifter against the runtime one it replaced, for
+// every shift type and amount source, amounts 0-31 (immediate) and 0-255
+// (register, so 0, 1-31, 32 and above), both carry ins and every kind of
+// pending lazy flag result. The decoded ARM operand 2 paths, including the
+// LSL #0 and rotated immediate shortcuts, are checked through MOVS.
+
+// The shifter before it was specialised, with the carry in passed in
+// instead of read from the flags
+static bool reference_shift(uint32_t &val, uint32_t shift_type,
+                            uint8_t shift_amount, bool shift_by_reg, bool c) {
+  if (shift_by_reg && shift_amount == 0) {
+    return c;
+  }
+
+  bool carry_out;
+  switch (shift_type) {
+  case 0: // LSL
+    if (shift_amount == 0) {
+      carry_out = c;
+    } else if (shift_amount == 32) {
+      carry_out = val & 0x1;
+      val = 0;
+    } else {
+      carry_out = shift_amount > 32 ? 0 : (val << (shift_amount - 1)) >> 31;
+      val = shift_amount > 32 ? 0 : val << shift_amount;
+    }
+    break;
+  case 1: // LSR
+    if ((!shift_by_reg && shift_amount == 0) || shift_amount == 32) {
+      carry_out = val >> 31;
+      val = 0;
+    } else {
+      carry_out = shift_amount > 32 ? 0 : (val >> (shift_amount - 1)) & 0x1;
+      val = shift_amount > 32 ? 0 : val >> shift_amount;
+    }
+    break;
+  case 2: // ASR
+    if (!shift_by_reg && shift_amount == 0) {
+      carry_out = val >> 31;
+      val = carry_out ? 0xffffffff : 0;
+    } else {
+      carry_out = shift_amount > 31
+                      ? val >> 31
+                      : (static_cast<int32_t>(val) >> (shift_amount - 1)) & 0x1;
+      val = shift_amount > 31 ? val >> 31 ? 0xffffffff : 0
+                              : static_cast<int32_t>(val) >> shift_amount;
+    }
+    break;
+  default: // ROR
+    if (!shift_by_reg && shift_amount == 0) {
+      uint32_t carry_in = c;
+      carry_out = val & 0x1;
+      val = val >> 1 | carry_in << 31;
+    } else {
+      val = (val >> (shift_amount & 0x1f)) | (val << ((-shift_amount) & 0x1f));
+      carry_out = val >> 31;
+    }
+    break;
+  }
+  return carry_out;
+}
+
+// Friend of CPU
+struct Test {
+  CPU *cpu;
+  Bus *bus;
+  std::mt19937 rng;
+  std::vector<uint32_t> values;
+
+  Test() : rng(39) {
+    cpu = new CPU();
+    bus = new Bus(*cpu);
+    bus->attach_ppu(new PPU(*bus, true));
+    cpu->set_bus(bus);
+    cpu->reset();
+
+    values = {0,          1,          2,          0x7fffffff, 0x80000000,
+              0x80000001, 0xfffffffe, 0xffffffff, 0x55555555, 0xaaaaaaaa};
+    while (values.size() < 2000) {
+      values.push_back(rng());
+    }
+  }
+
+  ~Test() { delete cpu; }
+
+  // C = `c`, either in CPSR or pending in one of the lazy flag kinds
+  void set_carry(bool c, uint32_t kind) {
+    cpu->cpsr = 0x1f;
+    cpu->flags.op = CPU::FLAGS_CLEAN;
+    switch (kind) {
+    case 0:
+      cpu->cpsr |= c ? CPU::C : 0;
+      break;
+    case 1:
+      cpu->set_nz(rng()); // C from CPSR
+      cpu->cpsr |= c ? CPU::C : 0;
+      break;
+    case 2:
+      cpu->set_logic(rng(), c);
+      break;
+    case 3:
+      cpu->set_add(0xffffffff, c, false, c ? 0 : 0xffffffff);
+      break;
+    default:
+      cpu->set_sub(c, 1, true, c - 1);
+      break;
+    }
+  }
+
+  void shifter() {
+    for (uint32_t val : values) {
+      for (int c = 0; c < 2; c++) {
+        for (uint32_t type = 0; type < 4; type++) {
+          for (int by_reg = 0; by_reg < 2; by_reg++) {
+            for (uint32_t amount = 0; amount < (by_reg ? 256u : 32u);
+                 amount++) {
+              set_carry(c, rng() % 5);
+              uint32_t expected = val, actual = val;
+              bool expected_carry =
+                  reference_shift(expected, type, amount, by_reg, c);
+              bool carry = cpu->barrel_shift(
+                  actual, static_cast<CPU::SHIFT>(type), amount, by_reg);
+              CHECK_EQ(actual, expected);
+              CHECK_EQ(carry, expected_carry);
+              CHECK_EQ(cpu->get_cc(CPU::C), c); // C itself is left alone
+            }
+          }
+        }
+      }
+    }
+  }
+
+  // movs r0, r1, <type> #amount and movs r0, r1, <type> r2
+  void operand2() {
+    for (uint32_t val : values) {
+      for (int c = 0; c < 2; c++) {
+        for (uint32_t type = 0; type < 4; type++) {
+          for (uint32_t amount = 0; amount < 32; amount++) {
+            set_carry(c, rng() % 5);
+            cpu->regs[1] = val;
+            cpu->arm_execute(0xE1B00001 | amount << 7 | type << 5);
+            uint32_t expected = val;
+            bool expected_carry =
+                reference_shift(expected, type, amount, false, c);
+            CHECK_EQ(cpu->regs[0], expected);
+            CHECK_EQ(cpu->get_cc(CPU::C), expected_carry);
+          }
+          for (uint32_t amount = 0; amount < 256; amount++) {
+            set_carry(c, rng() % 5);
+            cpu->regs[1] = val;
+            cpu->regs[2] = (rng() & 0xffffff00) | amount; // Only [7:0] count
+            cpu->arm_execute(0xE1B00211 | type << 5);
+            uint32_t expected = val;
+            bool expected_carry =
+                reference_shift(expected, type, amount, true, c);
+            CHECK_EQ(cpu->regs[0], expected);
+            CHECK_EQ(cpu->get_cc(CPU::C), expected_carry);
+          }
+        }
+      }
+    }
+  }
+
+  // movs r0, #imm for every immediate and rotation
+  void rotated_immediate() {
+    for (uint32_t imm12 = 0; imm12 < 4096; imm12++) {
+      for (int c = 0; c < 2; c++) {
+        set_carry(c, rng() % 5);
+        cpu->arm_execute(0xE3B00000 | imm12);
+        uint32_t expected = imm12 & 0xff;
+        bool expected_carry =
+            reference_shift(expected, 3, (imm12 >> 8) * 2, true, c);
+        CHECK_EQ(cpu->regs[0], expected);
+        CHECK_EQ(cpu->get_cc(CPU::C), expected_carry);
+      }
+    }
+  }
+};
+
+int main() {
+  Test test;
+  test.shifter();
+  test.operand2();
+  test.rotated_immediate();
+  return test_result("shifter");
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+
+// Minimal checks shared by the tests in this directory. Failures print their
+// location and are counted; main() returns test_result() so ctest sees them.
+// Randomised tests can fail thousands of times, only the first few print.
+
+#define TEST_MAX_REPORTS 20
+
+inline int test_failures = 0;
+
+inline bool test_report() { return ++test_failures <= TEST_MAX_REPORTS; }
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond) && test_report()) {                                            \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond);          \
+    }                                                                          \
+  } while (0)
+
+#define CHECK_EQ(actual, expected)                                             \
+  do {                                                                         \
+    uint64_t actual_ = (actual), expected_ = (expected);                       \
+    if (actual_ != expected_ && test_report()) {                               \
+      printf("%s:%d: %s is %08llx, expected %08llx\n", __FILE__, __LINE__,     \
+             #actual, static_cast<unsigned long long>(actual_),                \
+             static_cast<unsigned long long>(expected_));                      \
+    }                                                                          \
+  } while (0)
+
+inline int test_result(const char *name) {
+  if (test_failures) {
+    printf("%s: %d checks failed\n", name, test_failures);
+    return 1;
+  }
+  printf("%s: passed\n", name);
+  return 0;
+}
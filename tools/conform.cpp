@@ -0,0 +1,162 @@
+#include "bus.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+// Runs CPU test ROMs headless and judges them once they park in a terminal
+// self-branch ("b ."), the way most ARM/Thumb suites end; with interrupts
+// enabled, the branch has to hold for a full frame, interrupt handlers
+// returning to it. The result is the value of a register (r12 == 0 by
+// default, the failing test number otherwise), or for suites that only draw
+// their verdict, the hash of the screen after the frame finishes:
+//
+//   gba_conform [--reg <n>] [--pass <value>] [--timeout <frames>]
+//               [--bios <file>] [--no-hle] [--png <dir>]
+//               <rom>[=<screen hash>] ...
+//
+// A ROM that never parks within the timeout, or hits an unimplemented
+// instruction, fails. Exits with 1 if any ROM failed.
+
+#define DEFAULT_TIMEOUT 300 // Frames, 5 s of emulated time
+
+struct Options {
+  uint8_t reg = 12;
+  uint32_t pass = 0;
+  uint32_t timeout = DEFAULT_TIMEOUT;
+  const char *bios = "";
+  bool hle = true;
+  const char *png = nullptr;
+};
+
+static bool run(const Options &options, const std::string &arg) {
+  size_t eq = arg.rfind('=');
+  std::string rom = arg.substr(0, eq);
+  const char *screen = eq == std::string::npos ? nullptr : &arg[eq + 1];
+
+  if (FILE *fp = fopen(rom.c_str(), "rb")) {
+    fclose(fp);
+  } else {
+    printf("FAIL  %s: can't open\n", rom.c_str());
+    return false;
+  }
+
+  CPU *cpu = new CPU();
+  Bus *bus = new Bus(*cpu);
+  PPU *ppu = new PPU(*bus, true);
+  bus->attach_ppu(ppu);
+  cpu->set_bus(bus);
+  cpu->set_hle_bios(options.hle);
+  cpu->load(rom.c_str(), options.bios);
+
+  auto start_time = std::chrono::steady_clock::now();
+  // Only a lone instruction can leave the PC where it was; a fused pair that
+  // does is a two instruction polling loop, which doesn't count. While an
+  // interrupt can still fire, the self-branch may just be waiting for it, so
+  // it only counts once it held for a full frame: everything run outside IRQ
+  // mode was the branch, every return from the handler landed back on it.
+  // The verdict is read outside the handler.
+  auto held = [&](uint32_t pc) {
+    uint64_t frame = bus->perf.frame_count() + 2;
+    while (cpu->is_running() &&
+           (bus->perf.frame_count() < frame || cpu->in_irq_mode())) {
+      if (bus->perf.frame_count() >= options.timeout) {
+        return false;
+      }
+      cpu->step();
+      if (!cpu->in_irq_mode() && cpu->get_reg(15) != pc) {
+        return false;
+      }
+    }
+    return cpu->is_running();
+  };
+  bool parked = false;
+  while (cpu->is_running() && bus->perf.frame_count() < options.timeout) {
+    uint32_t pc = cpu->get_reg(15);
+    if (cpu->step() == 1 && cpu->get_reg(15) == pc &&
+        (cpu->irqs_masked() || !bus->irqs_enabled() || held(pc))) {
+      parked = true;
+      break;
+    }
+  }
+  uint32_t result = cpu->get_reg(options.reg);
+  uint32_t pc = cpu->get_reg(15) - (cpu->in_thumb() ? 2 : 4);
+
+  // Let the frame with the verdict finish drawing
+  uint64_t frame = bus->perf.frame_count();
+  while (parked && cpu->is_running() && bus->perf.frame_count() == frame) {
+    cpu->step();
+  }
+  double ms = std::chrono::duration<double, std::milli>(
+                  std::chrono::steady_clock::now() - start_time)
+                  .count();
+
+  char hash[17];
+  snprintf(hash, sizeof(hash), "%016llx",
+           static_cast<unsigned long long>(ppu->hash_frame()));
+
+  bool passed = parked && (screen ? !strcmp(screen, hash)
+                                  : result == options.pass);
+  printf("%s  %s  ", passed ? "PASS" : "FAIL", rom.c_str());
+  if (!parked && cpu->is_running()) {
+    printf("no self-branch within %u frames  ", options.timeout);
+  } else if (!parked) {
+    printf("stopped at an unimplemented instruction  ");
+  } else if (screen && passed) {
+    printf("screen %s  ", hash);
+  } else if (screen) {
+    printf("screen %s, expected %s  ", hash, screen);
+  } else {
+    printf("r%u=%u  ", options.reg, result);
+  }
+  printf("pc=%08x  frame %llu  %.1f ms\n", pc,
+         static_cast<unsigned long long>(bus->perf.frame_count()), ms);
+
+  if (!passed && options.png) {
+    std::string name = rom.substr(rom.rfind('/') + 1);
+    std::string path =
+        std::string(options.png) + "/" + name.substr(0, name.rfind('.')) +
+        ".png";
+    ppu->save_png(path.c_str());
+  }
+
+  delete cpu;
+  return passed;
+}
+
+int main(int argc, char *argv[]) {
+  Options options;
+  int failed = 0, roms = 0;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--reg") && i + 1 < argc) {
+      // "r7" or "7"
+      const char *reg = argv[++i];
+      options.reg = atoi(reg + (reg[0] == 'r')) & 0xf;
+    } else if (!strcmp(argv[i], "--pass") && i + 1 < argc) {
+      options.pass = strtoul(argv[++i], nullptr, 0);
+    } else if (!strcmp(argv[i], "--timeout") && i + 1 < argc) {
+      options.timeout = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--bios") && i + 1 < argc) {
+      options.bios = argv[++i];
+    } else if (!strcmp(argv[i], "--no-hle")) {
+      options.hle = false;
+    } else if (!strcmp(argv[i], "--png") && i + 1 < argc) {
+      options.png = argv[++i];
+    } else {
+      roms++;
+      failed += !run(options, argv[i]);
+    }
+  }
+
+  if (!roms) {
+    fprintf(stderr,
+            "Usage: %s [--reg <n>] [--pass <value>] [--timeout <frames>] "
+            "[--bios <file>] [--no-hle] [--png <dir>] "
+            "<rom>[=<screen hash>] ...\n",
+            argv[0]);
+    return 2;
+  }
+  printf("%d/%d passed\n", roms - failed, roms);
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,271 @@
+#include "bus.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Golden frame regression runner. Every manifest line names a ROM, an input
+// movie or "-" for none, and the frames to check with their expected
+// PPU::hash_frame() value:
+//
+//   # rom            movie           frame=hash ...
+//   games/demo.gba   -               60=0123456789abcdef 600=?
+//   games/rpg.gba    movies/rpg.gbam 1800=fedcba9876543210
+//
+// Paths are relative to the manifest. A frame is checked at the start of its
+// VBlank, once it has been drawn completely; a movie must reach it. Jobs run
+// headless in parallel. Mismatches are dumped as <name>-actual.png next to
+// the golden <name>-expected.png in the output directory.
+//
+//   gba_regress [-j <jobs>] [--out <dir>] [--update] <manifest>
+//
+// --update writes the actual hashes back into the manifest and the frames
+// into the golden directory (golden/ next to the manifest).
+
+struct Check {
+  uint32_t frame;
+  std::string expected; // 16 hex digits, "?" if not known yet
+  std::string actual;
+};
+
+struct Job {
+  size_t line;
+  std::string rom;
+  std::string movie; // "-" for none
+  std::vector<Check> checks;
+
+  std::string error;
+  double seconds = 0;
+  bool passed = false;
+};
+
+namespace fs = std::filesystem;
+
+static std::string resolve(const std::string &base, const std::string &path) {
+  return (fs::path(base) / path).string();
+}
+
+// Golden frames and dumps are named after the ROM, the movie and the frame
+static std::string frame_name(const Job &job, uint32_t frame) {
+  std::string name = fs::path(job.rom).stem().string();
+  if (job.movie != "-") {
+    name += "-" + fs::path(job.movie).stem().string();
+  }
+  return name + "-" + std::to_string(frame);
+}
+
+static bool parse(const std::string &text, size_t line, Job &job) {
+  std::istringstream in(text);
+  job.line = line;
+  if (!(in >> job.rom >> job.movie)) {
+    return false;
+  }
+  std::string check;
+  while (in >> check) {
+    size_t eq = check.find('=');
+    // The frame must be all digits, strtoul alone would also take a sign
+    if (eq == std::string::npos || eq == 0 || !isdigit(uint8_t(check[0]))) {
+      return false;
+    }
+    char *end;
+    uint32_t frame = strtoul(check.c_str(), &end, 10);
+    if (end != check.c_str() + eq) {
+      return false;
+    }
+    job.checks.push_back(Check{frame, check.substr(eq + 1), ""});
+  }
+  std::sort(job.checks.begin(), job.checks.end(),
+            [](const Check &a, const Check &b) { return a.frame < b.frame; });
+  return !job.checks.empty();
+}
+
+static void run(Job &job, const std::string &base, const std::string &out,
+                bool update) {
+  auto start_time = std::chrono::steady_clock::now();
+  std::string rom = resolve(base, job.rom);
+  if (FILE *fp = fopen(rom.c_str(), "rb")) {
+    fclose(fp);
+  } else {
+    job.error = "can't open " + rom;
+    return;
+  }
+
+  CPU *cpu = new CPU();
+  Bus *bus = new Bus(*cpu);
+  PPU *ppu = new PPU(*bus, true);
+  bus->attach_ppu(ppu);
+  cpu->set_bus(bus);
+  // No BIOS image, the stand-in keeps every host on the same start state
+  cpu->load(rom.c_str(), "");
+
+  Movie movie(*cpu, *bus);
+  if (job.movie != "-") {
+    std::string path = resolve(base, job.movie);
+    if (!movie.load(path.c_str())) {
+      job.error = "can't replay " + path;
+      delete cpu;
+      return;
+    }
+    cpu->set_hle_bios(movie.get_hle_bios());
+    bus->attach_movie(&movie);
+    movie.replay();
+  }
+
+  job.passed = true;
+  for (Check &check : job.checks) {
+    while (bus->perf.frame_count() < check.frame && cpu->is_running()) {
+      cpu->step();
+    }
+    if (bus->perf.frame_count() < check.frame) {
+      job.error = "stopped at frame " + std::to_string(bus->perf.frame_count());
+      job.passed = false;
+      break;
+    }
+
+    char hash[17];
+    snprintf(hash, sizeof(hash), "%016llx",
+             static_cast<unsigned long long>(ppu->hash_frame()));
+    check.actual = hash;
+    std::string name = frame_name(job, check.frame);
+    if (update) {
+      ppu->save_png(resolve(base, "golden/" + name + ".png").c_str());
+    } else if (check.actual != check.expected) {
+      job.passed = false;
+      ppu->save_png(resolve(out, name + "-actual.png").c_str());
+      std::ifstream golden(resolve(base, "golden/" + name + ".png"),
+                           std::ios::binary);
+      if (golden) {
+        std::ofstream(resolve(out, name + "-expected.png"), std::ios::binary)
+            << golden.rdbuf();
+      }
+    }
+  }
+
+  bus->attach_movie(nullptr);
+  delete cpu;
+  job.seconds = std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - start_time)
+                    .count();
+}
+
+int main(int argc, char *argv[]) {
+  unsigned jobs = std::max(1u, std::thread::hardware_concurrency());
+  const char *out = "regress";
+  const char *manifest = nullptr;
+  bool update = false;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+      jobs = std::max(1, atoi(argv[++i]));
+    } else if (!strcmp(argv[i], "--out") && i + 1 < argc) {
+      out = argv[++i];
+    } else if (!strcmp(argv[i], "--update")) {
+      update = true;
+    } else {
+      manifest = argv[i];
+    }
+  }
+  if (!manifest) {
+    fprintf(stderr,
+            "Usage: %s [-j <jobs>] [--out <dir>] [--update] <manifest>\n",
+            argv[0]);
+    return 2;
+  }
+
+  std::ifstream in(manifest);
+  if (!in) {
+    fprintf(stderr, "Can't open %s\n", manifest);
+    return 2;
+  }
+  std::vector<std::string> lines;
+  std::vector<Job> queue;
+  for (std::string text; std::getline(in, text);) {
+    lines.push_back(text);
+    size_t first = text.find_first_not_of(" \t");
+    if (first == std::string::npos || text[first] == '#') {
+      continue;
+    }
+    Job job;
+    if (!parse(text, lines.size(), job)) {
+      fprintf(stderr, "%s:%zu: expected <rom> <movie|-> <frame>=<hash>...\n",
+              manifest, lines.size());
+      return 2;
+    }
+    queue.push_back(job);
+  }
+
+  std::string base = fs::path(manifest).parent_path().string();
+  std::error_code error;
+  fs::create_directories(out, error);
+  fs::create_directories(resolve(base, "golden"), error);
+
+  // Workers take the next job until the queue is empty
+  auto start_time = std::chrono::steady_clock::now();
+  std::atomic<size_t> next(0);
+  std::mutex print_lock;
+  std::vector<std::thread> workers;
+  for (unsigned w = 0; w < std::min<size_t>(jobs, queue.size()); w++) {
+    workers.emplace_back([&] {
+      for (size_t i; (i = next++) < queue.size();) {
+        Job &job = queue[i];
+        run(job, base, out, update);
+
+        std::lock_guard<std::mutex> lock(print_lock);
+        if (!job.error.empty()) {
+          printf("ERROR %s:%zu %s: %s\n", manifest, job.line, job.rom.c_str(),
+                 job.error.c_str());
+          continue;
+        }
+        printf("%-5s %s:%zu %s (%.2f s)\n",
+               update ? "DONE" : job.passed ? "PASS" : "FAIL", manifest,
+               job.line, job.rom.c_str(), job.seconds);
+        for (const Check &check : job.checks) {
+          if (!update && check.actual != check.expected) {
+            printf("      frame %u: expected %s, got %s (%s/%s-*.png)\n",
+                   check.frame, check.expected.c_str(), check.actual.c_str(),
+                   out, frame_name(job, check.frame).c_str());
+          }
+        }
+        fflush(stdout);
+      }
+    });
+  }
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+
+  size_t failed = 0;
+  for (Job &job : queue) {
+    failed += !job.passed || !job.error.empty();
+    if (update && job.error.empty()) {
+      std::string text = job.rom + " " + job.movie;
+      for (const Check &check : job.checks) {
+        text += " " + std::to_string(check.frame) + "=" + check.actual;
+      }
+      lines[job.line - 1] = text;
+    }
+  }
+  if (update) {
+    std::ofstream rewrite(manifest);
+    for (const std::string &text : lines) {
+      rewrite << text << "\n";
+    }
+  }
+
+  printf("%zu/%zu passed in %.2f s with %u jobs\n", queue.size() - failed,
+         queue.size(),
+         std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start_time)
+             .count(),
+         jobs);
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,178 @@
+#include "trace.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+// Converts between the compact trace format (trace.h) and the flat
+// regs.bin / instr.bin pair gba_tracediff and other emulators use.
+//
+//   gba_traceconv pack [-k <interval>] <regs.bin> <instr.bin> <out.gbt>
+//   gba_traceconv unpack [--from <record>] [--count <records>] <in.gbt>
+//                 <regs.bin> <instr.bin>
+//   gba_traceconv info <in.gbt>
+
+// Records converted per read / write call
+#define BATCH 65536
+
+static int usage(const char *argv0) {
+  fprintf(stderr,
+          "Usage: %s pack [-k <interval>] <regs.bin> <instr.bin> <out.gbt>\n"
+          "       %s unpack [--from <record>] [--count <records>] <in.gbt> "
+          "<regs.bin> <instr.bin>\n"
+          "       %s info <in.gbt>\n",
+          argv0, argv0, argv0);
+  return 2;
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+static int pack(const char *regs_path, const char *instr_path,
+                const char *out_path, uint32_t interval) {
+  FILE *regs = fopen(regs_path, "rb");
+  FILE *instr = fopen(instr_path, "rb");
+  if (!regs || !instr) {
+    perror(regs ? instr_path : regs_path);
+    return 1;
+  }
+  TraceWriter writer;
+  if (!writer.open(out_path, interval)) {
+    perror(out_path);
+    return 1;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<uint32_t> regs_batch(BATCH * TRACE_REGS), instr_batch(BATCH);
+  uint64_t records = 0;
+  size_t n;
+  while ((n = fread(regs_batch.data(), 4 * TRACE_REGS, BATCH, regs))) {
+    // A shorter instr.bin leaves the rest of the opcodes zero
+    size_t m = fread(instr_batch.data(), 4, n, instr);
+    memset(instr_batch.data() + m, 0, (n - m) * 4);
+    for (size_t i = 0; i < n; i++) {
+      TraceRecord record;
+      memcpy(record.regs, &regs_batch[i * TRACE_REGS], sizeof(record.regs));
+      record.instr = instr_batch[i];
+      writer.write(record);
+    }
+    records += n;
+  }
+  fclose(regs);
+  fclose(instr);
+  if (!writer.close()) {
+    fprintf(stderr, "Failed to write %s\n", out_path);
+    return 1;
+  }
+  printf("%llu records packed in %.3f s\n",
+         static_cast<unsigned long long>(records), seconds_since(start));
+  return 0;
+}
+
+static int unpack(const char *in_path, const char *regs_path,
+                  const char *instr_path, uint64_t from, uint64_t count) {
+  TraceReader reader;
+  if (!reader.open(in_path)) {
+    fprintf(stderr, "%s: not a readable trace\n", in_path);
+    return 1;
+  }
+  if (!reader.seek(from)) {
+    fprintf(stderr, "%s: only %llu records\n", in_path,
+            static_cast<unsigned long long>(reader.get_records()));
+    return 1;
+  }
+  FILE *regs = fopen(regs_path, "wb");
+  FILE *instr = fopen(instr_path, "wb");
+  if (!regs || !instr) {
+    perror(regs ? instr_path : regs_path);
+    return 1;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<uint32_t> regs_batch(BATCH * TRACE_REGS), instr_batch(BATCH);
+  uint64_t records = 0;
+  bool ok = true;
+  while (records < count) {
+    size_t n = 0;
+    TraceRecord record;
+    while (n < BATCH && records + n < count && reader.read(record)) {
+      memcpy(&regs_batch[n * TRACE_REGS], record.regs, sizeof(record.regs));
+      instr_batch[n] = record.instr;
+      n++;
+    }
+    if (!n) {
+      break;
+    }
+    ok &= fwrite(regs_batch.data(), 4 * TRACE_REGS, n, regs) == n;
+    ok &= fwrite(instr_batch.data(), 4, n, instr) == n;
+    records += n;
+  }
+  ok &= !fclose(regs);
+  ok &= !fclose(instr);
+  if (!ok) {
+    fprintf(stderr, "Failed to write %s / %s\n", regs_path, instr_path);
+    return 1;
+  }
+  printf("%llu records unpacked in %.3f s\n",
+         static_cast<unsigned long long>(records), seconds_since(start));
+  return 0;
+}
+
+static int info(const char *in_path) {
+  TraceReader reader;
+  if (!reader.open(in_path)) {
+    fprintf(stderr, "%s: not a readable trace\n", in_path);
+    return 1;
+  }
+  FILE *fp = fopen(in_path, "rb");
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fclose(fp);
+
+  uint64_t records = reader.get_records();
+  uint64_t flat = records * 4 * (TRACE_REGS + 1);
+  printf("%llu records, keyframe every %u\n",
+         static_cast<unsigned long long>(records), reader.get_interval());
+  printf("%ld bytes, %.2f per record, %.1fx smaller than regs.bin + "
+         "instr.bin\n",
+         size, records ? double(size) / records : 0.0,
+         size ? double(flat) / size : 0.0);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    return usage(argv[0]);
+  }
+  const char *mode = argv[1];
+  uint32_t interval = TRACE_DEFAULT_INTERVAL;
+  uint64_t from = 0, count = UINT64_MAX;
+  const char *paths[3] = {};
+  int n = 0;
+  for (int i = 2; i < argc; i++) {
+    if (!strcmp(argv[i], "-k") && i + 1 < argc) {
+      interval = strtoul(argv[++i], nullptr, 0);
+    } else if (!strcmp(argv[i], "--from") && i + 1 < argc) {
+      from = strtoull(argv[++i], nullptr, 0);
+    } else if (!strcmp(argv[i], "--count") && i + 1 < argc) {
+      count = strtoull(argv[++i], nullptr, 0);
+    } else if (n < 3) {
+      paths[n++] = argv[i];
+    } else {
+      return usage(argv[0]);
+    }
+  }
+
+  if (!strcmp(mode, "pack") && n == 3) {
+    return pack(paths[0], paths[1], paths[2], interval);
+  } else if (!strcmp(mode, "unpack") && n == 3) {
+    return unpack(paths[0], paths[1], paths[2], from, count);
+  } else if (!strcmp(mode, "info") && n == 1) {
+    return info(paths[0]);
+  }
+  return usage(argv[0]);
+}
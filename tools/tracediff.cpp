@@ -0,0 +1,452 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TRACEDIFF_X86
+#endif
+
+// Finds the first instruction where two flat traces disagree and prints the
+// instructions leading up to it. `gba_traceconv unpack` turns the trace the
+// emulator writes with --trace into this layout.
+//
+//   gba_tracediff [-C <records>] <regs.bin> <reference regs.bin>
+//                 [<instr.bin> <reference instr.bin>]
+//
+// regs.bin holds r0-r15, CPSR and SPSR for every instruction, before it
+// executes. instr.bin holds the opcode, Thumb ones zero extended.
+
+#define REGS_WORDS 18
+#define RECORD_SIZE (REGS_WORDS * 4)
+
+// Compared per call, small enough to stay ahead of the page cache readahead
+#define CHUNK_SIZE (64 << 20)
+
+struct Trace {
+  const uint8_t *data;
+  size_t size;
+};
+
+static bool map(const char *path, Trace &trace) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    perror(path);
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st)) {
+    perror(path);
+    close(fd);
+    return false;
+  }
+  trace.size = st.st_size;
+  trace.data = nullptr;
+  if (trace.size) {
+    void *p = mmap(nullptr, trace.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+      perror(path);
+      close(fd);
+      return false;
+    }
+    madvise(p, trace.size, MADV_SEQUENTIAL);
+    trace.data = static_cast<const uint8_t *>(p);
+  }
+  close(fd);
+  return true;
+}
+
+// Offset of the first byte that differs, or `size`
+using DiffFunc = size_t (*)(const uint8_t *a, const uint8_t *b, size_t size);
+
+static size_t diff_scalar(const uint8_t *a, const uint8_t *b, size_t size) {
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t x, y;
+    memcpy(&x, a + i, 8);
+    memcpy(&y, b + i, 8);
+    if (x != y) {
+      break;
+    }
+  }
+  for (; i < size && a[i] == b[i]; i++) {
+  }
+  return i;
+}
+
+#ifdef TRACEDIFF_X86
+__attribute__((target("sse2"))) static size_t
+diff_sse2(const uint8_t *a, const uint8_t *b, size_t size) {
+  size_t i = 0;
+  for (; i + 64 <= size; i += 64) {
+    const __m128i *pa = reinterpret_cast<const __m128i *>(a + i);
+    const __m128i *pb = reinterpret_cast<const __m128i *>(b + i);
+    __m128i e0 = _mm_cmpeq_epi8(_mm_loadu_si128(pa), _mm_loadu_si128(pb));
+    __m128i e1 =
+        _mm_cmpeq_epi8(_mm_loadu_si128(pa + 1), _mm_loadu_si128(pb + 1));
+    __m128i e2 =
+        _mm_cmpeq_epi8(_mm_loadu_si128(pa + 2), _mm_loadu_si128(pb + 2));
+    __m128i e3 =
+        _mm_cmpeq_epi8(_mm_loadu_si128(pa + 3), _mm_loadu_si128(pb + 3));
+    __m128i all = _mm_and_si128(_mm_and_si128(e0, e1), _mm_and_si128(e2, e3));
+    if (_mm_movemask_epi8(all) != 0xffff) {
+      break;
+    }
+  }
+  return i + diff_scalar(a + i, b + i, size - i);
+}
+
+__attribute__((target("avx2"))) static size_t
+diff_avx2(const uint8_t *a, const uint8_t *b, size_t size) {
+  size_t i = 0;
+  for (; i + 128 <= size; i += 128) {
+    const __m256i *pa = reinterpret_cast<const __m256i *>(a + i);
+    const __m256i *pb = reinterpret_cast<const __m256i *>(b + i);
+    __m256i e0 =
+        _mm256_cmpeq_epi8(_mm256_loadu_si256(pa), _mm256_loadu_si256(pb));
+    __m256i e1 = _mm256_cmpeq_epi8(_mm256_loadu_si256(pa + 1),
+                                   _mm256_loadu_si256(pb + 1));
+    __m256i e2 = _mm256_cmpeq_epi8(_mm256_loadu_si256(pa + 2),
+                                   _mm256_loadu_si256(pb + 2));
+    __m256i e3 = _mm256_cmpeq_epi8(_mm256_loadu_si256(pa + 3),
+                                   _mm256_loadu_si256(pb + 3));
+    __m256i all =
+        _mm256_and_si256(_mm256_and_si256(e0, e1), _mm256_and_si256(e2, e3));
+    if (_mm256_movemask_epi8(all) != -1) {
+      break;
+    }
+  }
+  return i + diff_scalar(a + i, b + i, size - i);
+}
+#endif
+
+static DiffFunc pick_kernel(const char *&name) {
+#ifdef TRACEDIFF_X86
+  if (__builtin_cpu_supports("avx2")) {
+    name = "avx2";
+    return diff_avx2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    name = "sse2";
+    return diff_sse2;
+  }
+#endif
+  name = "scalar";
+  return diff_scalar;
+}
+
+// First record of `record_size` bytes that differs, or the shorter length in
+// records if one trace is a prefix of the other
+static uint64_t first_diff(DiffFunc diff, const Trace &a, const Trace &b,
+                           size_t record_size) {
+  size_t size = std::min(a.size, b.size) / record_size * record_size;
+  for (size_t off = 0; off < size; off += CHUNK_SIZE) {
+    size_t len = std::min<size_t>(CHUNK_SIZE, size - off);
+    size_t at = diff(a.data + off, b.data + off, len);
+    if (at < len) {
+      return (off + at) / record_size;
+    }
+  }
+  return size / record_size;
+}
+
+static uint32_t word(const Trace &trace, uint64_t index) {
+  uint32_t value;
+  memcpy(&value, trace.data + index * 4, 4);
+  return value;
+}
+
+static const char *mode_name(uint32_t cpsr) {
+  switch (cpsr & 0x1f) {
+  case 0x10:
+    return "usr";
+  case 0x11:
+    return "fiq";
+  case 0x12:
+    return "irq";
+  case 0x13:
+    return "svc";
+  case 0x17:
+    return "abt";
+  case 0x1b:
+    return "und";
+  case 0x1f:
+    return "sys";
+  default:
+    return "???";
+  }
+}
+
+static const char *const alu_names[16] = {
+    "and", "eor", "sub", "rsb", "add", "adc", "sbc", "rsc",
+    "tst", "teq", "cmp", "cmn", "orr", "mov", "bic", "mvn",
+};
+
+static const char *const thumb_alu_names[16] = {
+    "and", "eor", "lsl", "lsr", "asr", "adc", "sbc", "ror",
+    "tst", "neg", "cmp", "cmn", "orr", "mul", "bic", "mvn",
+};
+
+static const char *const cond_names[16] = {
+    "eq", "ne", "cs", "cc", "mi", "pl", "vs", "vc",
+    "hi", "ls", "ge", "lt", "gt", "le", "",   "nv",
+};
+
+// Instruction class and the main operation, enough to follow control flow
+static void decode_arm(uint32_t i, char *out, size_t size) {
+  const char *op;
+  if ((i & 0x0ffffff0) == 0x012fff10) {
+    op = "bx";
+  } else if ((i & 0x0fb00ff0) == 0x01000090) {
+    op = (i & (1 << 22)) ? "swpb" : "swp";
+  } else if ((i & 0x0fc000f0) == 0x00000090) {
+    op = (i & (1 << 21)) ? "mla" : "mul";
+  } else if ((i & 0x0f8000f0) == 0x00800090) {
+    op = (i & (1 << 21)) ? "mlal" : "mull";
+  } else if ((i & 0x0e000090) == 0x00000090) {
+    op = (i & (1 << 20)) ? "ldrh" : "strh";
+  } else if ((i & 0x0fbf0fff) == 0x010f0000) {
+    op = "mrs";
+  } else if ((i & 0x0db0f000) == 0x0120f000) {
+    op = "msr";
+  } else if ((i & 0x0c000000) == 0) {
+    op = alu_names[(i >> 21) & 0xf];
+  } else if ((i & 0x0c000000) == 0x04000000) {
+    op = (i & (1 << 20)) ? ((i & (1 << 22)) ? "ldrb" : "ldr")
+                         : ((i & (1 << 22)) ? "strb" : "str");
+  } else if ((i & 0x0e000000) == 0x08000000) {
+    op = (i & (1 << 20)) ? "ldm" : "stm";
+  } else if ((i & 0x0e000000) == 0x0a000000) {
+    op = (i & (1 << 24)) ? "bl" : "b";
+  } else if ((i & 0x0f000000) == 0x0f000000) {
+    op = "swi";
+  } else {
+    op = "cop";
+  }
+  snprintf(out, size, "%s%s", op, cond_names[i >> 28]);
+}
+
+static void decode_thumb(uint16_t i, char *out, size_t size) {
+  static const char *const shifts[3] = {"lsl", "lsr", "asr"};
+  static const char *const imm_ops[4] = {"mov", "cmp", "add", "sub"};
+  static const char *const hi_ops[4] = {"add", "cmp", "mov", "bx"};
+  const char *op;
+  switch (i >> 11) {
+  case 0x00 ... 0x02:
+    op = shifts[i >> 11];
+    break;
+  case 0x03:
+    op = (i & (1 << 9)) ? "sub" : "add";
+    break;
+  case 0x04 ... 0x07:
+    op = imm_ops[(i >> 11) & 3];
+    break;
+  case 0x08:
+    if (!(i & (1 << 10))) {
+      op = thumb_alu_names[(i >> 6) & 0xf];
+    } else {
+      op = hi_ops[(i >> 8) & 3];
+    }
+    break;
+  case 0x09:
+    op = "ldr pc";
+    break;
+  case 0x0a ... 0x0b:
+    op = (i & (1 << 11)) ? "ldr" : "str";
+    break;
+  case 0x0c ... 0x0f:
+    op = (i & (1 << 11)) ? ((i & (1 << 12)) ? "ldrb" : "ldr")
+                         : ((i & (1 << 12)) ? "strb" : "str");
+    break;
+  case 0x10 ... 0x11:
+    op = (i & (1 << 11)) ? "ldrh" : "strh";
+    break;
+  case 0x12 ... 0x13:
+    op = (i & (1 << 11)) ? "ldr sp" : "str sp";
+    break;
+  case 0x14 ... 0x15:
+    op = (i & (1 << 11)) ? "add sp" : "add pc";
+    break;
+  case 0x16 ... 0x17:
+    if ((i & 0x0f00) == 0x0000) {
+      op = "add sp";
+    } else if ((i & 0x0600) == 0x0400) {
+      op = (i & (1 << 11)) ? "pop" : "push";
+    } else {
+      op = "und";
+    }
+    break;
+  case 0x18 ... 0x19:
+    op = (i & (1 << 11)) ? "ldmia" : "stmia";
+    break;
+  case 0x1a ... 0x1b:
+    if ((i & 0x0f00) == 0x0f00) {
+      op = "swi";
+    } else {
+      snprintf(out, size, "b%s", cond_names[(i >> 8) & 0xf]);
+      return;
+    }
+    break;
+  case 0x1c:
+    op = "b";
+    break;
+  case 0x1e:
+    op = "bl hi";
+    break;
+  case 0x1f:
+    op = "bl lo";
+    break;
+  default:
+    op = "und";
+    break;
+  }
+  snprintf(out, size, "%s", op);
+}
+
+// One line per instruction: address, state, opcode, then the registers that
+// changed since the previous record
+static void print_record(const Trace &regs, const Trace *instr,
+                         uint64_t index) {
+  const uint64_t base = index * REGS_WORDS;
+  uint32_t cpsr = word(regs, base + 16);
+  bool thumb = cpsr & (1 << 5);
+  uint32_t pc = word(regs, base + 15) - (thumb ? 4 : 8);
+
+  printf("%12llu  %08x %s %s", static_cast<unsigned long long>(index), pc,
+         thumb ? "T" : "A", mode_name(cpsr));
+  if (instr && (index + 1) * 4 <= instr->size) {
+    uint32_t opcode = word(*instr, index);
+    char text[16];
+    if (thumb) {
+      decode_thumb(opcode, text, sizeof(text));
+      printf("  %04x      %-8s", opcode & 0xffff, text);
+    } else {
+      decode_arm(opcode, text, sizeof(text));
+      printf("  %08x  %-8s", opcode, text);
+    }
+  }
+  if (index) {
+    for (int r = 0; r < REGS_WORDS; r++) {
+      uint32_t now = word(regs, base + r);
+      if (r != 15 && now != word(regs, base - REGS_WORDS + r)) {
+        static const char *const names[3] = {"pc", "cpsr", "spsr"};
+        if (r < 15) {
+          printf(" r%d=%08x", r, now);
+        } else {
+          printf(" %s=%08x", names[r - 15], now);
+        }
+      }
+    }
+  }
+  printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+  uint64_t context = 16;
+  const char *paths[4] = {};
+  int n = 0;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-C") && i + 1 < argc) {
+      context = strtoull(argv[++i], nullptr, 0);
+    } else if (n < 4) {
+      paths[n++] = argv[i];
+    } else {
+      n = 5;
+    }
+  }
+  if (n != 2 && n != 4) {
+    fprintf(stderr,
+            "Usage: %s [-C <records>] <regs.bin> <reference regs.bin> "
+            "[<instr.bin> <reference instr.bin>]\n",
+            argv[0]);
+    return 2;
+  }
+
+  Trace traces[4] = {};
+  for (int i = 0; i < n; i++) {
+    if (!map(paths[i], traces[i])) {
+      return 2;
+    }
+  }
+  const Trace &regs_a = traces[0], &regs_b = traces[1];
+  const Trace *instr_a = (n == 4) ? &traces[2] : nullptr;
+  const Trace *instr_b = (n == 4) ? &traces[3] : nullptr;
+
+  const char *kernel;
+  DiffFunc diff = pick_kernel(kernel);
+
+  auto start_time = std::chrono::steady_clock::now();
+  uint64_t records_a = regs_a.size / RECORD_SIZE;
+  uint64_t records_b = regs_b.size / RECORD_SIZE;
+  uint64_t at = first_diff(diff, regs_a, regs_b, RECORD_SIZE);
+  if (instr_a) {
+    Trace a = *instr_a, b = *instr_b;
+    a.size = std::min<size_t>(a.size, at * 4);
+    b.size = std::min<size_t>(b.size, at * 4);
+    uint64_t instr_at = first_diff(diff, a, b, 4);
+    // Only earlier if both logs cover it, a short log just has no opcodes
+    if (instr_at < at && (instr_at + 1) * 4 <= a.size &&
+        (instr_at + 1) * 4 <= b.size) {
+      at = instr_at;
+    }
+  }
+  double elapsed = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start_time)
+                       .count();
+  double compared = 2.0 * at * RECORD_SIZE;
+  fprintf(stderr, "%llu records compared in %.3f s (%.2f GB/s, %s)\n",
+          static_cast<unsigned long long>(at), elapsed,
+          elapsed > 0 ? compared / elapsed / 1e9 : 0.0, kernel);
+
+  uint64_t common = std::min(records_a, records_b);
+  if (at == common) {
+    if (records_a == records_b) {
+      printf("Traces match, %llu records\n",
+             static_cast<unsigned long long>(common));
+      return 0;
+    }
+    printf("Traces match for %llu records, then %s ends\n",
+           static_cast<unsigned long long>(common),
+           records_a < records_b ? "the first" : "the reference");
+    return 1;
+  }
+
+  printf("First divergence at record %llu\n\n",
+         static_cast<unsigned long long>(at));
+  for (uint64_t i = (at > context) ? at - context : 0; i < at; i++) {
+    print_record(regs_a, instr_a, i);
+  }
+
+  printf("\n%-6s %-10s %-10s\n", "", paths[0], paths[1]);
+  static const char *const names[REGS_WORDS] = {
+      "r0", "r1", "r2",  "r3",  "r4",  "r5", "r6",   "r7",   "r8",
+      "r9", "r10", "r11", "r12", "sp", "lr", "pc", "cpsr", "spsr",
+  };
+  if (instr_a && (at + 1) * 4 <= std::min(instr_a->size, instr_b->size)) {
+    uint32_t a = word(*instr_a, at), b = word(*instr_b, at);
+    printf("%-6s %08x   %08x %s\n", "instr", a, b, a != b ? "<" : "");
+  }
+  for (int r = 0; r < REGS_WORDS; r++) {
+    uint32_t a = word(regs_a, at * REGS_WORDS + r);
+    uint32_t b = word(regs_b, at * REGS_WORDS + r);
+    printf("%-6s %08x   %08x %s\n", names[r], a, b, a != b ? "<" : "");
+  }
+
+  // Where each side goes next
+  printf("\n%s:\n", paths[0]);
+  for (uint64_t i = at; i < std::min(at + 4, records_a); i++) {
+    print_record(regs_a, instr_a, i);
+  }
+  printf("%s:\n", paths[1]);
+  for (uint64_t i = at; i < std::min(at + 4, records_b); i++) {
+    print_record(regs_b, instr_b, i);
+  }
+  return 1;
+}